@@ -0,0 +1,40 @@
+# Generates a C++ source file defining the contents of a file as a byte
+# array, for embedding the kernels into the library.
+#
+# Usage: cmake -DINPUT=<file> -DOUTPUT=<file.cpp> -DNAME=<symbol>
+#              -P EmbedFile.cmake
+#
+# The generated file defines NAME (unsigned char array) and NAME_SIZE
+# in the argon2::opencl::EmbeddedKernels namespace.
+
+file(READ "${INPUT}" CONTENT HEX)
+string(LENGTH "${CONTENT}" HEX_LENGTH)
+math(EXPR SIZE "${HEX_LENGTH} / 2")
+
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${CONTENT}")
+# 12 bytes per line:
+set(LINE_PATTERN "")
+foreach(I RANGE 11)
+    set(LINE_PATTERN "${LINE_PATTERN}0x[0-9a-f][0-9a-f],")
+endforeach()
+string(REGEX REPLACE "(${LINE_PATTERN})" "\\1\n    " BYTES "${BYTES}")
+
+get_filename_component(INPUT_NAME "${INPUT}" NAME)
+file(WRITE "${OUTPUT}"
+"/* Generated from ${INPUT_NAME} by EmbedFile.cmake -- do not edit. */
+
+#include \"embeddedkernels.h\"
+
+namespace argon2 {
+namespace opencl {
+namespace EmbeddedKernels {
+
+extern const unsigned char ${NAME}[] = {
+    ${BYTES}
+};
+extern const std::size_t ${NAME}_SIZE = ${SIZE};
+
+} // namespace EmbeddedKernels
+} // namespace opencl
+} // namespace argon2
+")
@@ -41,6 +41,24 @@ typedef ptrdiff_t intptr_t;
 #define THREADS_PER_LANE 32
 #define QWORDS_PER_THREAD (ARGON2_QWORDS_IN_BLOCK / 32)
 
+#if QWORDS_PER_THREAD != 4
+#error "The block layout requires QWORDS_PER_THREAD == 4"
+#endif
+
+#if defined(ARGON2_REGISTER_STATE)
+/* each work-item owns the qwords used by its G in the first round of
+ * shuffle_block, so that it can do the first round in registers: */
+#define QWORD_INDEX(thread, i) \
+    ((thread) / 4 * 16 + (i) * 4 + (thread) % 4)
+#elif defined(ARGON2_VECTOR_ACCESS)
+/* each work-item owns QWORDS_PER_THREAD consecutive qwords of a block,
+ * so that it can move them with a single vector load/store: */
+#define QWORD_INDEX(thread, i) ((thread) * QWORDS_PER_THREAD + (i))
+#else
+/* each work-item owns every THREADS_PER_LANE-th qword of a block: */
+#define QWORD_INDEX(thread, i) ((i) * THREADS_PER_LANE + (thread))
+#endif
+
 #ifndef ARGON2_VERSION
 #define ARGON2_VERSION ARGON2_VERSION_13
 #endif
@@ -49,12 +67,88 @@ typedef ptrdiff_t intptr_t;
 #define ARGON2_TYPE ARGON2_I
 #endif
 
+/*
+ * F() (the BlaMka multiply-add) and rotr64() dominate the ALU work of the
+ * kernel. The host enables the fast paths below according to the devices
+ * the program is built for (see KernelLoader); the rotation amount n is
+ * always a compile-time constant, so the branches on it fold away.
+ */
+#if defined(ARGON2_ARCH_NVIDIA) && !defined(ARGON2_PORTABLE_ARITHMETIC)
+/* NVIDIA: 32x32->64 multiply-add and (sm_32+) funnel shifts in PTX: */
+ulong f_nv(ulong x, ulong y)
+{
+    uint xl = (uint)x, yl = (uint)y;
+    ulong res = x + y;
+    asm("mad.wide.u32 %0, %1, %2, %0;" : "+l"(res) : "r"(xl), "r"(yl));
+    asm("mad.wide.u32 %0, %1, %2, %0;" : "+l"(res) : "r"(xl), "r"(yl));
+    return res;
+}
+
+#define F(x, y) f_nv(x, y)
+
+#ifdef ARGON2_NV_FUNNEL_SHIFT
+ulong rotr64_nv(ulong x, uint n)
+{
+    uint lo = (uint)x, hi = (uint)(x >> 32);
+    if (n >= 32) {
+        uint tmp = lo;
+        lo = hi;
+        hi = tmp;
+        n -= 32;
+    }
+    if (n == 0) {
+        return upsample(hi, lo);
+    }
+    uint res_lo, res_hi;
+    asm("shf.r.wrap.b32 %0, %1, %2, %3;"
+        : "=r"(res_lo) : "r"(lo), "r"(hi), "r"(n));
+    asm("shf.r.wrap.b32 %0, %1, %2, %3;"
+        : "=r"(res_hi) : "r"(hi), "r"(lo), "r"(n));
+    return upsample(res_hi, res_lo);
+}
+
+#define rotr64(x, n) rotr64_nv(x, n)
+#endif
+
+#elif defined(cl_amd_media_ops) && !defined(ARGON2_PORTABLE_ARITHMETIC)
+#pragma OPENCL EXTENSION cl_amd_media_ops : enable
+
+/* AMD: the widening multiply maps to a single v_mad_u64_u32 (GCN3+)
+ * and 32-bit halves rotate with v_alignbit_b32: */
+#define F(x, y) ((x) + (y) + 2 * ((ulong)(uint)(x) * (uint)(y)))
+
+ulong rotr64_amd(ulong x, uint n)
+{
+    uint lo = (uint)x, hi = (uint)(x >> 32);
+    if (n >= 32) {
+        uint tmp = lo;
+        lo = hi;
+        hi = tmp;
+        n -= 32;
+    }
+    if (n == 0) {
+        return upsample(hi, lo);
+    }
+    return upsample(amd_bitalign(lo, hi, n), amd_bitalign(hi, lo, n));
+}
+
+#define rotr64(x, n) rotr64_amd(x, n)
+
+#elif defined(ARGON2_WIDE_MUL) && !defined(ARGON2_PORTABLE_ARITHMETIC)
+/* CPUs: a plain widening multiply vectorizes to pmuludq & co.: */
+#define F(x, y) ((x) + (y) + 2 * ((ulong)(uint)(x) * (uint)(y)))
+#endif
+
+#ifndef F
 #define F(x, y) ((x) + (y) + 2 * upsample( \
     mul_hi((uint)(x), (uint)(y)), \
     (uint)(x) * (uint)(y) \
     ))
+#endif
 
+#ifndef rotr64
 #define rotr64(x, n) rotate(x, (ulong)(64 - (n)))
+#endif
 
 struct block_g {
     ulong data[ARGON2_QWORDS_IN_BLOCK];
@@ -65,10 +159,98 @@ struct block_l {
     uint hi[ARGON2_QWORDS_IN_BLOCK];
 };
 
-void g(__local struct block_l *block, uint subblock, uint hash_lane,
-       uint bw, uint bh, uint dx, uint dy, uint offset)
+/*
+ * With ARGON2_GLOBAL_SCRATCH defined, the working blocks of the lanes
+ * (which are normally in local memory) are kept in a global scratch
+ * area instead, for devices whose local memory is too small to hold
+ * them for all lanes of a job. Only argon2_kernel_oneshot is built then.
+ */
+#ifdef ARGON2_GLOBAL_SCRATCH
+#define SHARED_SPACE __global
+#define SHARED_FENCE CLK_GLOBAL_MEM_FENCE
+#else
+#define SHARED_SPACE __local
+#define SHARED_FENCE CLK_LOCAL_MEM_FENCE
+#endif
+
+#ifdef ARGON2_COUNTERS
+/*
+ * Instrumentation: the kernels take an extra last argument pointing to
+ * COUNTERS_RECORD_SIZE(passes) ulongs for each lane of each job:
+ *   [0] number of blocks computed,
+ *   [1] number of references to blocks of other lanes,
+ *   [2] number of address blocks generated (Argon2i),
+ *   [3] reserved,
+ *   [4 + 2 * s], [5 + 2 * s] device clock at the start and the end
+ *   of segment s (= pass * ARGON2_SYNC_POINTS + slice).
+ * The timestamps are only available with cl_khr_kernel_clock,
+ * otherwise they are zero. The counters are only added to, so the
+ * buffer must be zeroed before the launch.
+ */
+#define COUNTERS_HEADER 4
+#define COUNTERS_RECORD_SIZE(passes) \
+    (COUNTERS_HEADER + 2 * ARGON2_SYNC_POINTS * (passes))
+
+#if defined(cl_khr_kernel_clock) && \
+    defined(__opencl_c_kernel_clock_scope_device)
+#define DEVICE_CLOCK() clock_read_device()
+#else
+#define DEVICE_CLOCK() 0
+#endif
+
+#define COUNTERS_PARAM , __global ulong *counters
+#define COUNTERS_ARG , counters
+#define REF_COUNTER_PARAM , ulong *cross_lane_refs
+#define REF_COUNTER_FWD , cross_lane_refs
+#define REF_COUNTER_ARG , &cross_lane_refs
+
+/* select the record of the given lane of the given job: */
+#define COUNTERS_RECORD(job_id, lane, lanes, passes) \
+    (counters + ((job_id) * (lanes) + (lane)) * COUNTERS_RECORD_SIZE(passes))
+#define COUNTERS_RECORD_ARG(job_id, lane, lanes, passes) \
+    , COUNTERS_RECORD(job_id, lane, lanes, passes)
+#define COUNTERS_SELECT(job_id, lane, lanes, passes) \
+    counters = COUNTERS_RECORD(job_id, lane, lanes, passes)
+#define COUNTERS_SEGMENT_START(thread, pass, slice) \
+    if ((thread) == 0) { \
+        counters[COUNTERS_HEADER + 2 * ((pass) * ARGON2_SYNC_POINTS + \
+                                        (slice))] = DEVICE_CLOCK(); \
+    }
+#define COUNTERS_SEGMENT_END(thread, pass, slice) \
+    if ((thread) == 0) { \
+        counters[COUNTERS_HEADER + 2 * ((pass) * ARGON2_SYNC_POINTS + \
+                                        (slice)) + 1] = DEVICE_CLOCK(); \
+    }
+/* add the private counters to the record: */
+#define COUNTERS_ADD(thread, blocks) \
+    if ((thread) == 0) { \
+        counters[0] += (blocks); \
+        counters[1] += cross_lane_refs; \
+    } \
+    cross_lane_refs = 0
+/* the address block counter is in thread_input of work-item 6: */
+#define COUNTERS_ADD_ADDR_BLOCKS(thread, count) \
+    if ((thread) == 6) { \
+        counters[2] += (count); \
+    }
+#else
+#define COUNTERS_PARAM
+#define COUNTERS_ARG
+#define REF_COUNTER_PARAM
+#define REF_COUNTER_FWD
+#define REF_COUNTER_ARG
+#define COUNTERS_RECORD_ARG(job_id, lane, lanes, passes)
+#define COUNTERS_SELECT(job_id, lane, lanes, passes)
+#define COUNTERS_SEGMENT_START(thread, pass, slice)
+#define COUNTERS_SEGMENT_END(thread, pass, slice)
+#define COUNTERS_ADD(thread, blocks)
+#define COUNTERS_ADD_ADDR_BLOCKS(thread, count)
+#endif
+
+/* positions of the qwords processed by one G within a local block: */
+void g_index(uint *index, uint subblock, uint hash_lane,
+             uint bw, uint bh, uint dx, uint dy, uint offset)
 {
-    uint index[4];
     for (uint i = 0; i < 4; i++) {
         uint bpos = (hash_lane + i * offset) % 4;
         uint x = (subblock * dy + i * dx) * bw + bpos % bw;
@@ -76,12 +258,11 @@ void g(__local struct block_l *block, uint subblock, uint hash_lane,
 
         index[i] = y * 16 + (x + (y / 2) * 4) % 16;
     }
+}
 
-    ulong a, b, c, d;
-    a = upsample(block->hi[index[0]], block->lo[index[0]]);
-    b = upsample(block->hi[index[1]], block->lo[index[1]]);
-    c = upsample(block->hi[index[2]], block->lo[index[2]]);
-    d = upsample(block->hi[index[3]], block->lo[index[3]]);
+void g_regs(ulong *v)
+{
+    ulong a = v[0], b = v[1], c = v[2], d = v[3];
 
     a = F(a, b);
     d = rotr64(d ^ a, 32);
@@ -92,97 +273,287 @@ void g(__local struct block_l *block, uint subblock, uint hash_lane,
     c = F(c, d);
     b = rotr64(b ^ c, 63);
 
-    block->lo[index[0]] = (uint)a;
-    block->lo[index[1]] = (uint)b;
-    block->lo[index[2]] = (uint)c;
-    block->lo[index[3]] = (uint)d;
+    v[0] = a;
+    v[1] = b;
+    v[2] = c;
+    v[3] = d;
+}
 
-    block->hi[index[0]] = (uint)(a >> 32);
-    block->hi[index[1]] = (uint)(b >> 32);
-    block->hi[index[2]] = (uint)(c >> 32);
-    block->hi[index[3]] = (uint)(d >> 32);
+void g(SHARED_SPACE struct block_l *block, uint subblock, uint hash_lane,
+       uint bw, uint bh, uint dx, uint dy, uint offset)
+{
+    uint index[4];
+    g_index(index, subblock, hash_lane, bw, bh, dx, dy, offset);
+
+    ulong v[4];
+    for (uint i = 0; i < 4; i++) {
+        v[i] = upsample(block->hi[index[i]], block->lo[index[i]]);
+    }
+
+    g_regs(v);
+
+    for (uint i = 0; i < 4; i++) {
+        block->lo[index[i]] = (uint)v[i];
+        block->hi[index[i]] = (uint)(v[i] >> 32);
+    }
 }
 
-void shuffle_block(__local struct block_l *block, uint thread)
+void shuffle_block(SHARED_SPACE struct block_l *block, uint thread)
 {
     uint subblock = (thread >> 2) & 0x7;
     uint hash_lane = (thread >> 0) & 0x3;
 
     g(block, subblock, hash_lane, 4, 1, 1, 0, 0);
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     g(block, subblock, hash_lane, 4, 1, 1, 0, 1);
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     g(block, subblock, hash_lane, 2, 2, 0, 1, 0);
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     g(block, subblock, hash_lane, 2, 2, 0, 1, 1);
 }
 
-void fill_block(__global const struct block_g *restrict ref_block,
-                __local struct block_l *restrict prev_block,
-                __local struct block_l *restrict next_block,
+#ifdef ARGON2_REGISTER_STATE
+/*
+ * Stores v at the positions from, then loads v from the positions to.
+ * Every position is written and then read by one work-item only,
+ * so a single barrier is enough.
+ */
+void exchange_regs(ulong *v, SHARED_SPACE struct block_l *block,
+                   const uint *from, const uint *to)
+{
+    for (uint i = 0; i < 4; i++) {
+        block->lo[from[i]] = (uint)v[i];
+        block->hi[from[i]] = (uint)(v[i] >> 32);
+    }
+
+    barrier(SHARED_FENCE);
+
+    for (uint i = 0; i < 4; i++) {
+        v[i] = upsample(block->hi[to[i]], block->lo[to[i]]);
+    }
+}
+
+/*
+ * Same as shuffle_block, but the work-item's qwords are kept in v
+ * (in QWORD_INDEX order, which matches the first round) and block is only
+ * used to pass them between the rounds.
+ */
+void shuffle_block_regs(ulong *v, SHARED_SPACE struct block_l *block,
+                        uint thread)
+{
+    uint subblock = (thread >> 2) & 0x7;
+    uint hash_lane = (thread >> 0) & 0x3;
+
+    uint index1[4], index2[4], index3[4], index4[4];
+    g_index(index1, subblock, hash_lane, 4, 1, 1, 0, 0);
+    g_index(index2, subblock, hash_lane, 4, 1, 1, 0, 1);
+    g_index(index3, subblock, hash_lane, 2, 2, 0, 1, 0);
+    g_index(index4, subblock, hash_lane, 2, 2, 0, 1, 1);
+
+    g_regs(v);
+    exchange_regs(v, block, index1, index2);
+    g_regs(v);
+    exchange_regs(v, block, index2, index3);
+    g_regs(v);
+    exchange_regs(v, block, index3, index4);
+    g_regs(v);
+    exchange_regs(v, block, index4, index1);
+}
+#endif
+
+/* position of the work-item's i-th qword within a local block: */
+uint local_pos(uint thread, uint i)
+{
+    uint index = QWORD_INDEX(thread, i);
+    uint x = index % THREADS_PER_LANE;
+    uint y = index / THREADS_PER_LANE;
+    return y * THREADS_PER_LANE + (x & 0x10) + ((x + y * 4) & 0xf);
+}
+
+void load_block(ulong *restrict dst,
+                __global const struct block_g *restrict src,
+                uint thread)
+{
+#ifdef ARGON2_VECTOR_ACCESS
+    ulong4 in = vload4(thread, src->data);
+    dst[0] = in.s0;
+    dst[1] = in.s1;
+    dst[2] = in.s2;
+    dst[3] = in.s3;
+#else
+    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
+        dst[i] = src->data[QWORD_INDEX(thread, i)];
+    }
+#endif
+}
+
+void store_block(__global struct block_g *restrict dst,
+                 const ulong *restrict src,
+                 uint thread)
+{
+#ifdef ARGON2_VECTOR_ACCESS
+    ulong4 out;
+    out.s0 = src[0];
+    out.s1 = src[1];
+    out.s2 = src[2];
+    out.s3 = src[3];
+    vstore4(out, thread, dst->data);
+#else
+    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
+        dst->data[QWORD_INDEX(thread, i)] = src[i];
+    }
+#endif
+}
+
+void load_block_l(SHARED_SPACE struct block_l *restrict dst,
+                  __global const struct block_g *restrict src,
+                  uint thread)
+{
+    ulong in[QWORDS_PER_THREAD];
+    load_block(in, src, thread);
+    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
+        uint pos_l = local_pos(thread, i);
+        dst->lo[pos_l] = (uint)in[i];
+        dst->hi[pos_l] = (uint)(in[i] >> 32);
+    }
+}
+
+void store_block_l(__global struct block_g *restrict dst,
+                   SHARED_SPACE const struct block_l *restrict src,
+                   uint thread)
+{
+    ulong out[QWORDS_PER_THREAD];
+    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
+        uint pos_l = local_pos(thread, i);
+        out[i] = upsample(src->hi[pos_l], src->lo[pos_l]);
+    }
+    store_block(dst, out, thread);
+}
+
+void load_block_local(ulong *restrict dst,
+                      __local const struct block_l *restrict src,
+                      uint thread)
+{
+    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
+        uint pos_l = local_pos(thread, i);
+        dst[i] = upsample(src->hi[pos_l], src->lo[pos_l]);
+    }
+}
+
+void copy_block_l(__local struct block_l *restrict dst,
+                  __local const struct block_l *restrict src,
+                  uint thread)
+{
+    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
+        uint pos_l = local_pos(thread, i);
+        dst->lo[pos_l] = src->lo[pos_l];
+        dst->hi[pos_l] = src->hi[pos_l];
+    }
+}
+
+#ifdef ARGON2_REGISTER_STATE
+/*
+ * Computes the work-item's qwords of the next block (XOR-ed into the
+ * current contents of next_block if xor_next is set). The contents
+ * of prev_block are destroyed.
+ */
+void fill_block_regs(const ulong *restrict ref_block,
+                     SHARED_SPACE struct block_l *restrict prev_block,
+                     SHARED_SPACE struct block_l *restrict next_block,
+                     uint thread, bool xor_next)
+{
+    ulong r[QWORDS_PER_THREAD], v[QWORDS_PER_THREAD];
+    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
+        uint pos_l = local_pos(thread, i);
+        r[i] = upsample(prev_block->hi[pos_l], prev_block->lo[pos_l]);
+        r[i] ^= ref_block[i];
+        v[i] = r[i];
+    }
+
+    shuffle_block_regs(v, prev_block, thread);
+
+    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
+        uint pos_l = local_pos(thread, i);
+        ulong out = r[i] ^ v[i];
+        if (xor_next) {
+            out ^= upsample(next_block->hi[pos_l], next_block->lo[pos_l]);
+        }
+        next_block->lo[pos_l] = (uint)out;
+        next_block->hi[pos_l] = (uint)(out >> 32);
+    }
+}
+#endif
+
+void fill_block(const ulong *restrict ref_block,
+                SHARED_SPACE struct block_l *restrict prev_block,
+                SHARED_SPACE struct block_l *restrict next_block,
                 uint thread)
 {
+#ifdef ARGON2_REGISTER_STATE
+    fill_block_regs(ref_block, prev_block, next_block, thread, false);
+#else
     for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-        uint pos_l = i * THREADS_PER_LANE +
-                (thread & 0x10) + ((thread + i * 4) & 0xf);
-        ulong in = ref_block->data[i * THREADS_PER_LANE + thread];
+        uint pos_l = local_pos(thread, i);
+        ulong in = ref_block[i];
         next_block->lo[pos_l] = prev_block->lo[pos_l] ^= (uint)in;
         next_block->hi[pos_l] = prev_block->hi[pos_l] ^= (uint)(in >> 32);
     }
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     shuffle_block(prev_block, thread);
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-        uint pos_l = i * THREADS_PER_LANE +
-                (thread & 0x10) + ((thread + i * 4) & 0xf);
+        uint pos_l = local_pos(thread, i);
         next_block->lo[pos_l] ^= prev_block->lo[pos_l];
         next_block->hi[pos_l] ^= prev_block->hi[pos_l];
     }
+#endif
 }
 
 #if ARGON2_VERSION != ARGON2_VERSION_10
-void fill_block_xor(__global const struct block_g *restrict ref_block,
-                    __local struct block_l *restrict prev_block,
-                    __local struct block_l *restrict next_block,
+void fill_block_xor(const ulong *restrict ref_block,
+                    SHARED_SPACE struct block_l *restrict prev_block,
+                    SHARED_SPACE struct block_l *restrict next_block,
                     uint thread)
 {
+#ifdef ARGON2_REGISTER_STATE
+    fill_block_regs(ref_block, prev_block, next_block, thread, true);
+#else
     for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-        uint pos_l = i * THREADS_PER_LANE +
-                (thread & 0x10) + ((thread + i * 4) & 0xf);
-        ulong in = ref_block->data[i * THREADS_PER_LANE + thread];
+        uint pos_l = local_pos(thread, i);
+        ulong in = ref_block[i];
         next_block->lo[pos_l] ^= prev_block->lo[pos_l] ^= (uint)in;
         next_block->hi[pos_l] ^= prev_block->hi[pos_l] ^= (uint)(in >> 32);
     }
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     shuffle_block(prev_block, thread);
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-        uint pos_l = i * THREADS_PER_LANE +
-                (thread & 0x10) + ((thread + i * 4) & 0xf);
+        uint pos_l = local_pos(thread, i);
         next_block->lo[pos_l] ^= prev_block->lo[pos_l];
         next_block->hi[pos_l] ^= prev_block->hi[pos_l];
     }
+#endif
 }
 #endif
 
 #if ARGON2_TYPE == ARGON2_I
 void next_addresses(uint thread_input,
-                    __local struct block_l *restrict addr,
-                    __local struct block_l *restrict tmp,
+                    SHARED_SPACE struct block_l *restrict addr,
+                    SHARED_SPACE struct block_l *restrict tmp,
                     uint thread)
 {
     addr->lo[thread] = thread_input;
@@ -192,11 +563,11 @@ void next_addresses(uint thread_input,
         addr->hi[pos] = addr->lo[pos] = 0;
     }
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     shuffle_block(addr, thread);
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     tmp->lo[thread] = addr->lo[thread] ^= thread_input;
     tmp->hi[thread] = addr->hi[thread];
@@ -206,11 +577,11 @@ void next_addresses(uint thread_input,
         tmp->hi[pos] = addr->hi[pos];
     }
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     shuffle_block(addr, thread);
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 
     for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
         uint pos = i * THREADS_PER_LANE + thread;
@@ -218,29 +589,197 @@ void next_addresses(uint thread_input,
         addr->hi[pos] ^= tmp->hi[pos];
     }
 
-    barrier(CLK_LOCAL_MEM_FENCE);
+    barrier(SHARED_FENCE);
 }
 #endif
 
-__kernel void argon2_kernel_segment(
-        __global struct block_g *memory, uint passes, uint lanes,
-        uint segment_blocks, uint pass, uint slice)
+#if ARGON2_TYPE == ARGON2_I
+void address_pseudo_rand(uint offset, uint *thread_input,
+                         SHARED_SPACE struct block_l *restrict addr,
+                         SHARED_SPACE struct block_l *restrict tmp,
+                         uint thread,
+                         uint *pseudo_rand_lo, uint *pseudo_rand_hi)
 {
-    size_t job_id = get_global_id(0);
-    uint lane = get_global_id(1);
-    uint thread = (uint)get_global_id(2);
+    uint addr_index = offset % ARGON2_QWORDS_IN_BLOCK;
+    if (addr_index == 0) {
+        if (thread == 6) {
+            ++*thread_input;
+        }
+        next_addresses(*thread_input, addr, tmp, thread);
+    }
+    uint addr_index_x = addr_index % 16;
+    uint addr_index_y = addr_index / 16;
+    addr_index = addr_index_y * 16 +
+            (addr_index_x + (addr_index_y / 2) * 4) % 16;
+    *pseudo_rand_lo = addr->lo[addr_index];
+    *pseudo_rand_hi = addr->hi[addr_index];
+}
+#endif
 
+/* lane of the reference block and its index within that lane: */
+uint ref_lane_index(uint pseudo_rand_lo, uint pseudo_rand_hi,
+                    uint lanes, uint segment_blocks,
+                    uint pass, uint slice, uint lane, uint offset,
+                    uint *ref_lane_out REF_COUNTER_PARAM)
+{
     uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
 
-    /* select job's memory region: */
-    memory += job_id * lanes * lane_blocks;
+    uint ref_lane = pseudo_rand_hi % lanes;
+
+    uint base;
+    if (pass != 0) {
+        base = lane_blocks - segment_blocks;
+    } else {
+        if (slice == 0) {
+            ref_lane = lane;
+        }
+        base = slice * segment_blocks;
+    }
+
+    uint ref_area_size = base + offset - 1;
+    if (ref_lane != lane) {
+        ref_area_size = min(ref_area_size, base);
+    }
+
+    uint ref_index = pseudo_rand_lo;
+    ref_index = mul_hi(ref_index, ref_index);
+    ref_index = ref_area_size - 1 - mul_hi(ref_area_size, ref_index);
+
+    if (pass != 0 && slice != ARGON2_SYNC_POINTS - 1) {
+        ref_index += (slice + 1) * segment_blocks;
+        ref_index %= lane_blocks;
+    }
+
+#ifdef ARGON2_COUNTERS
+    *cross_lane_refs += ref_lane != lane;
+#endif
+    *ref_lane_out = ref_lane;
+    return ref_index;
+}
+
+/* index of the reference block within the job's memory (64-bit, since
+ * the memory of a job may exceed 4 GiB): */
+size_t ref_block_index(uint pseudo_rand_lo, uint pseudo_rand_hi,
+                       uint lanes, uint segment_blocks,
+                       uint pass, uint slice, uint lane, uint offset
+                       REF_COUNTER_PARAM)
+{
+    uint ref_lane;
+    uint ref_index = ref_lane_index(pseudo_rand_lo, pseudo_rand_hi,
+                                    lanes, segment_blocks,
+                                    pass, slice, lane, offset,
+                                    &ref_lane REF_COUNTER_FWD);
+    return (size_t)ref_lane * (ARGON2_SYNC_POINTS * segment_blocks)
+            + ref_index;
+}
+
+/*
+ * With ARGON2_SPLIT_LANES defined, the lanes of a job do not have to be
+ * in one buffer: the argon2_kernel_segment kernel takes up to
+ * MAX_MEMORY_BUFFERS buffers, the g-th of which holds the lanes
+ * [g * lanes_per_buffer, (g + 1) * lanes_per_buffer) of each job (the
+ * last one possibly fewer), job after job. This way the memory of a single
+ * job may exceed the largest allocation a device allows. Only the segment
+ * kernel is available in this variant.
+ */
+#ifdef ARGON2_SPLIT_LANES
+#define MAX_MEMORY_BUFFERS 8
+
+struct job_memory {
+    __global struct block_g *buffers[MAX_MEMORY_BUFFERS];
+    size_t job_id;
+    uint lanes;
+    uint lanes_per_buffer;
+};
+
+typedef const struct job_memory *job_memory_t;
+
+#define SPLIT_LANES_PARAM , uint lanes_per_buffer, \
+    __global struct block_g *memory1, __global struct block_g *memory2, \
+    __global struct block_g *memory3, __global struct block_g *memory4, \
+    __global struct block_g *memory5, __global struct block_g *memory6, \
+    __global struct block_g *memory7
+
+__global struct block_g *lane_memory(job_memory_t memory, uint lane,
+                                     uint lane_blocks)
+{
+    uint group = lane / memory->lanes_per_buffer;
+    uint group_start = group * memory->lanes_per_buffer;
+    uint group_lanes = min(memory->lanes_per_buffer,
+                           memory->lanes - group_start);
+    return memory->buffers[group] + ((size_t)memory->job_id * group_lanes
+                                     + (lane - group_start)) * lane_blocks;
+}
+#else
+/* the job's memory region: */
+typedef __global struct block_g *job_memory_t;
+
+#define SPLIT_LANES_PARAM
+
+__global struct block_g *lane_memory(job_memory_t memory, uint lane,
+                                     uint lane_blocks)
+{
+    return memory + (size_t)lane * lane_blocks;
+}
+#endif
+
+__global struct block_g *get_ref_block(
+        job_memory_t memory,
+        uint pseudo_rand_lo, uint pseudo_rand_hi,
+        uint lanes, uint segment_blocks,
+        uint pass, uint slice, uint lane, uint offset
+        REF_COUNTER_PARAM)
+{
+    uint ref_lane;
+    uint ref_index = ref_lane_index(pseudo_rand_lo, pseudo_rand_hi,
+                                    lanes, segment_blocks,
+                                    pass, slice, lane, offset,
+                                    &ref_lane REF_COUNTER_FWD);
+    return lane_memory(memory, ref_lane, ARGON2_SYNC_POINTS * segment_blocks)
+            + ref_index;
+}
+
+#if ARGON2_TYPE == ARGON2_I
+#define SHARED_BLOCKS 3
+#else
+#define SHARED_BLOCKS 2
+#endif
+
+#ifndef ARGON2_GLOBAL_SCRATCH
+/*
+ * Computes the blocks [chunk_start, chunk_end) of one segment of the given
+ * lane. The memory pointer points to the job's memory region, shared holds
+ * SHARED_BLOCKS working blocks. A segment may be computed in several chunks
+ * (in order), since all the state needed to continue (the previous block
+ * and the position in the address stream) follows from the job's memory
+ * and chunk_start.
+ */
+void process_segment(
+        job_memory_t memory, __local struct block_l *shared,
+        uint passes, uint lanes, uint segment_blocks,
+        uint pass, uint slice, uint lane, uint thread,
+        uint chunk_start, uint chunk_end COUNTERS_PARAM)
+{
+    uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
+
+    uint start_offset = chunk_start;
+    if (pass == 0 && slice == 0 && start_offset < 2) {
+        start_offset = 2;
+    }
+    uint end_offset = min(chunk_end, segment_blocks);
+
+#ifdef ARGON2_COUNTERS
+    ulong cross_lane_refs = 0;
+    if (chunk_start == 0) {
+        COUNTERS_SEGMENT_START(thread, pass, slice);
+    }
+#endif
 
-    __local struct block_l local_curr, local_prev;
-    __local struct block_l *curr = &local_curr;
-    __local struct block_l *prev = &local_prev;
+    __local struct block_l *curr = &shared[0];
+    __local struct block_l *prev = &shared[1];
 
 #if ARGON2_TYPE == ARGON2_I
-    __local struct block_l local_addr;
+    __local struct block_l *addr = &shared[2];
 
     uint thread_input;
     switch (thread) {
@@ -267,116 +806,120 @@ __kernel void argon2_kernel_segment(
         break;
     }
 
-    if (pass == 0 && slice == 0 && segment_blocks > 2) {
+    /* number of address blocks generated before start_offset: */
+    if (thread == 6) {
+        thread_input = start_offset / ARGON2_QWORDS_IN_BLOCK;
+    }
+    /* address_pseudo_rand only generates a new address block when it
+     * reaches its first address, so generate the current one here: */
+    if (start_offset % ARGON2_QWORDS_IN_BLOCK != 0 &&
+            start_offset < end_offset) {
         if (thread == 6) {
             ++thread_input;
         }
-        next_addresses(thread_input, &local_addr, curr, thread);
+        next_addresses(thread_input, addr, curr, thread);
     }
 #endif
 
-    __global struct block_g *mem_segment = memory
-            + lane * lane_blocks + slice * segment_blocks;
-    __global struct block_g *mem_prev, *mem_curr;
-    uint start_offset = 0;
-    if (pass == 0) {
-        if (slice == 0) {
-            mem_prev = mem_segment + 1;
-            mem_curr = mem_segment + 2;
-            start_offset = 2;
-        } else {
-            mem_prev = mem_segment - 1;
-            mem_curr = mem_segment;
-        }
-    } else {
-        mem_prev = mem_segment + (slice == 0 ? lane_blocks : 0) - 1;
-        mem_curr = mem_segment;
+    __global struct block_g *mem_segment =
+            lane_memory(memory, lane, lane_blocks) + slice * segment_blocks;
+    __global struct block_g *mem_curr = mem_segment + start_offset;
+    __global struct block_g *mem_prev = mem_curr - 1;
+    if (slice == 0 && start_offset == 0) {
+        /* the first block of a lane follows the last one: */
+        mem_prev += lane_blocks;
     }
 
-    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-        uint pos_l = (thread & 0x10) + ((thread + i * 4) & 0xf);
-        ulong in = mem_prev->data[i * THREADS_PER_LANE + thread];
-        prev->lo[i * THREADS_PER_LANE + pos_l] = (uint)in;
-        prev->hi[i * THREADS_PER_LANE + pos_l] = (uint)(in >> 32);
+    load_block_l(prev, mem_prev, thread);
+
+    ulong ref[QWORDS_PER_THREAD];
+    /* the reference block for the next offset is loaded into private
+     * memory while the current block is still being processed; in
+     * Argon2i that happens before the current block is computed, so
+     * most of the global memory latency is hidden behind it; in Argon2d
+     * the next reference depends on the first qword of the current
+     * block, so the load only overlaps the write-back (and, in version
+     * 1.3, the load of the next block to be overwritten); prefetching
+     * never crosses a segment boundary, because other lanes may not
+     * have finished the previous segment yet: */
+#ifdef ARGON2_PREFETCH_REFS
+    ulong ref_next[QWORDS_PER_THREAD];
+
+    if (start_offset < end_offset) {
+        uint pseudo_rand_lo, pseudo_rand_hi;
+#if ARGON2_TYPE == ARGON2_I
+        address_pseudo_rand(start_offset, &thread_input, addr, curr,
+                            thread, &pseudo_rand_lo, &pseudo_rand_hi);
+#else
+        pseudo_rand_lo = prev->lo[0];
+        pseudo_rand_hi = prev->hi[0];
+#endif
+        load_block(ref, get_ref_block(memory, pseudo_rand_lo, pseudo_rand_hi,
+                                      lanes, segment_blocks, pass, slice,
+                                      lane, start_offset REF_COUNTER_ARG), thread);
     }
+#endif
 
-    for (uint offset = start_offset; offset < segment_blocks; ++offset) {
+    for (uint offset = start_offset; offset < end_offset; ++offset) {
         uint pseudo_rand_lo, pseudo_rand_hi;
+#ifdef ARGON2_PREFETCH_REFS
 #if ARGON2_TYPE == ARGON2_I
-        uint addr_index = offset % ARGON2_QWORDS_IN_BLOCK;
-        if (addr_index == 0) {
-            if (thread == 6) {
-                ++thread_input;
-            }
-            next_addresses(thread_input, &local_addr, curr, thread);
+        if (offset + 1 < end_offset) {
+            address_pseudo_rand(offset + 1, &thread_input, addr, curr,
+                                thread, &pseudo_rand_lo, &pseudo_rand_hi);
+            load_block(ref_next, get_ref_block(
+                           memory, pseudo_rand_lo, pseudo_rand_hi,
+                           lanes, segment_blocks, pass, slice,
+                           lane, offset + 1 REF_COUNTER_ARG), thread);
         }
-        uint addr_index_x = addr_index % 16;
-        uint addr_index_y = addr_index / 16;
-        addr_index = addr_index_y * 16 +
-                (addr_index_x + (addr_index_y / 2) * 4) % 16;
-        pseudo_rand_lo = local_addr.lo[addr_index];
-        pseudo_rand_hi = local_addr.hi[addr_index];
+#endif
+#else
+#if ARGON2_TYPE == ARGON2_I
+        address_pseudo_rand(offset, &thread_input, addr, curr,
+                            thread, &pseudo_rand_lo, &pseudo_rand_hi);
 #else
         pseudo_rand_lo = prev->lo[0];
         pseudo_rand_hi = prev->hi[0];
 #endif
-
-        uint ref_lane = pseudo_rand_hi % lanes;
-
-        uint base;
-        if (pass != 0) {
-            base = lane_blocks - segment_blocks;
-        } else {
-            if (slice == 0) {
-                ref_lane = lane;
-            }
-            base = slice * segment_blocks;
-        }
-
-        uint ref_area_size = base + offset - 1;
-        if (ref_lane != lane) {
-            ref_area_size = min(ref_area_size, base);
-        }
-
-        uint ref_index = pseudo_rand_lo;
-        ref_index = mul_hi(ref_index, ref_index);
-        ref_index = ref_area_size - 1 - mul_hi(ref_area_size, ref_index);
-
-        if (pass != 0 && slice != ARGON2_SYNC_POINTS - 1) {
-            ref_index += (slice + 1) * segment_blocks;
-            ref_index %= lane_blocks;
-        }
-
-        __global struct block_g *mem_ref = memory +
-                ref_lane * lane_blocks + ref_index;
+        load_block(ref, get_ref_block(memory, pseudo_rand_lo, pseudo_rand_hi,
+                                      lanes, segment_blocks, pass, slice,
+                                      lane, offset REF_COUNTER_ARG), thread);
+#endif
 
         /* NOTE: no need to wrap fill_block in barriers, since
          * it starts & ends in 'nicely parallel' memory operations
          * like we do in this loop (IOW: this thread only depends on
          * its own data w.r.t. these boundaries) */
 #if ARGON2_VERSION == ARGON2_VERSION_10
-        fill_block(mem_ref, prev, curr, thread);
+        fill_block(ref, prev, curr, thread);
 #else
         if (pass != 0) {
-            for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-                uint pos_l = (thread & 0x10) + ((thread + i * 4) & 0xf);
-                ulong in = mem_curr->data[i * THREADS_PER_LANE + thread];
-                curr->lo[i * THREADS_PER_LANE + pos_l] = (uint)in;
-                curr->hi[i * THREADS_PER_LANE + pos_l] = (uint)(in >> 32);
-            }
+            load_block_l(curr, mem_curr, thread);
 
-            fill_block_xor(mem_ref, prev, curr, thread);
+            fill_block_xor(ref, prev, curr, thread);
         } else {
-            fill_block(mem_ref, prev, curr, thread);
+            fill_block(ref, prev, curr, thread);
         }
 #endif
 
+#if defined(ARGON2_PREFETCH_REFS) && ARGON2_TYPE == ARGON2_D
+        if (offset + 1 < end_offset) {
+            pseudo_rand_lo = curr->lo[0];
+            pseudo_rand_hi = curr->hi[0];
+            load_block(ref_next, get_ref_block(
+                           memory, pseudo_rand_lo, pseudo_rand_hi,
+                           lanes, segment_blocks, pass, slice,
+                           lane, offset + 1 REF_COUNTER_ARG), thread);
+        }
+#endif
+
+        store_block_l(mem_curr, curr, thread);
+
+#ifdef ARGON2_PREFETCH_REFS
         for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-            uint pos_l = (thread & 0x10) + ((thread + i * 4) & 0xf);
-            ulong out = upsample(curr->hi[i * THREADS_PER_LANE + pos_l],
-                                 curr->lo[i * THREADS_PER_LANE + pos_l]);
-            mem_curr->data[i * THREADS_PER_LANE + thread] = out;
+            ref[i] = ref_next[i];
         }
+#endif
 
         /* swap curr and prev buffers: */
         __local struct block_l *tmp = curr;
@@ -385,17 +928,30 @@ __kernel void argon2_kernel_segment(
 
         ++mem_curr;
     }
-}
 
+#ifdef ARGON2_COUNTERS
+    if (start_offset < end_offset) {
+        COUNTERS_ADD(thread, end_offset - start_offset);
+    }
 #if ARGON2_TYPE == ARGON2_I
-#define SHARED_BLOCKS 3
-#else
-#define SHARED_BLOCKS 2
+    COUNTERS_ADD_ADDR_BLOCKS(thread, thread_input
+                             - start_offset / ARGON2_QWORDS_IN_BLOCK);
 #endif
+    if (end_offset == segment_blocks) {
+        COUNTERS_SEGMENT_END(thread, pass, slice);
+    }
+#endif
+}
 
-__kernel void argon2_kernel_oneshot(
-        __global struct block_g *memory, __local struct block_l *shared,
-        uint passes, uint lanes, uint segment_blocks)
+/*
+ * Computes the blocks [chunk_start, chunk_end) of the given segment
+ * of each lane (pass chunk_start = 0, chunk_end = segment_blocks for
+ * the whole segment).
+ */
+__kernel void argon2_kernel_segment(
+        __global struct block_g *memory, uint passes, uint lanes,
+        uint segment_blocks, uint pass, uint slice,
+        uint chunk_start, uint chunk_end SPLIT_LANES_PARAM COUNTERS_PARAM)
 {
     size_t job_id = get_global_id(0);
     uint lane = get_global_id(1);
@@ -403,15 +959,115 @@ __kernel void argon2_kernel_oneshot(
 
     uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
 
+    /* select job's memory region: */
+#ifdef ARGON2_SPLIT_LANES
+    struct job_memory job_memory = {
+        { memory, memory1, memory2, memory3,
+          memory4, memory5, memory6, memory7 },
+        job_id, lanes, lanes_per_buffer
+    };
+    job_memory_t job = &job_memory;
+#else
+    job_memory_t job = memory + job_id * lanes * lane_blocks;
+#endif
+    COUNTERS_SELECT(job_id, lane, lanes, passes);
+
+    __local struct block_l local_shared[SHARED_BLOCKS];
+
+    process_segment(job, local_shared, passes, lanes, segment_blocks,
+                    pass, slice, lane, thread, chunk_start, chunk_end
+                    COUNTERS_ARG);
+}
+
+#endif /* ARGON2_GLOBAL_SCRATCH */
+
+#ifndef ARGON2_SPLIT_LANES
+#ifndef ARGON2_GLOBAL_SCRATCH
+/*
+ * Waits until all lanes of the job have incremented the job's counter
+ * up to target. All work-groups of the job must be resident on the
+ * device at the same time, otherwise this deadlocks.
+ *
+ * NOTE: OpenCL 1.x does not guarantee that global memory writes become
+ * visible to other work-groups during the same launch; we rely on the
+ * atomics and fences below, which is what common GPUs do in practice.
+ */
+void sync_lanes(__global volatile uint *counter, uint target, uint thread)
+{
+    barrier(CLK_GLOBAL_MEM_FENCE);
+    if (thread == 0) {
+        mem_fence(CLK_GLOBAL_MEM_FENCE);
+        atomic_inc(counter);
+        while (atomic_add(counter, 0) < target);
+        mem_fence(CLK_GLOBAL_MEM_FENCE);
+    }
+    barrier(CLK_GLOBAL_MEM_FENCE);
+}
+
+/*
+ * Processes all passes and slices in a single launch, with one
+ * work-group per lane (as in argon2_kernel_segment). The lanes of a job
+ * synchronize at segment boundaries through the job's counter in sync,
+ * which must be zeroed before the launch.
+ *
+ * NOTE: the dimensions are swapped w.r.t. argon2_kernel_segment, so that
+ * the work-groups of one job have consecutive IDs -- as long as the
+ * work-groups are dispatched in order, it is then enough that 'lanes'
+ * work-groups can be resident at the same time.
+ */
+__kernel void argon2_kernel_segment_persistent(
+        __global struct block_g *memory, __global volatile uint *sync,
+        __local struct block_l *shared,
+        uint passes, uint lanes, uint segment_blocks COUNTERS_PARAM)
+{
+    uint thread = (uint)get_global_id(0);
+    uint lane = get_global_id(1);
+    size_t job_id = get_global_id(2);
+
+    uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
+
     /* select job's memory region: */
     memory += job_id * lanes * lane_blocks;
+    COUNTERS_SELECT(job_id, lane, lanes, passes);
+
+    uint step = 0;
+    for (uint pass = 0; pass < passes; ++pass) {
+        for (uint slice = 0; slice < ARGON2_SYNC_POINTS; ++slice) {
+            if (step != 0) {
+                sync_lanes(&sync[job_id], step * lanes, thread);
+            }
+            process_segment(memory, shared, passes, lanes, segment_blocks,
+                            pass, slice, lane, thread, 0, segment_blocks
+                            COUNTERS_ARG);
+            ++step;
+        }
+    }
+}
+#endif /* ARGON2_GLOBAL_SCRATCH */
+
+/*
+ * Computes the whole job (all passes and slices) with all lanes in one
+ * work-group. The memory pointer points to the job's memory region,
+ * shared holds SHARED_BLOCKS working blocks for each lane.
+ */
+void process_job(
+        __global struct block_g *memory, SHARED_SPACE struct block_l *shared,
+        uint passes, uint lanes, uint segment_blocks,
+        uint lane, uint thread COUNTERS_PARAM)
+{
+    uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
+
+#ifdef ARGON2_COUNTERS
+    ulong cross_lane_refs = 0;
+#endif
+
     /* select lane's shared memory buffer: */
     shared += lane * SHARED_BLOCKS;
 
-    __local struct block_l *restrict curr = &shared[0];
-    __local struct block_l *restrict prev = &shared[1];
+    SHARED_SPACE struct block_l *restrict curr = &shared[0];
+    SHARED_SPACE struct block_l *restrict prev = &shared[1];
 #if ARGON2_TYPE == ARGON2_I
-    __local struct block_l *restrict addr = &shared[2];
+    SHARED_SPACE struct block_l *restrict addr = &shared[2];
 
     uint thread_input;
     switch (thread) {
@@ -440,109 +1096,112 @@ __kernel void argon2_kernel_oneshot(
     }
 #endif
 
-    __global struct block_g *mem_lane = memory + lane * lane_blocks;
+    __global struct block_g *mem_lane = lane_memory(memory, lane, lane_blocks);
     __global struct block_g *mem_prev = mem_lane + 1;
     __global struct block_g *mem_curr = mem_lane + 2;
 
-    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-        uint pos_l = (thread & 0x10) + ((thread + i * 4) & 0xf);
-        ulong in = mem_prev->data[i * THREADS_PER_LANE + thread];
-        prev->lo[i * THREADS_PER_LANE + pos_l] = (uint)in;
-        prev->hi[i * THREADS_PER_LANE + pos_l] = (uint)(in >> 32);
-    }
-    uint skip = 2;
+    load_block_l(prev, mem_prev, thread);
+
+    ulong ref[QWORDS_PER_THREAD];
+    /* prefetching as in process_segment(): */
+#ifdef ARGON2_PREFETCH_REFS
+    ulong ref_next[QWORDS_PER_THREAD];
+#endif
+
+    uint start_offset = 2;
     for (uint pass = 0; pass < passes; ++pass) {
         for (uint slice = 0; slice < ARGON2_SYNC_POINTS; ++slice) {
-            for (uint offset = 0; offset < segment_blocks; ++offset) {
-                if (skip > 0) {
-                    --skip;
-                    continue;
-                }
-
+            COUNTERS_SEGMENT_START(thread, pass, slice);
+#ifdef ARGON2_PREFETCH_REFS
+            if (start_offset < segment_blocks) {
                 uint pseudo_rand_lo, pseudo_rand_hi;
 #if ARGON2_TYPE == ARGON2_I
-                uint addr_index = offset % ARGON2_QWORDS_IN_BLOCK;
-                if (addr_index == 0) {
-                    if (thread == 6) {
-                        ++thread_input;
-                    }
-                    next_addresses(thread_input, addr, curr, thread);
-                }
-                uint addr_index_x = addr_index % 16;
-                uint addr_index_y = addr_index / 16;
-                addr_index = addr_index_y * 16 +
-                        (addr_index_x + (addr_index_y / 2) * 4) % 16;
-                pseudo_rand_lo = addr->lo[addr_index];
-                pseudo_rand_hi = addr->hi[addr_index];
+                address_pseudo_rand(start_offset, &thread_input, addr, curr,
+                                    thread, &pseudo_rand_lo, &pseudo_rand_hi);
 #else
                 pseudo_rand_lo = prev->lo[0];
                 pseudo_rand_hi = prev->hi[0];
 #endif
+                load_block(ref, get_ref_block(
+                               memory, pseudo_rand_lo, pseudo_rand_hi,
+                               lanes, segment_blocks, pass, slice,
+                               lane, start_offset REF_COUNTER_ARG), thread);
+            }
+#endif
 
-                uint ref_lane = pseudo_rand_hi % lanes;
-
-                uint base;
-                if (pass != 0) {
-                    base = lane_blocks - segment_blocks;
-                } else {
-                    if (slice == 0) {
-                        ref_lane = lane;
-                    }
-                    base = slice * segment_blocks;
-                }
-
-                uint ref_area_size = base + offset - 1;
-                if (ref_lane != lane) {
-                    ref_area_size = min(ref_area_size, base);
-                }
-
-                uint ref_index = pseudo_rand_lo;
-                ref_index = mul_hi(ref_index, ref_index);
-                ref_index = ref_area_size - 1 - mul_hi(ref_area_size, ref_index);
-
-                if (pass != 0 && slice != ARGON2_SYNC_POINTS - 1) {
-                    ref_index += (slice + 1) * segment_blocks;
-                    ref_index %= lane_blocks;
+            for (uint offset = start_offset; offset < segment_blocks; ++offset) {
+                uint pseudo_rand_lo, pseudo_rand_hi;
+#ifdef ARGON2_PREFETCH_REFS
+#if ARGON2_TYPE == ARGON2_I
+                if (offset + 1 < segment_blocks) {
+                    address_pseudo_rand(offset + 1, &thread_input, addr, curr,
+                                        thread, &pseudo_rand_lo,
+                                        &pseudo_rand_hi);
+                    load_block(ref_next, get_ref_block(
+                                   memory, pseudo_rand_lo, pseudo_rand_hi,
+                                   lanes, segment_blocks, pass, slice,
+                                   lane, offset + 1 REF_COUNTER_ARG), thread);
                 }
-
-                __global struct block_g *mem_ref = memory +
-                        ref_lane * lane_blocks + ref_index;
+#endif
+#else
+#if ARGON2_TYPE == ARGON2_I
+                address_pseudo_rand(offset, &thread_input, addr, curr,
+                                    thread, &pseudo_rand_lo, &pseudo_rand_hi);
+#else
+                pseudo_rand_lo = prev->lo[0];
+                pseudo_rand_hi = prev->hi[0];
+#endif
+                load_block(ref, get_ref_block(
+                               memory, pseudo_rand_lo, pseudo_rand_hi,
+                               lanes, segment_blocks, pass, slice,
+                               lane, offset REF_COUNTER_ARG), thread);
+#endif
 
                 /* NOTE: no need to wrap fill_block in barriers, since
                  * it starts & ends in 'nicely parallel' memory operations
                  * like we do in this loop (IOW: this thread only depends on
                  * its own data w.r.t. these boundaries) */
 #if ARGON2_VERSION == ARGON2_VERSION_10
-                fill_block(mem_ref, prev, curr, thread);
+                fill_block(ref, prev, curr, thread);
 #else
                 if (pass != 0) {
-                    for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-                        uint pos_l = (thread & 0x10) + ((thread + i * 4) & 0xf);
-                        ulong in = mem_curr->data[i * THREADS_PER_LANE + thread];
-                        curr->lo[i * THREADS_PER_LANE + pos_l] = (uint)in;
-                        curr->hi[i * THREADS_PER_LANE + pos_l] = (uint)(in >> 32);
-                    }
-
-                    fill_block_xor(mem_ref, prev, curr, thread);
+                    load_block_l(curr, mem_curr, thread);
+
+                    fill_block_xor(ref, prev, curr, thread);
                 } else {
-                    fill_block(mem_ref, prev, curr, thread);
+                    fill_block(ref, prev, curr, thread);
                 }
 #endif
 
+#if defined(ARGON2_PREFETCH_REFS) && ARGON2_TYPE == ARGON2_D
+                if (offset + 1 < segment_blocks) {
+                    pseudo_rand_lo = curr->lo[0];
+                    pseudo_rand_hi = curr->hi[0];
+                    load_block(ref_next, get_ref_block(
+                                   memory, pseudo_rand_lo, pseudo_rand_hi,
+                                   lanes, segment_blocks, pass, slice,
+                                   lane, offset + 1 REF_COUNTER_ARG), thread);
+                }
+#endif
+
+                store_block_l(mem_curr, curr, thread);
+
+#ifdef ARGON2_PREFETCH_REFS
                 for (uint i = 0; i < QWORDS_PER_THREAD; i++) {
-                    uint pos_l = (thread & 0x10) + ((thread + i * 4) & 0xf);
-                    ulong out = upsample(curr->hi[i * THREADS_PER_LANE + pos_l],
-                                         curr->lo[i * THREADS_PER_LANE + pos_l]);
-                    mem_curr->data[i * THREADS_PER_LANE + thread] = out;
+                    ref[i] = ref_next[i];
                 }
+#endif
 
                 /* swap curr and prev buffers: */
-                __local struct block_l *tmp = curr;
+                SHARED_SPACE struct block_l *tmp = curr;
                 curr = prev;
                 prev = tmp;
 
                 ++mem_curr;
             }
+            COUNTERS_ADD(thread, segment_blocks - start_offset);
+            COUNTERS_SEGMENT_END(thread, pass, slice);
+            start_offset = 0;
 
             barrier(CLK_GLOBAL_MEM_FENCE);
 #if ARGON2_TYPE == ARGON2_I
@@ -550,6 +1209,7 @@ __kernel void argon2_kernel_oneshot(
                 ++thread_input;
             }
             if (thread == 6) {
+                COUNTERS_ADD_ADDR_BLOCKS(thread, thread_input);
                 thread_input = 0;
             }
 #endif
@@ -565,3 +1225,412 @@ __kernel void argon2_kernel_oneshot(
         mem_curr = mem_lane;
     }
 }
+
+/*
+ * With ARGON2_GLOBAL_SCRATCH, shared points to SHARED_BLOCKS blocks
+ * for each lane of each job (of the launch).
+ */
+__kernel void argon2_kernel_oneshot(
+        __global struct block_g *memory, SHARED_SPACE struct block_l *shared,
+        uint passes, uint lanes, uint segment_blocks COUNTERS_PARAM)
+{
+    size_t job_id = get_global_id(0);
+    uint lane = get_global_id(1);
+    uint thread = (uint)get_global_id(2);
+
+    uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
+
+    /* select job's memory region: */
+    memory += job_id * lanes * lane_blocks;
+#ifdef ARGON2_GLOBAL_SCRATCH
+    shared += job_id * lanes * SHARED_BLOCKS;
+#endif
+    COUNTERS_SELECT(job_id, lane, lanes, passes);
+
+    process_job(memory, shared, passes, lanes, segment_blocks, lane, thread
+                COUNTERS_ARG);
+}
+
+#ifndef ARGON2_GLOBAL_SCRATCH
+
+/*
+ * Same as argon2_kernel_oneshot, but the work-groups pull jobs from
+ * a queue until job_count jobs have been taken. Job i is stored in the
+ * memory slot queue[(queue_start + i) % queue_size]; head is the index
+ * of the next job to take and must be zeroed before the launch.
+ */
+__kernel void argon2_kernel_oneshot_stream(
+        __global struct block_g *memory, __local struct block_l *shared,
+        __global const uint *queue, __global volatile uint *head,
+        uint queue_size, uint queue_start, uint job_count,
+        uint passes, uint lanes, uint segment_blocks COUNTERS_PARAM)
+{
+    uint lane = get_local_id(1);
+    uint thread = (uint)get_local_id(2);
+
+    uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
+
+    __local uint job_index;
+    for (;;) {
+        if (lane == 0 && thread == 0) {
+            job_index = atomic_inc(head);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        uint index = job_index;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (index >= job_count) {
+            break;
+        }
+
+        size_t slot = queue[(queue_start + index) % queue_size];
+        process_job(memory + slot * lanes * lane_blocks, shared,
+                    passes, lanes, segment_blocks, lane, thread
+                    COUNTERS_RECORD_ARG(slot, lane, lanes, passes));
+    }
+}
+
+#if ARGON2_TYPE == ARGON2_I
+#define LOCAL_SHARED_BLOCKS 3
+#else
+#define LOCAL_SHARED_BLOCKS 1
+#endif
+
+/*
+ * Same as argon2_kernel_oneshot, but the whole memory of the job is kept
+ * in local memory (which must hold LOCAL_SHARED_BLOCKS + lane blocks
+ * for each lane). Global memory is only used to read the first two
+ * blocks of each lane and to write back the last one (which is all that
+ * is needed to finalize the hash).
+ */
+__kernel void argon2_kernel_oneshot_local(
+        __global struct block_g *memory, __local struct block_l *shared,
+        uint passes, uint lanes, uint segment_blocks COUNTERS_PARAM)
+{
+    size_t job_id = get_global_id(0);
+    uint lane = get_global_id(1);
+    uint thread = (uint)get_global_id(2);
+
+    uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
+
+    /* select job's memory region: */
+    memory += job_id * lanes * lane_blocks;
+    COUNTERS_SELECT(job_id, lane, lanes, passes);
+
+#ifdef ARGON2_COUNTERS
+    ulong cross_lane_refs = 0;
+#endif
+
+    /* the job's memory comes first, then per-lane working blocks: */
+    __local struct block_l *mem_local = shared;
+    shared += lanes * lane_blocks + lane * LOCAL_SHARED_BLOCKS;
+
+    __local struct block_l *restrict prev = &shared[0];
+#if ARGON2_TYPE == ARGON2_I
+    __local struct block_l *restrict addr = &shared[1];
+    __local struct block_l *restrict tmp = &shared[2];
+
+    uint thread_input;
+    switch (thread) {
+    case 1:
+        thread_input = lane;
+        break;
+    case 3:
+        thread_input = lanes * lane_blocks;
+        break;
+    case 4:
+        thread_input = passes;
+        break;
+    case 5:
+        thread_input = ARGON2_I;
+        break;
+    default:
+        thread_input = 0;
+        break;
+    }
+
+    if (segment_blocks > 2) {
+        if (thread == 6) {
+            ++thread_input;
+        }
+        next_addresses(thread_input, addr, tmp, thread);
+    }
+#endif
+
+    __global struct block_g *mem_lane = memory + (size_t)lane * lane_blocks;
+    __local struct block_l *mem_lane_l = mem_local + lane * lane_blocks;
+    __local struct block_l *mem_curr = mem_lane_l + 2;
+
+    load_block_l(&mem_lane_l[0], mem_lane + 0, thread);
+    load_block_l(&mem_lane_l[1], mem_lane + 1, thread);
+    load_block_l(prev, mem_lane + 1, thread);
+
+    /* the first blocks of other lanes must be visible before the first
+     * cross-lane reference: */
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    uint start_offset = 2;
+    for (uint pass = 0; pass < passes; ++pass) {
+        for (uint slice = 0; slice < ARGON2_SYNC_POINTS; ++slice) {
+            COUNTERS_SEGMENT_START(thread, pass, slice);
+            for (uint offset = start_offset; offset < segment_blocks; ++offset) {
+                uint pseudo_rand_lo, pseudo_rand_hi;
+#if ARGON2_TYPE == ARGON2_I
+                address_pseudo_rand(offset, &thread_input, addr, tmp,
+                                    thread, &pseudo_rand_lo, &pseudo_rand_hi);
+#else
+                pseudo_rand_lo = prev->lo[0];
+                pseudo_rand_hi = prev->hi[0];
+#endif
+                ulong ref[QWORDS_PER_THREAD];
+                load_block_local(ref, mem_local + ref_block_index(
+                                     pseudo_rand_lo, pseudo_rand_hi,
+                                     lanes, segment_blocks, pass, slice,
+                                     lane, offset REF_COUNTER_ARG), thread);
+
+                /* the new block is computed directly in its place in the
+                 * memory, prev only keeps a (disposable) copy of the
+                 * previous block: */
+#if ARGON2_VERSION == ARGON2_VERSION_10
+                fill_block(ref, prev, mem_curr, thread);
+#else
+                if (pass != 0) {
+                    fill_block_xor(ref, prev, mem_curr, thread);
+                } else {
+                    fill_block(ref, prev, mem_curr, thread);
+                }
+#endif
+                copy_block_l(prev, mem_curr, thread);
+
+                ++mem_curr;
+            }
+            COUNTERS_ADD(thread, segment_blocks - start_offset);
+            COUNTERS_SEGMENT_END(thread, pass, slice);
+            start_offset = 0;
+
+            barrier(CLK_LOCAL_MEM_FENCE);
+#if ARGON2_TYPE == ARGON2_I
+            if (thread == 2) {
+                ++thread_input;
+            }
+            if (thread == 6) {
+                COUNTERS_ADD_ADDR_BLOCKS(thread, thread_input);
+                thread_input = 0;
+            }
+#endif
+        }
+#if ARGON2_TYPE == ARGON2_I
+        if (thread == 0) {
+            ++thread_input;
+        }
+        if (thread == 2) {
+            thread_input = 0;
+        }
+#endif
+        mem_curr = mem_lane_l;
+    }
+
+    store_block_l(mem_lane + lane_blocks - 1, &mem_lane_l[lane_blocks - 1],
+                  thread);
+}
+
+/*
+ * CPU variant: each work-item computes the blocks of one lane on its own,
+ * keeping the whole block in private memory. There are no barriers inside
+ * the block computation, so CPU runtimes can vectorize the straight-line
+ * code across the work-items (i.e. jobs) of a work-group.
+ */
+#define G_CPU(a, b, c, d) \
+    do { \
+        a = F(a, b); \
+        d = rotr64(d ^ a, 32); \
+        c = F(c, d); \
+        b = rotr64(b ^ c, 24); \
+        a = F(a, b); \
+        d = rotr64(d ^ a, 16); \
+        c = F(c, d); \
+        b = rotr64(b ^ c, 63); \
+    } while (0)
+
+#define ROUND_CPU(v, i0, i1, i2, i3, i4, i5, i6, i7, \
+                  i8, i9, i10, i11, i12, i13, i14, i15) \
+    do { \
+        G_CPU(v[i0], v[i4], v[i8], v[i12]); \
+        G_CPU(v[i1], v[i5], v[i9], v[i13]); \
+        G_CPU(v[i2], v[i6], v[i10], v[i14]); \
+        G_CPU(v[i3], v[i7], v[i11], v[i15]); \
+        G_CPU(v[i0], v[i5], v[i10], v[i15]); \
+        G_CPU(v[i1], v[i6], v[i11], v[i12]); \
+        G_CPU(v[i2], v[i7], v[i8], v[i13]); \
+        G_CPU(v[i3], v[i4], v[i9], v[i14]); \
+    } while (0)
+
+/* applies the permutation P to the rows and then the columns: */
+void permute_block_cpu(ulong *v)
+{
+    for (uint i = 0; i < 8; i++) {
+        uint b = i * 16;
+        ROUND_CPU(v, b + 0, b + 1, b + 2, b + 3, b + 4, b + 5, b + 6, b + 7,
+                  b + 8, b + 9, b + 10, b + 11, b + 12, b + 13, b + 14, b + 15);
+    }
+    for (uint i = 0; i < 8; i++) {
+        uint b = i * 2;
+        ROUND_CPU(v, b + 0, b + 1, b + 16, b + 17, b + 32, b + 33, b + 48, b + 49,
+                  b + 64, b + 65, b + 80, b + 81, b + 96, b + 97, b + 112, b + 113);
+    }
+}
+
+/*
+ * Computes the next block from the previous one (which is replaced by the
+ * result) and the reference block. The result is stored to next (XOR-ed
+ * into its current contents if xor_next is set).
+ */
+void fill_block_cpu(__global const struct block_g *restrict ref,
+                    __global struct block_g *restrict next,
+                    ulong *restrict prev, bool xor_next)
+{
+    ulong r[ARGON2_QWORDS_IN_BLOCK], tmp[ARGON2_QWORDS_IN_BLOCK];
+    for (uint i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+        r[i] = tmp[i] = ref->data[i] ^ prev[i];
+    }
+    if (xor_next) {
+        for (uint i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+            tmp[i] ^= next->data[i];
+        }
+    }
+
+    permute_block_cpu(r);
+
+    for (uint i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+        prev[i] = r[i] ^ tmp[i];
+        next->data[i] = prev[i];
+    }
+}
+
+#if ARGON2_TYPE == ARGON2_I
+/* addr = G(0, G(0, input)): */
+void next_addresses_cpu(ulong *restrict addr, const ulong *restrict input)
+{
+    ulong tmp[ARGON2_QWORDS_IN_BLOCK];
+    for (uint i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+        tmp[i] = input[i];
+    }
+    permute_block_cpu(tmp);
+    for (uint i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+        addr[i] = tmp[i] ^= input[i];
+    }
+    permute_block_cpu(addr);
+    for (uint i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+        addr[i] ^= tmp[i];
+    }
+}
+#endif
+
+void process_segment_cpu(
+        __global struct block_g *memory,
+        uint passes, uint lanes, uint segment_blocks,
+        uint pass, uint slice, uint lane COUNTERS_PARAM)
+{
+    uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
+
+    uint start_offset = 0;
+    if (pass == 0 && slice == 0) {
+        start_offset = 2;
+    }
+
+#ifdef ARGON2_COUNTERS
+    ulong cross_lane_refs = 0;
+    COUNTERS_SEGMENT_START(0, pass, slice);
+#endif
+
+#if ARGON2_TYPE == ARGON2_I
+    ulong input[ARGON2_QWORDS_IN_BLOCK], addr[ARGON2_QWORDS_IN_BLOCK];
+    for (uint i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+        input[i] = 0;
+    }
+    input[0] = pass;
+    input[1] = lane;
+    input[2] = slice;
+    input[3] = lanes * lane_blocks;
+    input[4] = passes;
+    input[5] = ARGON2_I;
+#endif
+
+    __global struct block_g *mem_lane = memory + (size_t)lane * lane_blocks;
+    __global struct block_g *mem_curr = mem_lane
+            + slice * segment_blocks + start_offset;
+    __global struct block_g *mem_prev = mem_curr - 1;
+    if (slice == 0 && start_offset == 0) {
+        /* the first block of a lane follows the last one: */
+        mem_prev += lane_blocks;
+    }
+
+    ulong prev[ARGON2_QWORDS_IN_BLOCK];
+    for (uint i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+        prev[i] = mem_prev->data[i];
+    }
+
+    for (uint offset = start_offset; offset < segment_blocks; ++offset) {
+        ulong pseudo_rand;
+#if ARGON2_TYPE == ARGON2_I
+        if (offset % ARGON2_QWORDS_IN_BLOCK == 0 || offset == start_offset) {
+            ++input[6];
+            next_addresses_cpu(addr, input);
+        }
+        pseudo_rand = addr[offset % ARGON2_QWORDS_IN_BLOCK];
+#else
+        pseudo_rand = prev[0];
+#endif
+        __global struct block_g *ref = memory + ref_block_index(
+                    (uint)pseudo_rand, (uint)(pseudo_rand >> 32),
+                    lanes, segment_blocks, pass, slice, lane, offset
+                    REF_COUNTER_ARG);
+
+#if ARGON2_VERSION == ARGON2_VERSION_10
+        fill_block_cpu(ref, mem_curr, prev, false);
+#else
+        fill_block_cpu(ref, mem_curr, prev, pass != 0);
+#endif
+        ++mem_curr;
+    }
+
+#ifdef ARGON2_COUNTERS
+    COUNTERS_ADD(0, segment_blocks - start_offset);
+#if ARGON2_TYPE == ARGON2_I
+    counters[2] += input[6];
+#endif
+    COUNTERS_SEGMENT_END(0, pass, slice);
+#endif
+}
+
+/*
+ * Processes the segments [first_segment, last_segment) (segment index
+ * = pass * ARGON2_SYNC_POINTS + slice) with one work-item per lane.
+ * If more than one segment is processed, all lanes of a job must be
+ * in the same work-group.
+ */
+__kernel void argon2_kernel_cpu(
+        __global struct block_g *memory, uint passes, uint lanes,
+        uint segment_blocks, uint first_segment, uint last_segment
+        COUNTERS_PARAM)
+{
+    size_t job_id = get_global_id(0);
+    uint lane = get_global_id(1);
+
+    uint lane_blocks = ARGON2_SYNC_POINTS * segment_blocks;
+
+    /* select job's memory region: */
+    memory += job_id * lanes * lane_blocks;
+    COUNTERS_SELECT(job_id, lane, lanes, passes);
+
+    for (uint segment = first_segment; segment < last_segment; ++segment) {
+        if (segment != first_segment) {
+            barrier(CLK_GLOBAL_MEM_FENCE);
+        }
+        process_segment_cpu(memory, passes, lanes, segment_blocks,
+                            segment / ARGON2_SYNC_POINTS,
+                            segment % ARGON2_SYNC_POINTS, lane
+                            COUNTERS_ARG);
+    }
+}
+#endif /* ARGON2_GLOBAL_SCRATCH */
+#endif /* ARGON2_SPLIT_LANES */
@@ -54,10 +54,14 @@ public:
             const void *ad, std::size_t adLen,
             std::size_t t_cost, std::size_t m_cost, std::size_t lanes);
 
+    /* laneStride is the distance between two lanes in memory
+     * (in blocks); zero means getLaneBlocks(): */
     void fillFirstBlocks(void *memory, const void *pwd, std::size_t pwdLen,
-                         Type type, Version version) const;
+                         Type type, Version version,
+                         std::size_t laneStride = 0) const;
 
-    void finalize(void *out, const void *memory) const;
+    void finalize(void *out, const void *memory,
+                  std::size_t laneStride = 0) const;
 };
 
 } // namespace argon2
@@ -0,0 +1,44 @@
+#ifndef ARGON2_CPU_CPUIMPLEMENTATION_H
+#define ARGON2_CPU_CPUIMPLEMENTATION_H
+
+#include <cstddef>
+
+namespace argon2 {
+namespace cpu {
+
+/**
+ * @brief The instruction sets that the block compression of the CPU
+ * backend is implemented with.
+ */
+enum Implementation {
+    IMPLEMENTATION_PORTABLE,
+    IMPLEMENTATION_SSE2,
+    IMPLEMENTATION_AVX2,
+    IMPLEMENTATION_AVX512,
+
+    IMPLEMENTATION_COUNT,
+};
+
+/**
+ * @brief Returns whether the CPU (and the build) supports the given
+ * implementation.
+ */
+bool isImplementationSupported(Implementation impl);
+
+/**
+ * @brief Returns the fastest implementation supported by the CPU.
+ */
+Implementation getBestImplementation();
+
+const char *getImplementationName(Implementation impl);
+
+/**
+ * @brief Returns the number of Argon2i jobs that the implementation
+ * computes in lockstep (one per SIMD lane), or 1 if it can't.
+ */
+std::size_t getLockstepJobs(Implementation impl);
+
+} // namespace cpu
+} // namespace argon2
+
+#endif // ARGON2_CPU_CPUIMPLEMENTATION_H
@@ -0,0 +1,149 @@
+#ifndef ARGON2_CPU_PROCESSINGUNIT_H
+#define ARGON2_CPU_PROCESSINGUNIT_H
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "argon2-common.h"
+#include "argon2params.h"
+#include "cpuimplementation.h"
+#include "memorypool.h"
+#include "threadpool.h"
+
+namespace argon2 {
+namespace cpu {
+
+/**
+ * @brief Computes batches of hashes on the host CPU, with the same batch
+ * interface as opencl::ProcessingUnit.
+ *
+ * It serves as a baseline for the OpenCL units and as a fallback on hosts
+ * without a usable OpenCL device; it can also run next to the devices
+ * in an opencl::Dispatcher.
+ */
+class ProcessingUnit
+{
+private:
+    const Argon2Params *params;
+    Type type;
+    Version version;
+    ThreadPool *pool;
+    Implementation impl;
+
+    std::size_t batchSize;
+    /* the jobs are computed in groups of lockstepJobs, with their blocks
+     * interleaved (see fillSegmentLockstep()) if there is more than one: */
+    std::size_t lockstepJobs;
+    /* segments that a thread computes in turns (see
+     * fillSegmentsInterleaved()) if the jobs are not in lockstep: */
+    std::size_t interleavedSegments;
+    /* the unit's own memory pool, if not given one: */
+    std::unique_ptr<MemoryPool> ownMemoryPool;
+    MemoryPool *memoryPool;
+    MemoryPool::Buffer memory;
+
+    std::thread worker;
+
+    std::size_t getGroupCount() const;
+    std::uint8_t *getGroupMemory(std::size_t group) const;
+    void computeSegment(std::size_t group, std::uint32_t pass,
+                        std::uint32_t slice, std::uint32_t lane) const;
+    /* the segments [from, to) of the pass and slice, counting the lanes
+     * of all groups: */
+    void computeSegments(std::size_t from, std::size_t to,
+                         std::uint32_t pass, std::uint32_t slice) const;
+    void process();
+
+public:
+    class PasswordWriter
+    {
+    private:
+        const ProcessingUnit *parent;
+        const Argon2Params *params;
+        Type type;
+        Version version;
+        std::size_t index;
+
+    public:
+        PasswordWriter(ProcessingUnit &parent, std::size_t index = 0);
+
+        void moveForward(std::size_t offset);
+        void moveBackwards(std::size_t offset);
+
+        void setPassword(const void *pw, std::size_t pwSize) const;
+    };
+
+    class HashReader
+    {
+    private:
+        const ProcessingUnit *parent;
+        const Argon2Params *params;
+        std::size_t index;
+        std::unique_ptr<uint8_t[]> buffer;
+
+    public:
+        HashReader(ProcessingUnit &parent, std::size_t index = 0);
+
+        void moveForward(std::size_t offset);
+        void moveBackwards(std::size_t offset);
+
+        const void *getHash() const;
+    };
+
+    ThreadPool *getThreadPool() const { return pool; }
+    MemoryPool *getMemoryPool() const { return memoryPool; }
+    Implementation getImplementation() const { return impl; }
+    std::size_t getBatchSize() const { return batchSize; }
+    std::size_t getLockstepJobs() const { return lockstepJobs; }
+    bool isLockstep() const { return lockstepJobs > 1; }
+    std::size_t getInterleavedSegments() const { return interleavedSegments; }
+
+    /**
+     * @brief Creates a unit computing batchSize hashes at once on the
+     * threads of the given pool. Several units may share one pool.
+     *
+     * The block compression uses the given instruction set, by default
+     * the fastest one that the CPU supports. Throws std::logic_error if
+     * the CPU does not support it.
+     *
+     * If allowLockstep is true, the batch is big enough and the type is
+     * Argon2i (whose jobs all reference the same blocks), each thread
+     * computes getLockstepJobs(impl) jobs at once, one per SIMD lane.
+     * Otherwise each thread takes turns computing up to
+     * interleavedSegments segments (of several jobs or lanes), which
+     * hides the latency of the random reference reads (mainly for
+     * Argon2d with more memory than fits into the caches); 1 turns
+     * this off and 0 chooses by the memory size. At most 16 segments
+     * are interleaved.
+     *
+     * The job memory comes from memoryPool, if given (it must outlive
+     * the unit), or else from a pool of the unit's own with the default
+     * settings.
+     */
+    ProcessingUnit(const Argon2Params *params, Type type, Version version,
+                   ThreadPool *pool, std::size_t batchSize,
+                   Implementation impl = getBestImplementation(),
+                   bool allowLockstep = true,
+                   MemoryPool *memoryPool = nullptr,
+                   std::size_t interleavedSegments = 0);
+    ~ProcessingUnit();
+
+    ProcessingUnit(const ProcessingUnit &) = delete;
+    ProcessingUnit &operator=(const ProcessingUnit &) = delete;
+
+    /**
+     * @brief Starts computing the batch in the background.
+     */
+    void beginProcessing();
+
+    /**
+     * @brief Waits until the processing is finished.
+     */
+    void endProcessing();
+};
+
+} // namespace cpu
+} // namespace argon2
+
+#endif // ARGON2_CPU_PROCESSINGUNIT_H
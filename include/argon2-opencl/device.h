@@ -20,19 +20,49 @@
 
 #include "opencl.h"
 
+#include <memory>
+#include <string>
+
 namespace argon2 {
 namespace opencl {
 
+/**
+ * @brief A snapshot of the device properties that the library (and its
+ * users) query repeatedly, taken once when the Device is created.
+ */
+struct DeviceProperties
+{
+    std::string name;
+    std::string vendor;
+    std::string platformName;
+    std::string version;
+    std::string driverVersion;
+    std::string extensions;
+
+    cl_device_type type;
+    cl_uint computeUnits;
+    cl_uint nativeVectorWidthLong;
+    std::size_t maxWorkGroupSize;
+    cl_ulong globalMemSize;
+    cl_ulong maxMemAllocSize;
+    cl_ulong localMemSize;
+};
+
 class Device
 {
 private:
     cl::Device device;
+    std::shared_ptr<const DeviceProperties> properties;
+
+    static std::shared_ptr<const DeviceProperties> queryProperties(
+            const cl::Device &device);
 
 public:
     std::string getName() const;
     std::string getInfo() const;
 
     const cl::Device &getCLDevice() const { return device; }
+    const DeviceProperties &getProperties() const { return *properties; }
 
     /**
      * @brief Empty constructor.
@@ -42,7 +72,7 @@ public:
     Device() { }
 
     Device(const cl::Device &device)
-        : device(device)
+        : device(device), properties(queryProperties(device))
     {
     }
 
@@ -0,0 +1,178 @@
+#ifndef ARGON2_OPENCL_DISPATCHER_H
+#define ARGON2_OPENCL_DISPATCHER_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "processingunit.h"
+#include "cpuprocessingunit.h"
+
+namespace argon2 {
+namespace opencl {
+
+/**
+ * @brief Spreads a stream of jobs over several processing units, possibly
+ * on several engines (OpenCL devices, host CPU backends...) of different
+ * speeds.
+ *
+ * The jobs of each run are split into one contiguous range per engine
+ * (in proportion to the throughput the engines reached in the previous
+ * run, or to their total batch size at first). Every unit runs on its own
+ * thread and takes batches from the front of its engine's range; once
+ * that is empty, it steals batches from the back of the range of the
+ * engine that would take the longest to finish its jobs, so that all
+ * engines finish at about the same time.
+ */
+class Dispatcher
+{
+public:
+    /* called concurrently from the worker threads (for distinct indices);
+     * the password only has to stay valid until the next call from the
+     * same thread: */
+    typedef std::function<void(std::size_t index,
+                               const void *&pw, std::size_t &pwSize)>
+        PasswordSource;
+    /* called concurrently from the worker threads (for distinct indices);
+     * the hash is only valid during the call: */
+    typedef std::function<void(std::size_t index, const void *hash)>
+        HashSink;
+
+    /**
+     * @brief A unit of any hashing engine; addUnit() wraps OpenCL
+     * ProcessingUnits into this interface.
+     */
+    class Unit
+    {
+    public:
+        virtual ~Unit() { }
+
+        /* units that return the same engine share one range of jobs
+         * (and their statistics): */
+        virtual const void *getEngine() const = 0;
+        virtual std::string getEngineName() const = 0;
+        /* the OpenCL device of the engine (nullptr for other engines): */
+        virtual const Device *getDevice() const { return nullptr; }
+
+        /* the most jobs that process() takes at once: */
+        virtual std::size_t getBatchSize() const = 0;
+
+        /* computes the hashes of the jobs [from, to): */
+        virtual void process(std::size_t from, std::size_t to,
+                             const PasswordSource &getPassword,
+                             const HashSink &putHash) = 0;
+    };
+
+    struct EngineStats
+    {
+        std::string name;
+        const Device *device;
+        std::size_t units;
+        std::uint64_t hashes;
+        std::uint64_t batches;
+        /* batches taken from the ranges of other devices: */
+        std::uint64_t stolenBatches;
+        /* time from the start of each run until the device ran out of
+         * work, summed over all runs: */
+        std::uint64_t nanoseconds;
+
+        double getHashesPerSecond() const
+        {
+            return nanoseconds == 0 ? 0.0 : hashes * 1e9 / nanoseconds;
+        }
+    };
+
+private:
+    struct EngineQueue
+    {
+        const void *engine;
+        /* total batch size of the engine's units: */
+        std::size_t batchSize;
+        /* the share of the jobs the engine got in this run: */
+        double weight;
+        /* the throughput of the engine in the last run: */
+        double lastHashesPerSecond;
+
+        std::mutex mutex;
+        std::size_t begin, end;
+        std::uint64_t runHashes;
+        std::uint64_t runNanoseconds;
+        EngineStats stats;
+    };
+
+    const Argon2Params *params;
+
+    std::vector<std::unique_ptr<Unit>> units;
+    std::vector<EngineQueue *> unitQueues;
+    std::vector<std::unique_ptr<EngineQueue>> queues;
+    std::chrono::steady_clock::time_point runStart;
+
+    void splitJobs(std::size_t count);
+    bool takeJobs(EngineQueue &own, std::size_t maxJobs,
+                  std::size_t &from, std::size_t &to, bool &stolen);
+    void runUnit(std::size_t index, const PasswordSource &getPassword,
+                 const HashSink &putHash);
+
+public:
+    explicit Dispatcher(const Argon2Params *params)
+        : params(params)
+    {
+    }
+
+    Dispatcher(const Dispatcher &) = delete;
+    Dispatcher &operator=(const Dispatcher &) = delete;
+
+    /**
+     * @brief Adds a unit; the unit must compute hashes for the params
+     * the dispatcher was created with. Units of the same engine share
+     * that engine's range of jobs.
+     */
+    void addUnit(std::unique_ptr<Unit> unit);
+
+    /**
+     * @brief Adds an OpenCL unit; its engine is its device.
+     */
+    void addUnit(std::unique_ptr<ProcessingUnit> unit);
+
+    /**
+     * @brief Adds a host CPU unit; its engine is its thread pool.
+     */
+    void addUnit(std::unique_ptr<cpu::ProcessingUnit> unit);
+
+    /**
+     * @brief Adds unitCount units (with the default processing modes)
+     * for the given device. More than one unit per device lets the host
+     * seed and read one batch while another one is being computed.
+     */
+    void addDevice(const ProgramContext *programContext,
+                   const Device *device, std::size_t batchSize,
+                   std::size_t unitCount = 2);
+
+    std::size_t getUnitCount() const { return units.size(); }
+    std::size_t getEngineCount() const { return queues.size(); }
+
+    /**
+     * @brief Returns the statistics of each engine (in the order in which
+     * the engines were added), accumulated over all runs since the last
+     * resetStats().
+     */
+    std::vector<EngineStats> getStats() const;
+    void resetStats();
+
+    /**
+     * @brief Computes the hashes of the jobs 0 to count - 1 and waits for
+     * all of them. If a unit fails, the remaining jobs are abandoned and
+     * the first error is rethrown.
+     */
+    void run(std::size_t count, const PasswordSource &getPassword,
+             const HashSink &putHash);
+};
+
+} // namespace opencl
+} // namespace argon2
+
+#endif // ARGON2_OPENCL_DISPATCHER_H
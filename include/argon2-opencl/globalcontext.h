@@ -20,21 +20,60 @@
 
 #include "device.h"
 
+#include <mutex>
 #include <string>
 #include <vector>
 
 namespace argon2 {
 namespace opencl {
 
+/**
+ * @brief Selects the devices that a GlobalContext discovers.
+ *
+ * The default-constructed filter accepts all devices of all platforms.
+ */
+struct DeviceFilter
+{
+    /* only platforms whose name contains this (case-insensitive;
+     * empty = any platform): */
+    std::string platformName;
+    /* only devices whose vendor contains this (case-insensitive;
+     * empty = any vendor): */
+    std::string vendor;
+    /* only devices of these types: */
+    cl_device_type type = CL_DEVICE_TYPE_ALL;
+    /* only the devices with these indices in the list of devices that
+     * pass the criteria above (empty = all of them; indices that are
+     * out of range are ignored): */
+    std::vector<std::size_t> indices;
+};
+
 class GlobalContext
 {
 private:
-    std::vector<Device> devices;
+    DeviceFilter filter;
+
+    mutable std::once_flag discovered;
+    mutable std::vector<Device> devices;
+
+    void discoverDevices() const;
 
 public:
-    const std::vector<Device> &getAllDevices() const { return devices; }
+    const DeviceFilter &getFilter() const { return filter; }
+
+    /**
+     * @brief Returns the devices that pass the filter, in the order of
+     * their platforms and (for DeviceFilter::indices) in the order of the
+     * given indices. The platforms are only queried on the first call,
+     * and platforms that the filter rules out are never asked for their
+     * devices. The list is empty if no OpenCL platform is installed.
+     */
+    const std::vector<Device> &getAllDevices() const;
+
+    explicit GlobalContext(const DeviceFilter &filter = DeviceFilter());
 
-    GlobalContext();
+    GlobalContext(const GlobalContext &) = delete;
+    GlobalContext &operator=(const GlobalContext &) = delete;
 };
 
 } // namespace opencl
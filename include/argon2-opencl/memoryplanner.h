@@ -0,0 +1,82 @@
+#ifndef ARGON2_OPENCL_MEMORYPLANNER_H
+#define ARGON2_OPENCL_MEMORYPLANNER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "device.h"
+
+namespace argon2 {
+namespace opencl {
+
+/**
+ * @brief Plans how the hash memory of a batch is laid out on a device.
+ *
+ * Many devices limit a single allocation to CL_DEVICE_MAX_MEM_ALLOC_SIZE
+ * (often a quarter of CL_DEVICE_GLOBAL_MEM_SIZE), so a batch is split into
+ * shards of whole jobs, each of which fits into one buffer and is
+ * processed by its own kernel launches. If even a single job does not fit
+ * into one allocation, its lanes may be split between several buffers
+ * (see KERNEL_SPLIT_LANES).
+ */
+class MemoryPlanner
+{
+public:
+    struct Shard
+    {
+        std::size_t firstJob;
+        std::size_t jobs;
+    };
+
+    /* the most buffers the lanes of one job may be split between
+     * (MAX_MEMORY_BUFFERS in the kernel): */
+    static const std::size_t MAX_LANE_BUFFERS = 8;
+
+    /**
+     * @brief Returns the number of bytes of global memory that may be used
+     * for hash memory (the global memory size minus a reserve for the
+     * driver and the other buffers).
+     */
+    static std::uint64_t getMemoryBudget(const Device &device);
+
+    /**
+     * @brief Returns the largest number of jobs with jobMemorySize bytes of
+     * memory each that fit into the device's memory budget, or zero if
+     * the part of a job that has to be in one buffer (bufferMemorySize
+     * bytes, zero meaning the whole job) is too large for one allocation.
+     */
+    static std::size_t getMaxBatchSize(const Device &device,
+                                       std::size_t jobMemorySize,
+                                       std::size_t bufferMemorySize = 0);
+
+    /**
+     * @brief Returns the number of lanes (with laneMemorySize bytes of
+     * memory each) of one job to put into each buffer: all of them if the
+     * job fits into one allocation, otherwise as many as fit into one.
+     * Throws std::length_error if a single lane does not fit into one
+     * allocation or more than MAX_LANE_BUFFERS buffers would be needed.
+     */
+    static std::size_t getLanesPerBuffer(const Device &device,
+                                         std::size_t laneMemorySize,
+                                         std::size_t lanes);
+
+    /**
+     * @brief Splits a batch into as few shards as possible (but at least
+     * minShards, if there are enough jobs), with the jobs spread evenly
+     * between them. If the lanes of each job are split between several
+     * buffers, bufferMemorySize is the size of the largest part of a job
+     * (zero means the whole job). Throws std::length_error describing
+     * the limit if that part does not fit into one allocation or the batch
+     * does not fit into the memory budget.
+     */
+    static std::vector<Shard> planShards(const Device &device,
+                                         std::size_t jobMemorySize,
+                                         std::size_t batchSize,
+                                         std::size_t minShards = 1,
+                                         std::size_t bufferMemorySize = 0);
+};
+
+} // namespace opencl
+} // namespace argon2
+
+#endif // ARGON2_OPENCL_MEMORYPLANNER_H
@@ -0,0 +1,121 @@
+#ifndef ARGON2_CPU_MEMORYPOOL_H
+#define ARGON2_CPU_MEMORYPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace argon2 {
+namespace cpu {
+
+/**
+ * @brief Hands out the job memory of CPU processing units and keeps it
+ * when they are done with it, so that later units get memory that is
+ * already mapped.
+ *
+ * On Linux the memory is mapped on huge pages if possible (with fewer
+ * TLB misses on the random block references), optionally bound to one
+ * NUMA node, and faulted in before it is handed out. Elsewhere it comes
+ * from operator new.
+ */
+class MemoryPool
+{
+public:
+    enum PageSize {
+        PAGES_DEFAULT,
+        /* 2 MiB pages, or transparent huge pages if there are none: */
+        PAGES_2M,
+        /* 1 GiB pages, or the above if there are none: */
+        PAGES_1G,
+    };
+
+    struct Stats
+    {
+        /* buffers handed out, and those of them that were reused: */
+        std::size_t allocations;
+        std::size_t reuses;
+        /* memory mapped so far (by page size actually used): */
+        std::size_t bytes;
+        std::size_t bytes2M;
+        std::size_t bytes1G;
+    };
+
+    /**
+     * @brief A piece of memory from a pool; it goes back to the pool
+     * when destroyed.
+     */
+    class Buffer
+    {
+    private:
+        MemoryPool *pool;
+        void *data;
+        std::size_t size;
+
+        friend class MemoryPool;
+
+    public:
+        Buffer() : pool(nullptr), data(nullptr), size(0) { }
+        Buffer(Buffer &&other);
+        Buffer &operator=(Buffer &&other);
+        ~Buffer();
+
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
+
+        std::uint8_t *get() const { return static_cast<std::uint8_t *>(data); }
+        std::size_t getSize() const { return size; }
+    };
+
+private:
+    struct Mapping
+    {
+        std::size_t size;
+        PageSize pageSize;
+    };
+
+    PageSize pageSize;
+    int numaNode;
+
+    std::mutex mutex;
+    /* all mappings, and the free ones by size: */
+    std::map<void *, Mapping> mappings;
+    std::multimap<std::size_t, void *> freeMappings;
+    Stats stats;
+
+    void *map(std::size_t size, PageSize &usedPageSize);
+    void unmap(void *data, const Mapping &mapping);
+    void release(void *data);
+
+public:
+    /**
+     * @brief Creates a pool that maps memory on pages of up to the given
+     * size, on the given NUMA node (negative means anywhere).
+     */
+    explicit MemoryPool(PageSize pageSize = PAGES_2M, int numaNode = -1);
+
+    /**
+     * @brief Unmaps all memory; all buffers must have been returned.
+     */
+    ~MemoryPool();
+
+    MemoryPool(const MemoryPool &) = delete;
+    MemoryPool &operator=(const MemoryPool &) = delete;
+
+    PageSize getPageSize() const { return pageSize; }
+    int getNumaNode() const { return numaNode; }
+
+    Stats getStats();
+
+    /**
+     * @brief Returns a buffer of at least size bytes, reusing a free one
+     * of the same size if there is any. New memory is zeroed; reused
+     * memory keeps its contents.
+     */
+    Buffer allocate(std::size_t size);
+};
+
+} // namespace cpu
+} // namespace argon2
+
+#endif // ARGON2_CPU_MEMORYPOOL_H
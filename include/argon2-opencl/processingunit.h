@@ -2,8 +2,13 @@
 #define ARGON2_OPENCL_PROCESSINGUNIT_H
 
 #include <memory>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
 
 #include "programcontext.h"
+#include "memoryplanner.h"
 #include "argon2params.h"
 
 namespace argon2 {
@@ -12,32 +17,79 @@ namespace opencl {
 class ProcessingUnit
 {
 private:
+    /* a part of the batch with its own buffers (see MemoryPlanner),
+     * processed on one of the command queues: */
+    struct Shard
+    {
+        std::size_t firstJob;
+        std::size_t jobs;
+
+        cl::CommandQueue cmdQueue;
+        /* one buffer per group of lanesPerBuffer lanes: */
+        std::vector<cl::Buffer> memoryBuffers;
+        cl::Buffer debugBuffer;
+        cl::Buffer syncBuffer;
+        cl::Buffer scratchBuffer;
+
+        std::vector<void *> mappedMemoryBuffers;
+
+        cl::Kernel kernel;
+        cl::Event event;
+
+        std::size_t nextChunk;
+        std::deque<cl::Event> chunkEvents;
+    };
+
     const ProgramContext *programContext;
     const Argon2Params *params;
     const Device *device;
 
     std::size_t batchSize;
-    std::size_t memorySize;
 
     bool bySegment;
+    bool persistent;
+    bool localMemoryResident;
+    bool globalScratch;
+    bool cpuKernel;
+    std::size_t cpuJobsPerGroup;
+    std::size_t lanesPerBuffer;
 
-    cl::CommandQueue cmdQueue;
-    cl::Buffer memoryBuffer;
-    cl::Buffer debugBuffer;
+    cl::Program program;
+    std::string kernelName;
+    std::size_t localMemSize;
 
-    void *mappedMemoryBuffer;
+    std::size_t chunkBlocks;
+    std::size_t chunksPerSegment;
+    std::size_t chunkCount;
+    std::atomic<bool> cancelled;
 
-    cl::Kernel kernel;
-    cl::Event event;
+    std::size_t countersRecordSize;
+    std::vector<cl_ulong> counters;
+
+    std::vector<cl::CommandQueue> cmdQueues;
+    std::vector<Shard> shards;
+
+    void setUpShard(Shard &shard);
+    void enqueueKernels(Shard &shard);
+    void enqueueNextChunk(Shard &shard);
+    void mapMemory(Shard &shard, bool blocking, cl_map_flags flags,
+                   cl::Event *event);
+    void unmapMemory(Shard &shard);
+
+    std::size_t getLaneGroupSize(std::size_t group) const;
+    std::uint8_t *getLaneMemory(std::size_t job, std::size_t lane) const;
 
 public:
     class PasswordWriter
     {
     private:
+        const ProcessingUnit *parent;
         const Argon2Params *params;
         Type type;
         Version version;
-        std::uint8_t *dest;
+        std::size_t index;
+        /* the first blocks of the lanes if they are split: */
+        std::unique_ptr<uint8_t[]> buffer;
 
     public:
         PasswordWriter(ProcessingUnit &parent, std::size_t index = 0);
@@ -51,9 +103,12 @@ public:
     class HashReader
     {
     private:
+        const ProcessingUnit *parent;
         const Argon2Params *params;
-        const std::uint8_t *src;
+        std::size_t index;
         std::unique_ptr<uint8_t[]> buffer;
+        /* the last blocks of the lanes if they are split: */
+        std::unique_ptr<uint8_t[]> lastBlocks;
 
     public:
         HashReader(ProcessingUnit &parent, std::size_t index = 0);
@@ -64,15 +119,154 @@ public:
         const void *getHash() const;
     };
 
+    const Device *getDevice() const { return device; }
     std::size_t getBatchSize() const { return batchSize; }
 
+    /**
+     * @brief Returns true if each lane is processed by a separate
+     * work-group. This is also the case in oneshot mode if the lanes
+     * of one job do not fit into a single work-group (the work-group
+     * size limit of the device and kernel).
+     */
+    bool isBySegment() const { return bySegment; }
+
+    /**
+     * @brief Returns true if all passes and slices are processed
+     * by a single kernel launch.
+     */
+    bool isPersistent() const { return persistent; }
+
+    /**
+     * @brief Returns true if the whole memory of each job is kept in
+     * the device's local memory during processing.
+     */
+    bool isLocalMemoryResident() const { return localMemoryResident; }
+
+    /**
+     * @brief Returns true if the oneshot kernel keeps the working blocks
+     * of the lanes in global memory (see KERNEL_GLOBAL_SCRATCH).
+     */
+    bool isGlobalScratch() const { return globalScratch; }
+
+    /**
+     * @brief Returns true if the kernel variant for CPU devices (one
+     * work-item per lane) is used.
+     */
+    bool isCpuKernel() const { return cpuKernel; }
+
+    /**
+     * @brief Returns the number of command queues the batch is split
+     * between.
+     */
+    std::size_t getQueueCount() const { return cmdQueues.size(); }
+
+    /**
+     * @brief Returns the number of buffers the memory of the batch is
+     * split into (at least one per command queue).
+     */
+    std::size_t getShardCount() const { return shards.size(); }
+
+    /**
+     * @brief Returns the number of lanes of each job kept in one buffer
+     * (equal to the number of lanes unless they are split between
+     * several buffers).
+     */
+    std::size_t getLanesPerBuffer() const { return lanesPerBuffer; }
+
+    /**
+     * @brief Creates a processing unit.
+     * If bySegment is false and allowLocalMemory is true, the whole job
+     * memory is kept in local memory whenever it fits there.
+     * If bySegment and allowPersistent are true, a single kernel launch
+     * is used for all passes and slices whenever the work-groups of one
+     * job (of each command queue) can all be resident on the device at
+     * the same time. The persistent kernel spins until the other lanes
+     * catch up, so it needs exclusive use of the device: it may hang if
+     * other kernels (e.g. of another unit) occupy some compute units.
+     * If bySegment is false and all lanes of a job fit into one
+     * work-group, but their working blocks do not fit into the local
+     * memory, the oneshot kernel keeps them in global memory instead
+     * (still one work-group per job and one launch).
+     * If bySegment is false, but all lanes of a job do not fit into one
+     * work-group (the work-group size limit), the unit behaves as if
+     * bySegment were true; this is the only case in which the oneshot
+     * mode falls back to one work-group per lane.
+     * If chunkBlocks is non-zero, each kernel launch computes at most
+     * chunkBlocks blocks of each lane (this implies bySegment and
+     * disables the persistent and local memory kernels), so that
+     * the processing can be cancelled between launches.
+     * If allowCpuKernel is true and the device is a CPU, the kernel
+     * variant for CPUs is used instead (unless chunkBlocks is non-zero);
+     * bySegment, allowLocalMemory and allowPersistent are then ignored.
+     * If queueCount is greater than one, the batch is split into that
+     * many parts (at most one per job), each with its own command queue
+     * and device memory, so that the transfers of one part can overlap
+     * the computation of another and (on devices that support it) the
+     * kernels of the parts can run concurrently.
+     * The memory of the batch is also split into several buffers when
+     * it does not fit into one allocation (see MemoryPlanner); throws
+     * std::length_error if the batch does not fit on the device at all.
+     * If the program was built with KERNEL_SPLIT_LANES, the segment kernel
+     * is always used and the lanes of each job are split between buffers
+     * of lanesPerBuffer lanes each (zero means as many as fit into one
+     * allocation, so they are only split if a job does not fit into one).
+     * If the program was built with KERNEL_GLOBAL_SCRATCH, only the
+     * oneshot kernel with the working blocks in global memory can be
+     * used; throws std::logic_error if chunkBlocks is non-zero and
+     * std::length_error if the lanes of a job do not fit into one
+     * work-group.
+     */
     ProcessingUnit(
             const ProgramContext *programContext, const Argon2Params *params,
             const Device *device, std::size_t batchSize,
-            bool bySegment = true);
+            bool bySegment = true, bool allowLocalMemory = true,
+            bool allowPersistent = false, std::size_t chunkBlocks = 0,
+            bool allowCpuKernel = true, std::size_t queueCount = 1,
+            std::size_t lanesPerBuffer = 0);
+
+    std::size_t getChunkBlocks() const { return chunkBlocks; }
+
+    /**
+     * @brief Counters recorded for one lane of one job by kernels built
+     * with KERNEL_COUNTERS.
+     */
+    struct LaneCounters
+    {
+        std::uint64_t blocks;
+        std::uint64_t crossLaneRefs;
+        std::uint64_t addressBlocks;
+        /* device clock at the start/end of each segment (indexed by
+         * pass * ARGON2_SYNC_POINTS + slice); all zero if the device
+         * does not support cl_khr_kernel_clock: */
+        std::vector<std::uint64_t> segmentStart;
+        std::vector<std::uint64_t> segmentEnd;
+    };
+
+    /**
+     * @brief Returns true if the program was built with KERNEL_COUNTERS.
+     */
+    bool hasCounters() const { return countersRecordSize != 0; }
+
+    /**
+     * @brief Returns the counters of the given lane of the given job
+     * from the last finished processing. Only valid if hasCounters().
+     */
+    LaneCounters getCounters(std::size_t job, std::size_t lane) const;
 
     void beginProcessing();
-    void endProcessing();
+
+    /**
+     * @brief Waits until the processing is finished.
+     * Returns false if it was cancelled (the hashes are then invalid).
+     */
+    bool endProcessing();
+
+    /**
+     * @brief Stops chunked processing before the next chunk is started.
+     * May be called from any thread; has no effect unless chunkBlocks
+     * is non-zero. The flag is cleared by beginProcessing().
+     */
+    void cancel() { cancelled = true; }
 };
 
 } // namespace opencl
@@ -4,9 +4,43 @@
 #include "globalcontext.h"
 #include "argon2-common.h"
 
+#include <mutex>
+#include <string>
+
 namespace argon2 {
 namespace opencl {
 
+/**
+ * @brief Optional kernel variants, selected when the program is built.
+ * Values may be OR-ed together.
+ */
+enum KernelFlags {
+    /* Load the next reference block while the current one is computed
+     * (in Argon2d, whose next reference depends on the computed block,
+     * the load only overlaps the write-back): */
+    KERNEL_PREFETCH_REFS = 0x1,
+    /* Move blocks to/from global memory using vector loads/stores: */
+    KERNEL_VECTOR_ACCESS = 0x2,
+    /* Keep the work-item's part of the block being computed in registers
+     * (overrides KERNEL_VECTOR_ACCESS, which needs a different layout): */
+    KERNEL_REGISTER_STATE = 0x4,
+    /* Instrumentation: record per-lane counters and segment timestamps
+     * (see ProcessingUnit::getCounters()); slows the kernels down: */
+    KERNEL_COUNTERS = 0x8,
+    /* Do not use the vendor-specific implementations of the BlaMka
+     * multiply and 64-bit rotations (selected automatically otherwise): */
+    KERNEL_PORTABLE_ARITHMETIC = 0x10,
+    /* Allow the lanes of a job to be spread over several buffers, so that
+     * the memory of one job may exceed the largest allocation the device
+     * allows (only the segment kernel is built with this flag): */
+    KERNEL_SPLIT_LANES = 0x20,
+    /* Keep the working blocks of the lanes in global instead of local
+     * memory, for devices whose local memory cannot hold them for all
+     * lanes of a job (only the oneshot kernel is built with this flag,
+     * and it is ignored together with KERNEL_SPLIT_LANES): */
+    KERNEL_GLOBAL_SCRATCH = 0x40,
+};
+
 class ProgramContext
 {
 private:
@@ -18,6 +52,14 @@ private:
 
     Type type;
     Version version;
+    unsigned int kernelFlags;
+
+    std::string sourceDirectory;
+
+    mutable std::once_flag globalScratchBuilt;
+    mutable cl::Program globalScratchProgram;
+
+    void buildGlobalScratchProgram() const;
 
 public:
     const GlobalContext *getGlobalContext() const { return globalContext; }
@@ -28,11 +70,27 @@ public:
 
     Type getArgon2Type() const { return type; }
     Version getArgon2Version() const { return version; }
+    unsigned int getKernelFlags() const { return kernelFlags; }
+
+    /**
+     * @brief Returns the program built with KERNEL_GLOBAL_SCRATCH added
+     * to the kernel flags, in the same OpenCL context. It is built on
+     * the first call (unless the program itself was built with that
+     * flag).
+     */
+    const cl::Program &getGlobalScratchProgram() const;
+
+    /**
+     * @brief Returns the kernel flags that are expected to perform best
+     * on the given device.
+     */
+    static unsigned int getPreferredKernelFlags(const Device &device);
 
     ProgramContext(
             const GlobalContext *globalContext,
             const std::vector<Device> &devices,
-            Type type, Version version);
+            Type type, Version version,
+            unsigned int kernelFlags = 0);
 };
 
 } // namespace opencl
@@ -0,0 +1,63 @@
+#ifndef ARGON2_OPENCL_PROGRAMPOOL_H
+#define ARGON2_OPENCL_PROGRAMPOOL_H
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+#include "programcontext.h"
+
+namespace argon2 {
+namespace opencl {
+
+/**
+ * @brief Builds program contexts in the background and shares them.
+ *
+ * Each distinct (devices, type, version, kernel flags) combination is
+ * built only once, on its own thread, so requesting several programs
+ * up front makes the start-up as long as the longest build instead of
+ * the sum of all of them.
+ */
+class ProgramPool
+{
+public:
+    typedef std::shared_future<std::shared_ptr<const ProgramContext>> Handle;
+
+private:
+    typedef std::tuple<std::vector<cl_device_id>, Type, Version, unsigned int>
+        Key;
+
+    const GlobalContext *globalContext;
+
+    std::mutex mutex;
+    std::map<Key, Handle> programs;
+
+public:
+    explicit ProgramPool(const GlobalContext *globalContext)
+        : globalContext(globalContext)
+    {
+    }
+
+    /* waits for all builds that are still running: */
+    ~ProgramPool();
+
+    ProgramPool(const ProgramPool &) = delete;
+    ProgramPool &operator=(const ProgramPool &) = delete;
+
+    /**
+     * @brief Returns a handle to the program context for the given
+     * parameters, starting the build if it has not been requested yet.
+     * The handle's get() waits for the build to finish and rethrows
+     * any build error. The context stays valid as long as the pool
+     * or any shared_ptr obtained from it.
+     */
+    Handle get(const std::vector<Device> &devices, Type type, Version version,
+               unsigned int kernelFlags = 0);
+};
+
+} // namespace opencl
+} // namespace argon2
+
+#endif // ARGON2_OPENCL_PROGRAMPOOL_H
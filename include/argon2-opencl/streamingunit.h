@@ -0,0 +1,119 @@
+#ifndef ARGON2_OPENCL_STREAMINGUNIT_H
+#define ARGON2_OPENCL_STREAMINGUNIT_H
+
+#include <memory>
+#include <deque>
+
+#include "programcontext.h"
+#include "memoryplanner.h"
+#include "argon2params.h"
+
+namespace argon2 {
+namespace opencl {
+
+/**
+ * @brief Processes a continuous stream of jobs.
+ *
+ * The device memory is divided into slots, each holding the memory of
+ * one job. New jobs are seeded directly into free slots and queued by
+ * flush() behind the batches that are still running, so the device does
+ * not have to drain between batches. Only the first two and the last
+ * block of each lane are transferred between the host and the device.
+ */
+class StreamingUnit
+{
+private:
+    struct Job
+    {
+        std::uint64_t id;
+        std::size_t slot;
+        std::unique_ptr<std::uint8_t[]> seed;
+    };
+
+    struct Batch
+    {
+        std::vector<Job> jobs;
+        std::vector<cl_uint> slots;
+        std::unique_ptr<std::uint8_t[]> lastBlocks;
+        std::size_t harvested;
+        cl::Event event;
+    };
+
+    const ProgramContext *programContext;
+    const Argon2Params *params;
+    const Device *device;
+
+    std::size_t slotCount;
+    std::size_t maxWorkGroups;
+
+    cl::CommandQueue cmdQueue;
+    cl::Buffer memoryBuffer;
+    cl::Buffer queueBuffer;
+    cl::Buffer headBuffer;
+    cl::Buffer countersBuffer;
+
+    cl::Kernel kernel;
+
+    std::vector<std::size_t> freeSlots;
+    std::vector<Job> pending;
+    std::deque<Batch> batches;
+    std::size_t queueStart;
+    std::uint64_t nextJobId;
+
+public:
+    std::size_t getSlotCount() const { return slotCount; }
+
+    /**
+     * @brief Returns the number of jobs that can be submitted before
+     * some finished jobs have to be harvested.
+     */
+    std::size_t getFreeSlotCount() const { return freeSlots.size(); }
+
+    /**
+     * @brief Returns the number of submitted jobs that have not been
+     * harvested yet.
+     */
+    std::size_t getJobsInFlight() const
+    {
+        return slotCount - freeSlots.size();
+    }
+
+    /**
+     * @brief Creates a streaming unit with the given number of job slots.
+     * At most maxWorkGroups jobs are processed at the same time
+     * (zero means no limit). Throws std::length_error if the slots
+     * do not fit into one allocation on the device, or if the lanes of
+     * a job do not fit into one work-group (the stream kernel computes
+     * each job in a single work-group, like the oneshot kernel), and
+     * std::logic_error if the program was built with KERNEL_SPLIT_LANES
+     * or KERNEL_GLOBAL_SCRATCH.
+     */
+    StreamingUnit(
+            const ProgramContext *programContext, const Argon2Params *params,
+            const Device *device, std::size_t slotCount,
+            std::size_t maxWorkGroups = 0);
+
+    /**
+     * @brief Seeds a new job into a free slot and returns its ID.
+     * The job is not started until the next call to flush().
+     * Throws std::logic_error if there is no free slot.
+     */
+    std::uint64_t submit(const void *pw, std::size_t pwSize);
+
+    /**
+     * @brief Starts processing of all jobs submitted since the last flush.
+     */
+    void flush();
+
+    /**
+     * @brief Retrieves the hash of the oldest unharvested job and frees
+     * its slot. Returns false if there is no flushed job to harvest
+     * or if wait is false and the job has not finished yet.
+     */
+    bool harvest(std::uint64_t &jobId, void *hash, bool wait = true);
+};
+
+} // namespace opencl
+} // namespace argon2
+
+#endif // ARGON2_OPENCL_STREAMINGUNIT_H
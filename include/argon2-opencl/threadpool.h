@@ -0,0 +1,101 @@
+#ifndef ARGON2_CPU_THREADPOOL_H
+#define ARGON2_CPU_THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace argon2 {
+namespace cpu {
+
+/**
+ * @brief A fixed set of worker threads that run parallel loops.
+ *
+ * Several threads may call parallelFor() at the same time (e.g. the units
+ * of a Dispatcher sharing one pool); their loops are then worked on in
+ * the order in which they were started, each caller helping with its own.
+ */
+class ThreadPool
+{
+private:
+    struct Loop
+    {
+        const std::function<void(std::size_t)> *task;
+        std::size_t count;
+        std::size_t next;
+        std::size_t finished;
+    };
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable loopFinished;
+    std::deque<Loop *> loops;
+    bool stopping;
+    /* whether the thread that calls parallelFor() works too (pinned
+     * pools leave it alone, as it may run on any CPU): */
+    bool callerHelps;
+
+    std::vector<std::thread> threads;
+
+    /* runs one iteration of the first loop; returns false if there
+     * is nothing to do (the lock is held on entry and on exit): */
+    bool runNext(std::unique_lock<std::mutex> &lock);
+    void workerMain();
+    void pinnedWorkerMain(unsigned int cpu);
+
+public:
+    struct NumaNode
+    {
+        int id;
+        std::vector<unsigned int> cpus;
+    };
+
+    /**
+     * @brief Returns the NUMA nodes of the host that have CPUs, or an
+     * empty list if they can't be determined (e.g. not on Linux).
+     */
+    static std::vector<NumaNode> getNumaNodes();
+
+    /**
+     * @brief Starts threadCount worker threads (zero means one per
+     * hardware thread, counting the thread that calls parallelFor()).
+     */
+    explicit ThreadPool(std::size_t threadCount = 0);
+
+    /**
+     * @brief Starts one worker thread pinned to each of the given CPUs;
+     * the thread that calls parallelFor() only waits. Pinning is only
+     * supported on Linux; elsewhere the threads are left unpinned.
+     */
+    explicit ThreadPool(const std::vector<unsigned int> &cpus);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * @brief Returns the number of threads that work on a loop (the
+     * workers plus the calling thread, unless the pool is pinned).
+     */
+    std::size_t getThreadCount() const
+    {
+        return threads.size() + (callerHelps ? 1 : 0);
+    }
+
+    /**
+     * @brief Calls task(i) for each i in [0, count) on the pool's threads
+     * (and the calling thread) and returns when all calls have finished.
+     * The task must not throw.
+     */
+    void parallelFor(std::size_t count,
+                     const std::function<void(std::size_t)> &task);
+};
+
+} // namespace cpu
+} // namespace argon2
+
+#endif // ARGON2_CPU_THREADPOOL_H
@@ -105,8 +105,12 @@ void Argon2Params::initialHash(
 
 void Argon2Params::fillFirstBlocks(
         void *memory, const void *pwd, std::size_t pwdLen,
-        Type type, Version version) const
+        Type type, Version version, std::size_t laneStride) const
 {
+    if (laneStride == 0) {
+        laneStride = getLaneBlocks();
+    }
+
     std::uint8_t initHash[ARGON2_PREHASH_SEED_LENGTH];
     initialHash(initHash, pwd, pwdLen, type, version);
 
@@ -155,11 +159,12 @@ void Argon2Params::fillFirstBlocks(
         std::fprintf(stderr, "}\n");
 #endif
 
-        bmemory += ARGON2_BLOCK_SIZE * getLaneBlocks();
+        bmemory += ARGON2_BLOCK_SIZE * laneStride;
     }
 }
 
-void Argon2Params::finalize(void *out, const void *memory) const
+void Argon2Params::finalize(void *out, const void *memory,
+                            std::size_t laneStride) const
 {
     /* TODO: nicify this (or move it into the kernel (I mean, we currently
      * have all lanes in one work-group...) */
@@ -167,9 +172,13 @@ void Argon2Params::finalize(void *out, const void *memory) const
         std::uint64_t v[ARGON2_BLOCK_SIZE / 8];
     };
 
+    if (laneStride == 0) {
+        laneStride = getLaneBlocks();
+    }
+
     auto cursor = static_cast<const block *>(memory);
 #ifdef DEBUG
-    for (std::size_t i = 0; i < getMemoryBlocks(); i++) {
+    for (std::size_t i = 0; i < lanes * laneStride; i++) {
         for (std::size_t k = 0; k < ARGON2_BLOCK_SIZE / 8; k++) {
             std::fprintf(stderr, "Block %04u [%3u]: %016llx\n",
                          (unsigned)i, (unsigned)k,
@@ -179,11 +188,11 @@ void Argon2Params::finalize(void *out, const void *memory) const
 #endif
 
     cursor = static_cast<const block *>(memory);
-    cursor += getLaneBlocks() - 1;
+    cursor += laneStride - 1;
 
     block xored = *cursor;
     for (std::uint32_t l = 1; l < lanes; l++) {
-        cursor += getLaneBlocks();
+        cursor += laneStride;
         for (std::size_t i = 0; i < ARGON2_BLOCK_SIZE / 8; i++) {
             xored.v[i] ^= cursor->v[i];
         }
@@ -0,0 +1,640 @@
+#include "cpuimplementation.h"
+
+#include "cpukernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ARGON2_CPU_X86
+#include <immintrin.h>
+
+/* the SIMD variants are compiled for their instruction sets regardless
+ * of the compiler flags and only called if the CPU supports them: */
+#define ARGON2_TARGET_SSE2 __attribute__((target("sse2")))
+#define ARGON2_TARGET_AVX2 __attribute__((target("avx2")))
+#define ARGON2_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+namespace argon2 {
+namespace cpu {
+
+namespace {
+
+inline std::uint64_t rotr64(std::uint64_t x, unsigned int n)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+/* the BlaMka multiply-add: */
+inline std::uint64_t f(std::uint64_t x, std::uint64_t y)
+{
+    std::uint64_t xy = (x & 0xFFFFFFFF) * (y & 0xFFFFFFFF);
+    return x + y + 2 * xy;
+}
+
+inline void g(std::uint64_t &a, std::uint64_t &b,
+              std::uint64_t &c, std::uint64_t &d)
+{
+    a = f(a, b);
+    d = rotr64(d ^ a, 32);
+    c = f(c, d);
+    b = rotr64(b ^ c, 24);
+    a = f(a, b);
+    d = rotr64(d ^ a, 16);
+    c = f(c, d);
+    b = rotr64(b ^ c, 63);
+}
+
+/* one BLAKE2 round on the 16 qwords formed by the pairs v[s0], v[s0 + 1],
+ * v[s1], v[s1 + 1], ..., v[s7], v[s7 + 1]: */
+inline void blake2Round(std::uint64_t *v, std::size_t s0, std::size_t s1,
+                        std::size_t s2, std::size_t s3, std::size_t s4,
+                        std::size_t s5, std::size_t s6, std::size_t s7)
+{
+    std::uint64_t &v0 = v[s0], &v1 = v[s0 + 1];
+    std::uint64_t &v2 = v[s1], &v3 = v[s1 + 1];
+    std::uint64_t &v4 = v[s2], &v5 = v[s2 + 1];
+    std::uint64_t &v6 = v[s3], &v7 = v[s3 + 1];
+    std::uint64_t &v8 = v[s4], &v9 = v[s4 + 1];
+    std::uint64_t &v10 = v[s5], &v11 = v[s5 + 1];
+    std::uint64_t &v12 = v[s6], &v13 = v[s6 + 1];
+    std::uint64_t &v14 = v[s7], &v15 = v[s7 + 1];
+
+    g(v0, v4, v8, v12);
+    g(v1, v5, v9, v13);
+    g(v2, v6, v10, v14);
+    g(v3, v7, v11, v15);
+    g(v0, v5, v10, v15);
+    g(v1, v6, v11, v12);
+    g(v2, v7, v8, v13);
+    g(v3, v4, v9, v14);
+}
+
+/* next = P(prev ^ ref) ^ prev ^ ref (^ next if withXor): */
+void fillBlockPortable(const Block &prev, const Block &ref, Block &next,
+                       bool withXor)
+{
+    Block r, tmp;
+    for (std::size_t i = 0; i < QWORDS_IN_BLOCK; i++) {
+        r.v[i] = prev.v[i] ^ ref.v[i];
+        tmp.v[i] = withXor ? r.v[i] ^ next.v[i] : r.v[i];
+    }
+
+    /* rows of 16 qwords: */
+    for (std::size_t i = 0; i < 8; i++) {
+        std::size_t row = 16 * i;
+        blake2Round(r.v, row, row + 2, row + 4, row + 6,
+                    row + 8, row + 10, row + 12, row + 14);
+    }
+    /* columns of 8 pairs of qwords: */
+    for (std::size_t i = 0; i < 8; i++) {
+        std::size_t col = 2 * i;
+        blake2Round(r.v, col, col + 16, col + 32, col + 48,
+                    col + 64, col + 80, col + 96, col + 112);
+    }
+
+    for (std::size_t i = 0; i < QWORDS_IN_BLOCK; i++) {
+        next.v[i] = tmp.v[i] ^ r.v[i];
+    }
+}
+
+#ifdef ARGON2_CPU_X86
+
+/*
+ * SSE2: a register holds a pair of qwords, so a BLAKE2 round works on
+ * two halves (a0, b0, c0, d0 and a1, b1, c1, d1) of its 4x4 matrix.
+ */
+
+ARGON2_TARGET_SSE2
+inline __m128i fSse2(__m128i x, __m128i y)
+{
+    __m128i xy = _mm_mul_epu32(x, y);
+    return _mm_add_epi64(_mm_add_epi64(x, y), _mm_add_epi64(xy, xy));
+}
+
+ARGON2_TARGET_SSE2
+inline void gSse2(__m128i &a, __m128i &b, __m128i &c, __m128i &d)
+{
+    a = fSse2(a, b);
+    d = _mm_xor_si128(d, a);
+    d = _mm_shuffle_epi32(d, _MM_SHUFFLE(2, 3, 0, 1));
+    c = fSse2(c, d);
+    b = _mm_xor_si128(b, c);
+    b = _mm_xor_si128(_mm_srli_epi64(b, 24), _mm_slli_epi64(b, 40));
+    a = fSse2(a, b);
+    d = _mm_xor_si128(d, a);
+    d = _mm_xor_si128(_mm_srli_epi64(d, 16), _mm_slli_epi64(d, 48));
+    c = fSse2(c, d);
+    b = _mm_xor_si128(b, c);
+    b = _mm_xor_si128(_mm_srli_epi64(b, 63), _mm_add_epi64(b, b));
+}
+
+/* the high qword of x and the low qword of y: */
+ARGON2_TARGET_SSE2
+inline __m128i alignSse2(__m128i x, __m128i y)
+{
+    return _mm_castpd_si128(_mm_shuffle_pd(
+                                _mm_castsi128_pd(x), _mm_castsi128_pd(y), 1));
+}
+
+ARGON2_TARGET_SSE2
+inline void blake2RoundSse2(__m128i &a0, __m128i &a1, __m128i &b0,
+                            __m128i &b1, __m128i &c0, __m128i &c1,
+                            __m128i &d0, __m128i &d1)
+{
+    __m128i t;
+    gSse2(a0, b0, c0, d0);
+    gSse2(a1, b1, c1, d1);
+
+    /* rotate the rows of b, c and d by one, two and three qwords: */
+    t = alignSse2(b0, b1); b1 = alignSse2(b1, b0); b0 = t;
+    t = c0; c0 = c1; c1 = t;
+    t = alignSse2(d1, d0); d1 = alignSse2(d0, d1); d0 = t;
+
+    gSse2(a0, b0, c0, d0);
+    gSse2(a1, b1, c1, d1);
+
+    t = alignSse2(b1, b0); b1 = alignSse2(b0, b1); b0 = t;
+    t = c0; c0 = c1; c1 = t;
+    t = alignSse2(d0, d1); d1 = alignSse2(d1, d0); d0 = t;
+}
+
+ARGON2_TARGET_SSE2
+void fillBlockSse2(const Block &prev, const Block &ref, Block &next,
+                   bool withXor)
+{
+    enum { REGS = QWORDS_IN_BLOCK / 2 };
+
+    auto prevRegs = reinterpret_cast<const __m128i *>(prev.v);
+    auto refRegs = reinterpret_cast<const __m128i *>(ref.v);
+    auto nextRegs = reinterpret_cast<__m128i *>(next.v);
+
+    __m128i r[REGS], tmp[REGS];
+    for (std::size_t i = 0; i < REGS; i++) {
+        r[i] = _mm_xor_si128(_mm_loadu_si128(prevRegs + i),
+                             _mm_loadu_si128(refRegs + i));
+        tmp[i] = withXor ? _mm_xor_si128(r[i], _mm_loadu_si128(nextRegs + i))
+                         : r[i];
+    }
+
+    /* a row is 8 consecutive registers: */
+    for (std::size_t i = 0; i < 8; i++) {
+        __m128i *row = r + 8 * i;
+        blake2RoundSse2(row[0], row[1], row[2], row[3],
+                        row[4], row[5], row[6], row[7]);
+    }
+    /* a column is every 8th register: */
+    for (std::size_t i = 0; i < 8; i++) {
+        __m128i *col = r + i;
+        blake2RoundSse2(col[0], col[8], col[16], col[24],
+                        col[32], col[40], col[48], col[56]);
+    }
+
+    for (std::size_t i = 0; i < REGS; i++) {
+        _mm_storeu_si128(nextRegs + i, _mm_xor_si128(tmp[i], r[i]));
+    }
+}
+
+/*
+ * AVX2: a register holds a row of the 4x4 matrix of a BLAKE2 round.
+ */
+
+ARGON2_TARGET_AVX2
+inline __m256i fAvx2(__m256i x, __m256i y)
+{
+    __m256i xy = _mm256_mul_epu32(x, y);
+    return _mm256_add_epi64(_mm256_add_epi64(x, y),
+                            _mm256_add_epi64(xy, xy));
+}
+
+ARGON2_TARGET_AVX2
+inline void gAvx2(__m256i &a, __m256i &b, __m256i &c, __m256i &d)
+{
+    /* rotations by whole bytes are byte shuffles: */
+    const __m256i rotr24 = _mm256_setr_epi8(
+                3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+    const __m256i rotr16 = _mm256_setr_epi8(
+                2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+
+    a = fAvx2(a, b);
+    d = _mm256_xor_si256(d, a);
+    d = _mm256_shuffle_epi32(d, _MM_SHUFFLE(2, 3, 0, 1));
+    c = fAvx2(c, d);
+    b = _mm256_xor_si256(b, c);
+    b = _mm256_shuffle_epi8(b, rotr24);
+    a = fAvx2(a, b);
+    d = _mm256_xor_si256(d, a);
+    d = _mm256_shuffle_epi8(d, rotr16);
+    c = fAvx2(c, d);
+    b = _mm256_xor_si256(b, c);
+    b = _mm256_xor_si256(_mm256_srli_epi64(b, 63), _mm256_add_epi64(b, b));
+}
+
+ARGON2_TARGET_AVX2
+inline void blake2RoundAvx2(__m256i &a, __m256i &b, __m256i &c, __m256i &d)
+{
+    gAvx2(a, b, c, d);
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));
+    gAvx2(a, b, c, d);
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+ARGON2_TARGET_AVX2
+void fillBlockAvx2(const Block &prev, const Block &ref, Block &next,
+                   bool withXor)
+{
+    enum { REGS = QWORDS_IN_BLOCK / 4 };
+
+    auto prevRegs = reinterpret_cast<const __m256i *>(prev.v);
+    auto refRegs = reinterpret_cast<const __m256i *>(ref.v);
+    auto nextRegs = reinterpret_cast<__m256i *>(next.v);
+
+    __m256i r[REGS], tmp[REGS];
+    for (std::size_t i = 0; i < REGS; i++) {
+        r[i] = _mm256_xor_si256(_mm256_loadu_si256(prevRegs + i),
+                                _mm256_loadu_si256(refRegs + i));
+        tmp[i] = withXor ? _mm256_xor_si256(
+                               r[i], _mm256_loadu_si256(nextRegs + i))
+                         : r[i];
+    }
+
+    /* a row is 4 consecutive registers: */
+    for (std::size_t i = 0; i < 8; i++) {
+        __m256i *row = r + 4 * i;
+        blake2RoundAvx2(row[0], row[1], row[2], row[3]);
+    }
+    /* the low and high halves of every 4th register make two columns: */
+    for (std::size_t i = 0; i < 4; i++) {
+        __m256i *col = r + i;
+        __m256i a0 = _mm256_permute2x128_si256(col[0], col[4], 0x20);
+        __m256i a1 = _mm256_permute2x128_si256(col[0], col[4], 0x31);
+        __m256i b0 = _mm256_permute2x128_si256(col[8], col[12], 0x20);
+        __m256i b1 = _mm256_permute2x128_si256(col[8], col[12], 0x31);
+        __m256i c0 = _mm256_permute2x128_si256(col[16], col[20], 0x20);
+        __m256i c1 = _mm256_permute2x128_si256(col[16], col[20], 0x31);
+        __m256i d0 = _mm256_permute2x128_si256(col[24], col[28], 0x20);
+        __m256i d1 = _mm256_permute2x128_si256(col[24], col[28], 0x31);
+
+        blake2RoundAvx2(a0, b0, c0, d0);
+        blake2RoundAvx2(a1, b1, c1, d1);
+
+        col[0] = _mm256_permute2x128_si256(a0, a1, 0x20);
+        col[4] = _mm256_permute2x128_si256(a0, a1, 0x31);
+        col[8] = _mm256_permute2x128_si256(b0, b1, 0x20);
+        col[12] = _mm256_permute2x128_si256(b0, b1, 0x31);
+        col[16] = _mm256_permute2x128_si256(c0, c1, 0x20);
+        col[20] = _mm256_permute2x128_si256(c0, c1, 0x31);
+        col[24] = _mm256_permute2x128_si256(d0, d1, 0x20);
+        col[28] = _mm256_permute2x128_si256(d0, d1, 0x31);
+    }
+
+    for (std::size_t i = 0; i < REGS; i++) {
+        _mm256_storeu_si256(nextRegs + i, _mm256_xor_si256(tmp[i], r[i]));
+    }
+}
+
+/* GCC 12 warns about _mm512_undefined_epi32() in avx512fintrin.h: */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+/*
+ * AVX-512: a register holds the matrix rows of two BLAKE2 rounds, one in
+ * each 256-bit half. F() is a single vpmuludq and the rotations are
+ * native.
+ */
+
+ARGON2_TARGET_AVX512
+inline __m512i fAvx512(__m512i x, __m512i y)
+{
+    __m512i xy = _mm512_mul_epu32(x, y);
+    return _mm512_add_epi64(_mm512_add_epi64(x, y),
+                            _mm512_add_epi64(xy, xy));
+}
+
+ARGON2_TARGET_AVX512
+inline void gAvx512(__m512i &a, __m512i &b, __m512i &c, __m512i &d)
+{
+    a = fAvx512(a, b);
+    d = _mm512_ror_epi64(_mm512_xor_si512(d, a), 32);
+    c = fAvx512(c, d);
+    b = _mm512_ror_epi64(_mm512_xor_si512(b, c), 24);
+    a = fAvx512(a, b);
+    d = _mm512_ror_epi64(_mm512_xor_si512(d, a), 16);
+    c = fAvx512(c, d);
+    b = _mm512_ror_epi64(_mm512_xor_si512(b, c), 63);
+}
+
+ARGON2_TARGET_AVX512
+inline void blake2RoundAvx512(__m512i &a, __m512i &b, __m512i &c, __m512i &d)
+{
+    gAvx512(a, b, c, d);
+    b = _mm512_permutex_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));
+    c = _mm512_permutex_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+    d = _mm512_permutex_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));
+    gAvx512(a, b, c, d);
+    b = _mm512_permutex_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));
+    c = _mm512_permutex_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+    d = _mm512_permutex_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+ARGON2_TARGET_AVX512
+void fillBlockAvx512(const Block &prev, const Block &ref, Block &next,
+                     bool withXor)
+{
+    enum { REGS = QWORDS_IN_BLOCK / 8 };
+
+    __m512i r[REGS], tmp[REGS];
+    for (std::size_t i = 0; i < REGS; i++) {
+        r[i] = _mm512_xor_si512(_mm512_loadu_si512(prev.v + 8 * i),
+                                _mm512_loadu_si512(ref.v + 8 * i));
+        tmp[i] = withXor ? _mm512_xor_si512(
+                               r[i], _mm512_loadu_si512(next.v + 8 * i))
+                         : r[i];
+    }
+
+    /* two rows at a time -- a row is 2 consecutive registers: */
+    for (std::size_t i = 0; i < 4; i++) {
+        __m512i *rows = r + 4 * i;
+        __m512i a = _mm512_shuffle_i64x2(rows[0], rows[2], 0x44);
+        __m512i b = _mm512_shuffle_i64x2(rows[0], rows[2], 0xEE);
+        __m512i c = _mm512_shuffle_i64x2(rows[1], rows[3], 0x44);
+        __m512i d = _mm512_shuffle_i64x2(rows[1], rows[3], 0xEE);
+
+        blake2RoundAvx512(a, b, c, d);
+
+        rows[0] = _mm512_shuffle_i64x2(a, b, 0x44);
+        rows[2] = _mm512_shuffle_i64x2(a, b, 0xEE);
+        rows[1] = _mm512_shuffle_i64x2(c, d, 0x44);
+        rows[3] = _mm512_shuffle_i64x2(c, d, 0xEE);
+    }
+
+    /* four columns at a time -- the 128-bit lanes of every 2nd register: */
+    const __m512i gatherLo = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i gatherHi = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    const __m512i scatterLo = _mm512_setr_epi64(0, 1, 4, 5, 8, 9, 12, 13);
+    const __m512i scatterHi = _mm512_setr_epi64(2, 3, 6, 7, 10, 11, 14, 15);
+    for (std::size_t i = 0; i < 2; i++) {
+        __m512i *cols = r + i;
+        __m512i a0 = _mm512_permutex2var_epi64(cols[0], gatherLo, cols[2]);
+        __m512i a1 = _mm512_permutex2var_epi64(cols[0], gatherHi, cols[2]);
+        __m512i b0 = _mm512_permutex2var_epi64(cols[4], gatherLo, cols[6]);
+        __m512i b1 = _mm512_permutex2var_epi64(cols[4], gatherHi, cols[6]);
+        __m512i c0 = _mm512_permutex2var_epi64(cols[8], gatherLo, cols[10]);
+        __m512i c1 = _mm512_permutex2var_epi64(cols[8], gatherHi, cols[10]);
+        __m512i d0 = _mm512_permutex2var_epi64(cols[12], gatherLo, cols[14]);
+        __m512i d1 = _mm512_permutex2var_epi64(cols[12], gatherHi, cols[14]);
+
+        blake2RoundAvx512(a0, b0, c0, d0);
+        blake2RoundAvx512(a1, b1, c1, d1);
+
+        cols[0] = _mm512_permutex2var_epi64(a0, scatterLo, a1);
+        cols[2] = _mm512_permutex2var_epi64(a0, scatterHi, a1);
+        cols[4] = _mm512_permutex2var_epi64(b0, scatterLo, b1);
+        cols[6] = _mm512_permutex2var_epi64(b0, scatterHi, b1);
+        cols[8] = _mm512_permutex2var_epi64(c0, scatterLo, c1);
+        cols[10] = _mm512_permutex2var_epi64(c0, scatterHi, c1);
+        cols[12] = _mm512_permutex2var_epi64(d0, scatterLo, d1);
+        cols[14] = _mm512_permutex2var_epi64(d0, scatterHi, d1);
+    }
+
+    for (std::size_t i = 0; i < REGS; i++) {
+        _mm512_storeu_si512(next.v + 8 * i, _mm512_xor_si512(tmp[i], r[i]));
+    }
+}
+
+#pragma GCC diagnostic pop
+
+/*
+ * Lockstep variants: each register holds the same qword of 4 (AVX2) or
+ * 8 (AVX-512) jobs, so the blocks need no shuffling at all -- the round
+ * is the portable one, with registers in place of qwords.
+ */
+
+ARGON2_TARGET_AVX2
+inline void blake2RoundAvx2x4(__m256i *v, std::size_t s0, std::size_t s1,
+                              std::size_t s2, std::size_t s3, std::size_t s4,
+                              std::size_t s5, std::size_t s6, std::size_t s7)
+{
+    /* the round works on copies, which the compiler can keep in
+     * registers: */
+    __m256i v0 = v[s0], v1 = v[s0 + 1], v2 = v[s1], v3 = v[s1 + 1];
+    __m256i v4 = v[s2], v5 = v[s2 + 1], v6 = v[s3], v7 = v[s3 + 1];
+    __m256i v8 = v[s4], v9 = v[s4 + 1], v10 = v[s5], v11 = v[s5 + 1];
+    __m256i v12 = v[s6], v13 = v[s6 + 1], v14 = v[s7], v15 = v[s7 + 1];
+
+    gAvx2(v0, v4, v8, v12);
+    gAvx2(v1, v5, v9, v13);
+    gAvx2(v2, v6, v10, v14);
+    gAvx2(v3, v7, v11, v15);
+    gAvx2(v0, v5, v10, v15);
+    gAvx2(v1, v6, v11, v12);
+    gAvx2(v2, v7, v8, v13);
+    gAvx2(v3, v4, v9, v14);
+
+    v[s0] = v0; v[s0 + 1] = v1; v[s1] = v2; v[s1 + 1] = v3;
+    v[s2] = v4; v[s2 + 1] = v5; v[s3] = v6; v[s3 + 1] = v7;
+    v[s4] = v8; v[s4 + 1] = v9; v[s5] = v10; v[s5 + 1] = v11;
+    v[s6] = v12; v[s6 + 1] = v13; v[s7] = v14; v[s7 + 1] = v15;
+}
+
+ARGON2_TARGET_AVX2
+void fillBlocksAvx2x4(const std::uint64_t *prev, const std::uint64_t *ref,
+                      std::uint64_t *next, bool withXor)
+{
+    auto prevRegs = reinterpret_cast<const __m256i *>(prev);
+    auto refRegs = reinterpret_cast<const __m256i *>(ref);
+    auto nextRegs = reinterpret_cast<__m256i *>(next);
+
+    __m256i r[QWORDS_IN_BLOCK];
+    for (std::size_t i = 0; i < QWORDS_IN_BLOCK; i++) {
+        r[i] = _mm256_xor_si256(_mm256_loadu_si256(prevRegs + i),
+                                _mm256_loadu_si256(refRegs + i));
+    }
+
+    for (std::size_t i = 0; i < 8; i++) {
+        std::size_t row = 16 * i;
+        blake2RoundAvx2x4(r, row, row + 2, row + 4, row + 6,
+                          row + 8, row + 10, row + 12, row + 14);
+    }
+    for (std::size_t i = 0; i < 8; i++) {
+        std::size_t col = 2 * i;
+        blake2RoundAvx2x4(r, col, col + 16, col + 32, col + 48,
+                          col + 64, col + 80, col + 96, col + 112);
+    }
+
+    /* prev ^ ref is loaded again instead of being kept aside: */
+    for (std::size_t i = 0; i < QWORDS_IN_BLOCK; i++) {
+        __m256i tmp = _mm256_xor_si256(_mm256_loadu_si256(prevRegs + i),
+                                       _mm256_loadu_si256(refRegs + i));
+        if (withXor) {
+            tmp = _mm256_xor_si256(tmp, _mm256_loadu_si256(nextRegs + i));
+        }
+        _mm256_storeu_si256(nextRegs + i, _mm256_xor_si256(tmp, r[i]));
+    }
+}
+
+/* the same GCC 12 false positive as above: */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+ARGON2_TARGET_AVX512
+inline void blake2RoundAvx512x8(__m512i *v, std::size_t s0, std::size_t s1,
+                                std::size_t s2, std::size_t s3,
+                                std::size_t s4, std::size_t s5,
+                                std::size_t s6, std::size_t s7)
+{
+    /* copies, as in blake2RoundAvx2x4(): */
+    __m512i v0 = v[s0], v1 = v[s0 + 1], v2 = v[s1], v3 = v[s1 + 1];
+    __m512i v4 = v[s2], v5 = v[s2 + 1], v6 = v[s3], v7 = v[s3 + 1];
+    __m512i v8 = v[s4], v9 = v[s4 + 1], v10 = v[s5], v11 = v[s5 + 1];
+    __m512i v12 = v[s6], v13 = v[s6 + 1], v14 = v[s7], v15 = v[s7 + 1];
+
+    gAvx512(v0, v4, v8, v12);
+    gAvx512(v1, v5, v9, v13);
+    gAvx512(v2, v6, v10, v14);
+    gAvx512(v3, v7, v11, v15);
+    gAvx512(v0, v5, v10, v15);
+    gAvx512(v1, v6, v11, v12);
+    gAvx512(v2, v7, v8, v13);
+    gAvx512(v3, v4, v9, v14);
+
+    v[s0] = v0; v[s0 + 1] = v1; v[s1] = v2; v[s1 + 1] = v3;
+    v[s2] = v4; v[s2 + 1] = v5; v[s3] = v6; v[s3 + 1] = v7;
+    v[s4] = v8; v[s4 + 1] = v9; v[s5] = v10; v[s5 + 1] = v11;
+    v[s6] = v12; v[s6 + 1] = v13; v[s7] = v14; v[s7 + 1] = v15;
+}
+
+ARGON2_TARGET_AVX512
+void fillBlocksAvx512x8(const std::uint64_t *prev, const std::uint64_t *ref,
+                        std::uint64_t *next, bool withXor)
+{
+    __m512i r[QWORDS_IN_BLOCK];
+    for (std::size_t i = 0; i < QWORDS_IN_BLOCK; i++) {
+        r[i] = _mm512_xor_si512(_mm512_loadu_si512(prev + 8 * i),
+                                _mm512_loadu_si512(ref + 8 * i));
+    }
+
+    for (std::size_t i = 0; i < 8; i++) {
+        std::size_t row = 16 * i;
+        blake2RoundAvx512x8(r, row, row + 2, row + 4, row + 6,
+                            row + 8, row + 10, row + 12, row + 14);
+    }
+    for (std::size_t i = 0; i < 8; i++) {
+        std::size_t col = 2 * i;
+        blake2RoundAvx512x8(r, col, col + 16, col + 32, col + 48,
+                            col + 64, col + 80, col + 96, col + 112);
+    }
+
+    for (std::size_t i = 0; i < QWORDS_IN_BLOCK; i++) {
+        __m512i tmp = _mm512_xor_si512(_mm512_loadu_si512(prev + 8 * i),
+                                       _mm512_loadu_si512(ref + 8 * i));
+        if (withXor) {
+            tmp = _mm512_xor_si512(tmp, _mm512_loadu_si512(next + 8 * i));
+        }
+        _mm512_storeu_si512(next + 8 * i, _mm512_xor_si512(tmp, r[i]));
+    }
+}
+
+#pragma GCC diagnostic pop
+
+#endif // ARGON2_CPU_X86
+
+} // namespace
+
+bool isImplementationSupported(Implementation impl)
+{
+    switch (impl) {
+    case IMPLEMENTATION_PORTABLE:
+        return true;
+#ifdef ARGON2_CPU_X86
+    case IMPLEMENTATION_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case IMPLEMENTATION_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    case IMPLEMENTATION_AVX512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+Implementation getBestImplementation()
+{
+    for (int impl = IMPLEMENTATION_COUNT - 1; impl > 0; impl--) {
+        if (isImplementationSupported(static_cast<Implementation>(impl))) {
+            return static_cast<Implementation>(impl);
+        }
+    }
+    return IMPLEMENTATION_PORTABLE;
+}
+
+const char *getImplementationName(Implementation impl)
+{
+    switch (impl) {
+    case IMPLEMENTATION_PORTABLE:
+        return "portable";
+    case IMPLEMENTATION_SSE2:
+        return "SSE2";
+    case IMPLEMENTATION_AVX2:
+        return "AVX2";
+    case IMPLEMENTATION_AVX512:
+        return "AVX-512";
+    default:
+        return "unknown";
+    }
+}
+
+FillBlockFunc getFillBlock(Implementation impl)
+{
+    switch (impl) {
+#ifdef ARGON2_CPU_X86
+    case IMPLEMENTATION_SSE2:
+        return fillBlockSse2;
+    case IMPLEMENTATION_AVX2:
+        return fillBlockAvx2;
+    case IMPLEMENTATION_AVX512:
+        return fillBlockAvx512;
+#endif
+    default:
+        return fillBlockPortable;
+    }
+}
+
+std::size_t getLockstepJobs(Implementation impl)
+{
+    switch (impl) {
+#ifdef ARGON2_CPU_X86
+    case IMPLEMENTATION_AVX2:
+        return 4;
+    case IMPLEMENTATION_AVX512:
+        return 8;
+#endif
+    default:
+        return 1;
+    }
+}
+
+FillBlocksFunc getFillBlocks(Implementation impl)
+{
+    switch (impl) {
+#ifdef ARGON2_CPU_X86
+    case IMPLEMENTATION_AVX2:
+        return fillBlocksAvx2x4;
+    case IMPLEMENTATION_AVX512:
+        return fillBlocksAvx512x8;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+} // namespace cpu
+} // namespace argon2
@@ -0,0 +1,264 @@
+#include "cpukernel.h"
+
+#include <vector>
+
+#if defined(__GNUC__)
+#define ARGON2_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define ARGON2_PREFETCH(p) ((void)(p))
+#endif
+
+namespace argon2 {
+namespace cpu {
+
+namespace {
+
+/* the Argon2i pseudo-random addresses of one segment: */
+class AddressGenerator
+{
+private:
+    Block input, addresses;
+    FillBlockFunc fillBlock;
+
+    void nextAddresses()
+    {
+        Block zero = Block(), tmp;
+        ++input.v[6];
+        fillBlock(zero, input, tmp, false);
+        fillBlock(zero, tmp, addresses, false);
+    }
+
+public:
+    AddressGenerator(const Argon2Params &params, Type type,
+                     std::uint32_t pass, std::uint32_t slice,
+                     std::uint32_t lane, FillBlockFunc fillBlock)
+        : input(), fillBlock(fillBlock)
+    {
+        if (type != ARGON2_I) {
+            return;
+        }
+        input.v[0] = pass;
+        input.v[1] = lane;
+        input.v[2] = slice;
+        input.v[3] = params.getMemoryBlocks();
+        input.v[4] = params.getTimeCost();
+        input.v[5] = type;
+        if (pass == 0 && slice == 0) {
+            /* the first two blocks are skipped, but not their
+             * addresses: */
+            nextAddresses();
+        }
+    }
+
+    std::uint64_t get(std::uint32_t offset)
+    {
+        if (offset % QWORDS_IN_BLOCK == 0) {
+            nextAddresses();
+        }
+        return addresses.v[offset % QWORDS_IN_BLOCK];
+    }
+};
+
+/* the index of the block referenced from the given offset of a segment
+ * (the same logic as in argon2_kernel.cl): */
+std::uint32_t getRefIndex(const Argon2Params &params, std::uint32_t pass,
+                          std::uint32_t slice, std::uint32_t lane,
+                          std::uint32_t offset, std::uint64_t pseudoRand,
+                          std::uint32_t &refLane)
+{
+    std::uint32_t segmentBlocks = params.getSegmentBlocks();
+    std::uint32_t laneBlocks = params.getLaneBlocks();
+
+    refLane = (std::uint32_t)(pseudoRand >> 32) % params.getLanes();
+    std::uint32_t base;
+    if (pass != 0) {
+        base = laneBlocks - segmentBlocks;
+    } else {
+        if (slice == 0) {
+            refLane = lane;
+        }
+        base = slice * segmentBlocks;
+    }
+
+    /* the blocks that may be referenced (in other lanes only those
+     * of the finished segments): */
+    std::uint32_t refAreaSize = base + offset - 1;
+    if (refLane != lane) {
+        refAreaSize = offset == 0 ? base - 1 : base;
+    }
+
+    std::uint64_t relPos = pseudoRand & 0xFFFFFFFF;
+    relPos = (relPos * relPos) >> 32;
+    relPos = refAreaSize - 1 - ((refAreaSize * relPos) >> 32);
+
+    std::uint32_t refIndex = (std::uint32_t)relPos;
+    if (pass != 0 && slice != ARGON2_SYNC_POINTS - 1) {
+        refIndex = (refIndex + (slice + 1) * segmentBlocks) % laneBlocks;
+    }
+    return refIndex;
+}
+
+void prefetchBlock(const Block *block)
+{
+    auto bytes = reinterpret_cast<const char *>(block);
+    for (std::size_t i = 0; i < ARGON2_BLOCK_SIZE; i += 64) {
+        ARGON2_PREFETCH(bytes + i);
+    }
+}
+
+/* a segment of fillSegmentsInterleaved() between two blocks: */
+struct InterleavedSegment
+{
+    Block *memory;
+    Block *laneMemory;
+    std::uint32_t lane;
+    std::uint32_t prevIndex, currIndex;
+    /* the reference block of currIndex, already prefetched: */
+    const Block *ref;
+    AddressGenerator addresses;
+
+    InterleavedSegment(const SegmentTask &task, const Argon2Params &params,
+                       Type type, std::uint32_t pass, std::uint32_t slice,
+                       std::uint32_t startOffset, FillBlockFunc fillBlock)
+        : memory(task.memory),
+          laneMemory(task.memory
+                     + (std::size_t)task.lane * params.getLaneBlocks()),
+          lane(task.lane),
+          currIndex(slice * params.getSegmentBlocks() + startOffset),
+          ref(nullptr),
+          addresses(params, type, pass, slice, task.lane, fillBlock)
+    {
+        prevIndex = currIndex == 0 ? params.getLaneBlocks() - 1
+                                   : currIndex - 1;
+    }
+
+    void fetchRef(const Argon2Params &params, Type type,
+                  std::uint32_t pass, std::uint32_t slice,
+                  std::uint32_t offset)
+    {
+        std::uint64_t pseudoRand;
+        if (type == ARGON2_I) {
+            pseudoRand = addresses.get(offset);
+        } else {
+            pseudoRand = laneMemory[prevIndex].v[0];
+        }
+
+        std::uint32_t refLane;
+        std::uint32_t refIndex = getRefIndex(params, pass, slice, lane,
+                                             offset, pseudoRand, refLane);
+        ref = memory + (std::size_t)refLane * params.getLaneBlocks()
+                + refIndex;
+        prefetchBlock(ref);
+    }
+};
+
+} // namespace
+
+void fillSegment(Block *memory, const Argon2Params &params,
+                 Type type, Version version,
+                 std::uint32_t pass, std::uint32_t slice, std::uint32_t lane,
+                 FillBlockFunc fillBlock)
+{
+    std::uint32_t segmentBlocks = params.getSegmentBlocks();
+    std::uint32_t laneBlocks = params.getLaneBlocks();
+
+    AddressGenerator addresses(params, type, pass, slice, lane, fillBlock);
+
+    /* the first two blocks are computed by fillFirstBlocks(): */
+    std::uint32_t startOffset = pass == 0 && slice == 0 ? 2 : 0;
+
+    Block *laneMemory = memory + (std::size_t)lane * laneBlocks;
+    std::uint32_t currIndex = slice * segmentBlocks + startOffset;
+    /* the first block of a lane follows the last one: */
+    std::uint32_t prevIndex = currIndex == 0 ? laneBlocks - 1 : currIndex - 1;
+
+    for (std::uint32_t offset = startOffset; offset < segmentBlocks;
+         ++offset, prevIndex = currIndex++) {
+        std::uint64_t pseudoRand;
+        if (type == ARGON2_I) {
+            pseudoRand = addresses.get(offset);
+        } else {
+            pseudoRand = laneMemory[prevIndex].v[0];
+        }
+
+        std::uint32_t refLane;
+        std::uint32_t refIndex = getRefIndex(params, pass, slice, lane,
+                                             offset, pseudoRand, refLane);
+
+        const Block &ref = memory[(std::size_t)refLane * laneBlocks
+                + refIndex];
+        fillBlock(laneMemory[prevIndex], ref, laneMemory[currIndex],
+                  version != ARGON2_VERSION_10 && pass != 0);
+    }
+}
+
+void fillSegmentsInterleaved(const SegmentTask *tasks, std::size_t count,
+                             const Argon2Params &params,
+                             Type type, Version version,
+                             std::uint32_t pass, std::uint32_t slice,
+                             FillBlockFunc fillBlock)
+{
+    std::uint32_t segmentBlocks = params.getSegmentBlocks();
+    std::uint32_t startOffset = pass == 0 && slice == 0 ? 2 : 0;
+    bool withXor = version != ARGON2_VERSION_10 && pass != 0;
+
+    std::vector<InterleavedSegment> segments;
+    segments.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        segments.emplace_back(tasks[i], params, type, pass, slice,
+                              startOffset, fillBlock);
+        segments.back().fetchRef(params, type, pass, slice, startOffset);
+    }
+
+    /* each segment computes one block and requests the reference of
+     * its next one, then yields to the others until it arrives: */
+    for (std::uint32_t offset = startOffset; offset < segmentBlocks;
+         offset++) {
+        for (auto &segment : segments) {
+            fillBlock(segment.laneMemory[segment.prevIndex], *segment.ref,
+                      segment.laneMemory[segment.currIndex], withXor);
+            segment.prevIndex = segment.currIndex++;
+            if (offset + 1 < segmentBlocks) {
+                segment.fetchRef(params, type, pass, slice, offset + 1);
+            }
+        }
+    }
+}
+
+void fillSegmentLockstep(std::uint64_t *memory, std::size_t jobs,
+                         const Argon2Params &params, Version version,
+                         std::uint32_t pass, std::uint32_t slice,
+                         std::uint32_t lane, FillBlocksFunc fillBlocks,
+                         FillBlockFunc fillBlock)
+{
+    std::uint32_t segmentBlocks = params.getSegmentBlocks();
+    std::uint32_t laneBlocks = params.getLaneBlocks();
+    std::size_t blockQwords = QWORDS_IN_BLOCK * jobs;
+
+    /* one address stream for all the jobs: */
+    AddressGenerator addresses(params, ARGON2_I, pass, slice, lane,
+                               fillBlock);
+
+    std::uint32_t startOffset = pass == 0 && slice == 0 ? 2 : 0;
+
+    std::uint64_t *laneMemory = memory
+            + (std::size_t)lane * laneBlocks * blockQwords;
+    std::uint32_t currIndex = slice * segmentBlocks + startOffset;
+    std::uint32_t prevIndex = currIndex == 0 ? laneBlocks - 1 : currIndex - 1;
+
+    for (std::uint32_t offset = startOffset; offset < segmentBlocks;
+         ++offset, prevIndex = currIndex++) {
+        std::uint32_t refLane;
+        std::uint32_t refIndex = getRefIndex(params, pass, slice, lane, offset,
+                                             addresses.get(offset), refLane);
+
+        const std::uint64_t *ref = memory
+                + ((std::size_t)refLane * laneBlocks + refIndex) * blockQwords;
+        fillBlocks(laneMemory + prevIndex * blockQwords, ref,
+                   laneMemory + currIndex * blockQwords,
+                   version != ARGON2_VERSION_10 && pass != 0);
+    }
+}
+
+} // namespace cpu
+} // namespace argon2
@@ -0,0 +1,87 @@
+#ifndef ARGON2_CPU_CPUKERNEL_H
+#define ARGON2_CPU_CPUKERNEL_H
+
+#include <cstdint>
+
+#include "argon2params.h"
+#include "cpuimplementation.h"
+
+namespace argon2 {
+namespace cpu {
+
+enum {
+    QWORDS_IN_BLOCK = ARGON2_BLOCK_SIZE / 8,
+};
+
+struct Block
+{
+    std::uint64_t v[QWORDS_IN_BLOCK];
+};
+
+/* next = P(prev ^ ref) ^ prev ^ ref (^ next if withXor): */
+typedef void (*FillBlockFunc)(const Block &prev, const Block &ref,
+                              Block &next, bool withXor);
+
+/* the block compression written with the given instruction set (see
+ * cpuimplementation.cpp); the caller checks that the CPU supports it: */
+FillBlockFunc getFillBlock(Implementation impl);
+
+/* the same for the blocks of getLockstepJobs(impl) jobs at once, stored
+ * interleaved (qword i of job j at index i * jobs + j); nullptr if
+ * the implementation has no such variant: */
+typedef void (*FillBlocksFunc)(const std::uint64_t *prev,
+                               const std::uint64_t *ref,
+                               std::uint64_t *next, bool withXor);
+
+FillBlocksFunc getFillBlocks(Implementation impl);
+
+/*
+ * The host counterpart of argon2_kernel.cl: computes the given segment
+ * of one lane of a job. The memory holds the lanes of the job one after
+ * another (the same layout as in the OpenCL buffers), so the first blocks
+ * and the result are handled by Argon2Params::fillFirstBlocks() and
+ * Argon2Params::finalize(). All lanes must have finished the previous
+ * segment.
+ */
+void fillSegment(Block *memory, const Argon2Params &params,
+                 Type type, Version version,
+                 std::uint32_t pass, std::uint32_t slice, std::uint32_t lane,
+                 FillBlockFunc fillBlock);
+
+/* one lane of one job, laid out as for fillSegment(): */
+struct SegmentTask
+{
+    Block *memory;
+    std::uint32_t lane;
+};
+
+/*
+ * The same as fillSegment() for several segments of the same pass and
+ * slice (of different jobs with the same parameters, or of different
+ * lanes), computed in turns of one block each. The reference block of
+ * a segment's next block is prefetched as soon as its index is known,
+ * so that it arrives while the other segments are computed.
+ */
+void fillSegmentsInterleaved(const SegmentTask *tasks, std::size_t count,
+                             const Argon2Params &params,
+                             Type type, Version version,
+                             std::uint32_t pass, std::uint32_t slice,
+                             FillBlockFunc fillBlock);
+
+/*
+ * The same as fillSegment() for a group of Argon2i jobs with the same
+ * parameters: they all reference the same blocks, so they share one
+ * address stream and are computed in lockstep, one job per SIMD lane.
+ * The memory holds the blocks of the group interleaved as described at
+ * FillBlocksFunc, in the usual order; fillBlock computes the addresses.
+ */
+void fillSegmentLockstep(std::uint64_t *memory, std::size_t jobs,
+                         const Argon2Params &params, Version version,
+                         std::uint32_t pass, std::uint32_t slice,
+                         std::uint32_t lane, FillBlocksFunc fillBlocks,
+                         FillBlockFunc fillBlock);
+
+} // namespace cpu
+} // namespace argon2
+
+#endif // ARGON2_CPU_CPUKERNEL_H
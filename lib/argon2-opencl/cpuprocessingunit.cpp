@@ -0,0 +1,285 @@
+#include "cpuprocessingunit.h"
+
+#include "cpukernel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace argon2 {
+namespace cpu {
+
+enum {
+    /* more don't fit into the L1 cache with their blocks: */
+    MAX_INTERLEAVED_SEGMENTS = 16,
+    /* smaller jobs mostly hit the caches, where the turns only cost
+     * time (measured on a 2 MiB L2 Xeon): */
+    AUTO_INTERLEAVE_MIN_MEMORY = 64 * 1024 * 1024,
+};
+
+static std::size_t chooseInterleavedSegments(const Argon2Params *params,
+                                             std::size_t lockstepJobs,
+                                             std::size_t segments)
+{
+    if (lockstepJobs != 1) {
+        return 1;
+    }
+    if (segments == 0) {
+        return params->getMemorySize() >= AUTO_INTERLEAVE_MIN_MEMORY ? 2 : 1;
+    }
+    return std::min<std::size_t>(segments, MAX_INTERLEAVED_SEGMENTS);
+}
+
+static std::size_t chooseLockstepJobs(Type type, Implementation impl,
+                                      std::size_t batchSize, bool allowLockstep)
+{
+    std::size_t jobs = getLockstepJobs(impl);
+    if (!allowLockstep || type != ARGON2_I || batchSize < jobs) {
+        return 1;
+    }
+    return jobs;
+}
+
+ProcessingUnit::ProcessingUnit(
+        const Argon2Params *params, Type type, Version version,
+        ThreadPool *pool, std::size_t batchSize, Implementation impl,
+        bool allowLockstep, MemoryPool *memoryPool,
+        std::size_t interleavedSegments)
+    : params(params), type(type), version(version), pool(pool), impl(impl),
+      batchSize(batchSize),
+      lockstepJobs(chooseLockstepJobs(type, impl, batchSize, allowLockstep)),
+      interleavedSegments(chooseInterleavedSegments(params, lockstepJobs,
+                                                    interleavedSegments)),
+      memoryPool(memoryPool)
+{
+    if (!isImplementationSupported(impl)) {
+        throw std::logic_error(
+                std::string("cpu::ProcessingUnit: ")
+                + getImplementationName(impl)
+                + " is not supported by this CPU");
+    }
+
+    if (!memoryPool) {
+        ownMemoryPool.reset(new MemoryPool());
+        this->memoryPool = ownMemoryPool.get();
+    }
+
+    std::size_t groupSize = params->getMemorySize() * lockstepJobs;
+    memory = this->memoryPool->allocate(groupSize * getGroupCount());
+    if (batchSize % lockstepJobs != 0) {
+        /* the spare jobs of the last group compute from zeros (reused
+         * memory is not zeroed): */
+        std::memset(getGroupMemory(getGroupCount() - 1), 0, groupSize);
+    }
+}
+
+ProcessingUnit::~ProcessingUnit()
+{
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+std::size_t ProcessingUnit::getGroupCount() const
+{
+    return (batchSize + lockstepJobs - 1) / lockstepJobs;
+}
+
+std::uint8_t *ProcessingUnit::getGroupMemory(std::size_t group) const
+{
+    return memory.get() + group * lockstepJobs * params->getMemorySize();
+}
+
+void ProcessingUnit::computeSegment(std::size_t group, std::uint32_t pass,
+                                    std::uint32_t slice,
+                                    std::uint32_t lane) const
+{
+    auto groupMemory = getGroupMemory(group);
+    if (lockstepJobs == 1) {
+        fillSegment(reinterpret_cast<Block *>(groupMemory), *params,
+                    type, version, pass, slice, lane, getFillBlock(impl));
+    } else {
+        fillSegmentLockstep(reinterpret_cast<std::uint64_t *>(groupMemory),
+                            lockstepJobs, *params, version, pass, slice, lane,
+                            getFillBlocks(impl), getFillBlock(impl));
+    }
+}
+
+void ProcessingUnit::computeSegments(std::size_t from, std::size_t to,
+                                     std::uint32_t pass,
+                                     std::uint32_t slice) const
+{
+    std::uint32_t lanes = params->getLanes();
+    if (interleavedSegments == 1) {
+        for (std::size_t i = from; i < to; i++) {
+            computeSegment(i / lanes, pass, slice,
+                           (std::uint32_t)(i % lanes));
+        }
+        return;
+    }
+
+    SegmentTask tasks[MAX_INTERLEAVED_SEGMENTS];
+    for (std::size_t first = from; first < to; first += interleavedSegments) {
+        std::size_t count = std::min(interleavedSegments, to - first);
+        for (std::size_t i = 0; i < count; i++) {
+            tasks[i].memory = reinterpret_cast<Block *>(
+                        getGroupMemory((first + i) / lanes));
+            tasks[i].lane = (std::uint32_t)((first + i) % lanes);
+        }
+        fillSegmentsInterleaved(tasks, count, *params, type, version,
+                                pass, slice, getFillBlock(impl));
+    }
+}
+
+void ProcessingUnit::process()
+{
+    auto passes = params->getTimeCost();
+    auto lanes = params->getLanes();
+    auto groups = getGroupCount();
+    auto threads = pool->getThreadCount();
+
+    if (groups >= threads) {
+        /* enough jobs to keep all threads busy -- each thread computes
+         * whole jobs (as many at once as may be interleaved without
+         * leaving a thread idle), so there is no need to synchronize
+         * the lanes: */
+        std::size_t jobs = std::max<std::size_t>(
+                    1, std::min(interleavedSegments / lanes,
+                                groups / threads));
+        pool->parallelFor(
+                    (groups + jobs - 1) / jobs,
+                    [this, passes, lanes, groups, jobs](std::size_t i) {
+            std::size_t from = i * jobs * lanes;
+            std::size_t to = std::min(i * jobs + jobs, groups) * lanes;
+            for (std::uint32_t pass = 0; pass < passes; pass++) {
+                for (std::uint32_t slice = 0; slice < ARGON2_SYNC_POINTS;
+                     slice++) {
+                    computeSegments(from, to, pass, slice);
+                }
+            }
+        });
+        return;
+    }
+
+    /* otherwise spread the lanes of all jobs over the threads, one
+     * slice at a time: */
+    std::size_t segments = groups * lanes;
+    std::size_t chunk = std::max<std::size_t>(
+                1, std::min(interleavedSegments, segments / threads));
+    for (std::uint32_t pass = 0; pass < passes; pass++) {
+        for (std::uint32_t slice = 0; slice < ARGON2_SYNC_POINTS; slice++) {
+            pool->parallelFor(
+                        (segments + chunk - 1) / chunk,
+                        [this, segments, chunk, pass, slice](std::size_t i) {
+                computeSegments(i * chunk,
+                                std::min(i * chunk + chunk, segments),
+                                pass, slice);
+            });
+        }
+    }
+}
+
+void ProcessingUnit::beginProcessing()
+{
+    worker = std::thread(&ProcessingUnit::process, this);
+}
+
+void ProcessingUnit::endProcessing()
+{
+    worker.join();
+}
+
+ProcessingUnit::PasswordWriter::PasswordWriter(
+        ProcessingUnit &parent, std::size_t index)
+    : parent(&parent), params(parent.params),
+      type(parent.type), version(parent.version), index(index)
+{
+}
+
+void ProcessingUnit::PasswordWriter::moveForward(std::size_t offset)
+{
+    index += offset;
+}
+
+void ProcessingUnit::PasswordWriter::moveBackwards(std::size_t offset)
+{
+    index -= offset;
+}
+
+void ProcessingUnit::PasswordWriter::setPassword(
+        const void *pw, std::size_t pwSize) const
+{
+    std::size_t jobs = parent->lockstepJobs;
+    auto groupMemory = parent->getGroupMemory(index / jobs);
+    if (jobs == 1) {
+        params->fillFirstBlocks(groupMemory, pw, pwSize, type, version);
+        return;
+    }
+
+    /* compute the first blocks of the lanes aside and interleave them
+     * with those of the other jobs: */
+    std::uint32_t lanes = params->getLanes();
+    std::unique_ptr<Block[]> firstBlocks(new Block[2 * lanes]);
+    params->fillFirstBlocks(firstBlocks.get(), pw, pwSize, type, version, 2);
+
+    auto jobMemory = reinterpret_cast<std::uint64_t *>(groupMemory)
+            + index % jobs;
+    for (std::uint32_t lane = 0; lane < lanes; lane++) {
+        for (std::uint32_t i = 0; i < 2; i++) {
+            auto &block = firstBlocks[2 * lane + i];
+            auto dst = jobMemory + ((std::size_t)lane * params->getLaneBlocks()
+                                    + i) * QWORDS_IN_BLOCK * jobs;
+            for (std::size_t k = 0; k < QWORDS_IN_BLOCK; k++) {
+                dst[k * jobs] = block.v[k];
+            }
+        }
+    }
+}
+
+ProcessingUnit::HashReader::HashReader(
+        ProcessingUnit &parent, std::size_t index)
+    : parent(&parent), params(parent.params), index(index),
+      buffer(new std::uint8_t[params->getOutputLength()])
+{
+}
+
+void ProcessingUnit::HashReader::moveForward(std::size_t offset)
+{
+    index += offset;
+}
+
+void ProcessingUnit::HashReader::moveBackwards(std::size_t offset)
+{
+    index -= offset;
+}
+
+const void *ProcessingUnit::HashReader::getHash() const
+{
+    std::size_t jobs = parent->lockstepJobs;
+    auto groupMemory = parent->getGroupMemory(index / jobs);
+    if (jobs == 1) {
+        params->finalize(buffer.get(), groupMemory);
+        return buffer.get();
+    }
+
+    /* collect the last block of each lane: */
+    std::uint32_t lanes = params->getLanes();
+    std::unique_ptr<Block[]> lastBlocks(new Block[lanes]);
+
+    auto jobMemory = reinterpret_cast<const std::uint64_t *>(groupMemory)
+            + index % jobs;
+    for (std::uint32_t lane = 0; lane < lanes; lane++) {
+        auto src = jobMemory + ((std::size_t)(lane + 1)
+                                * params->getLaneBlocks() - 1)
+                * QWORDS_IN_BLOCK * jobs;
+        for (std::size_t k = 0; k < QWORDS_IN_BLOCK; k++) {
+            lastBlocks[lane].v[k] = src[k * jobs];
+        }
+    }
+    params->finalize(buffer.get(), lastBlocks.get(), 1);
+    return buffer.get();
+}
+
+} // namespace cpu
+} // namespace argon2
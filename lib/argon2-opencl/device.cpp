@@ -24,11 +24,34 @@
 namespace argon2 {
 namespace opencl {
 
+std::shared_ptr<const DeviceProperties> Device::queryProperties(
+        const cl::Device &device)
+{
+    auto props = std::make_shared<DeviceProperties>();
+    props->name = device.getInfo<CL_DEVICE_NAME>();
+    props->vendor = device.getInfo<CL_DEVICE_VENDOR>();
+    props->version = device.getInfo<CL_DEVICE_VERSION>();
+    props->driverVersion = device.getInfo<CL_DRIVER_VERSION>();
+    props->extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+
+    cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+    props->platformName = platform.getInfo<CL_PLATFORM_NAME>();
+
+    props->type = device.getInfo<CL_DEVICE_TYPE>();
+    props->computeUnits = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    props->nativeVectorWidthLong =
+            device.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_LONG>();
+    props->maxWorkGroupSize = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    props->globalMemSize = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    props->maxMemAllocSize = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    props->localMemSize = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    return props;
+}
+
 std::string Device::getName() const
 {
-    return "OpenCL Device '"
-            + device.getInfo<CL_DEVICE_NAME>()
-            + "' (" + device.getInfo<CL_DEVICE_VENDOR>() + ")";
+    return "OpenCL Device '" + properties->name
+            + "' (" + properties->vendor + ")";
 }
 
 template<class T>
@@ -0,0 +1,337 @@
+#include "dispatcher.h"
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+
+namespace argon2 {
+namespace opencl {
+
+namespace {
+
+/* feeds the jobs to an OpenCL unit batch by batch: */
+class ProcessingUnitAdapter : public Dispatcher::Unit
+{
+private:
+    std::unique_ptr<ProcessingUnit> unit;
+
+public:
+    explicit ProcessingUnitAdapter(std::unique_ptr<ProcessingUnit> unit)
+        : unit(std::move(unit))
+    {
+    }
+
+    const void *getEngine() const override { return unit->getDevice(); }
+    std::string getEngineName() const override
+    {
+        return unit->getDevice()->getName();
+    }
+    const Device *getDevice() const override { return unit->getDevice(); }
+    std::size_t getBatchSize() const override { return unit->getBatchSize(); }
+
+    void process(std::size_t from, std::size_t to,
+                 const Dispatcher::PasswordSource &getPassword,
+                 const Dispatcher::HashSink &putHash) override
+    {
+        {
+            ProcessingUnit::PasswordWriter writer(*unit);
+            for (std::size_t i = from; i < to; i++) {
+                const void *pw;
+                std::size_t pwSize;
+                getPassword(i, pw, pwSize);
+                writer.setPassword(pw, pwSize);
+                writer.moveForward(1);
+            }
+        }
+        unit->beginProcessing();
+        unit->endProcessing();
+        {
+            ProcessingUnit::HashReader reader(*unit);
+            for (std::size_t i = from; i < to; i++) {
+                putHash(i, reader.getHash());
+                reader.moveForward(1);
+            }
+        }
+    }
+};
+
+/* the same for a host CPU unit: */
+class CpuProcessingUnitAdapter : public Dispatcher::Unit
+{
+private:
+    std::unique_ptr<cpu::ProcessingUnit> unit;
+
+public:
+    explicit CpuProcessingUnitAdapter(
+            std::unique_ptr<cpu::ProcessingUnit> unit)
+        : unit(std::move(unit))
+    {
+    }
+
+    const void *getEngine() const override { return unit->getThreadPool(); }
+    std::string getEngineName() const override
+    {
+        return "CPU (" + std::to_string(unit->getThreadPool()->getThreadCount())
+                + " threads, "
+                + cpu::getImplementationName(unit->getImplementation()) + ")";
+    }
+    std::size_t getBatchSize() const override { return unit->getBatchSize(); }
+
+    void process(std::size_t from, std::size_t to,
+                 const Dispatcher::PasswordSource &getPassword,
+                 const Dispatcher::HashSink &putHash) override
+    {
+        {
+            cpu::ProcessingUnit::PasswordWriter writer(*unit);
+            for (std::size_t i = from; i < to; i++) {
+                const void *pw;
+                std::size_t pwSize;
+                getPassword(i, pw, pwSize);
+                writer.setPassword(pw, pwSize);
+                writer.moveForward(1);
+            }
+        }
+        unit->beginProcessing();
+        unit->endProcessing();
+        {
+            cpu::ProcessingUnit::HashReader reader(*unit);
+            for (std::size_t i = from; i < to; i++) {
+                putHash(i, reader.getHash());
+                reader.moveForward(1);
+            }
+        }
+    }
+};
+
+} // namespace
+
+void Dispatcher::addUnit(std::unique_ptr<Unit> unit)
+{
+    EngineQueue *queue = nullptr;
+    for (auto &q : queues) {
+        if (q->engine == unit->getEngine()) {
+            queue = q.get();
+            break;
+        }
+    }
+    if (queue == nullptr) {
+        queues.emplace_back(new EngineQueue());
+        queue = queues.back().get();
+        queue->engine = unit->getEngine();
+        queue->batchSize = 0;
+        queue->weight = 0.0;
+        queue->lastHashesPerSecond = 0.0;
+        queue->begin = queue->end = 0;
+        queue->runHashes = 0;
+        queue->runNanoseconds = 0;
+        queue->stats = EngineStats();
+        queue->stats.name = unit->getEngineName();
+        queue->stats.device = unit->getDevice();
+    }
+    queue->batchSize += unit->getBatchSize();
+    queue->stats.units++;
+
+    unitQueues.push_back(queue);
+    units.push_back(std::move(unit));
+}
+
+void Dispatcher::addUnit(std::unique_ptr<ProcessingUnit> unit)
+{
+    addUnit(std::unique_ptr<Unit>(new ProcessingUnitAdapter(std::move(unit))));
+}
+
+void Dispatcher::addUnit(std::unique_ptr<cpu::ProcessingUnit> unit)
+{
+    addUnit(std::unique_ptr<Unit>(
+                new CpuProcessingUnitAdapter(std::move(unit))));
+}
+
+void Dispatcher::addDevice(const ProgramContext *programContext,
+                           const Device *device, std::size_t batchSize,
+                           std::size_t unitCount)
+{
+    for (std::size_t i = 0; i < unitCount; i++) {
+        addUnit(std::unique_ptr<ProcessingUnit>(
+                    new ProcessingUnit(programContext, params, device,
+                                       batchSize)));
+    }
+}
+
+std::vector<Dispatcher::EngineStats> Dispatcher::getStats() const
+{
+    std::vector<EngineStats> res;
+    for (auto &queue : queues) {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        res.push_back(queue->stats);
+    }
+    return res;
+}
+
+void Dispatcher::resetStats()
+{
+    for (auto &queue : queues) {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        auto name = queue->stats.name;
+        auto device = queue->stats.device;
+        auto unitCount = queue->stats.units;
+        queue->stats = EngineStats();
+        queue->stats.name = name;
+        queue->stats.device = device;
+        queue->stats.units = unitCount;
+    }
+}
+
+void Dispatcher::splitJobs(std::size_t count)
+{
+    /* weigh the engines by their throughput in the last run if all of
+     * them have one (so that the split follows changes in their speed),
+     * otherwise by the number of jobs they take at once: */
+    bool measured = true;
+    for (auto &queue : queues) {
+        if (queue->lastHashesPerSecond == 0.0) {
+            measured = false;
+        }
+    }
+    double totalWeight = 0.0;
+    for (auto &queue : queues) {
+        queue->weight = measured ? queue->lastHashesPerSecond
+                                 : (double)queue->batchSize;
+        totalWeight += queue->weight;
+    }
+
+    std::size_t start = 0;
+    double weightSoFar = 0.0;
+    for (std::size_t i = 0; i < queues.size(); i++) {
+        weightSoFar += queues[i]->weight;
+        std::size_t end = i == queues.size() - 1 ? count :
+                (std::size_t)(count * (weightSoFar / totalWeight));
+        queues[i]->begin = start;
+        queues[i]->end = std::max(start, end);
+        queues[i]->runHashes = 0;
+        queues[i]->runNanoseconds = 0;
+        start = queues[i]->end;
+    }
+}
+
+bool Dispatcher::takeJobs(EngineQueue &own, std::size_t maxJobs,
+                          std::size_t &from, std::size_t &to, bool &stolen)
+{
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.begin != own.end) {
+            from = own.begin;
+            to = std::min(own.end, from + maxJobs);
+            own.begin = to;
+            stolen = false;
+            return true;
+        }
+    }
+
+    /* steal from the back of the range that would take its engine the
+     * longest to finish (a slow engine may be a better victim than a fast
+     * one with more jobs left); the sizes may change before the victim
+     * is locked, so retry until all ranges are empty: */
+    for (;;) {
+        EngineQueue *victim = nullptr;
+        double victimTime = 0.0;
+        for (auto &queue : queues) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            auto jobs = queue->end - queue->begin;
+            if (jobs == 0) {
+                continue;
+            }
+            double time = jobs / std::max(queue->weight, 1e-9);
+            if (victim == nullptr || time > victimTime) {
+                victim = queue.get();
+                victimTime = time;
+            }
+        }
+        if (victim == nullptr) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (victim->begin != victim->end) {
+            to = victim->end;
+            from = to - std::min(to - victim->begin, maxJobs);
+            victim->end = from;
+            stolen = true;
+            return true;
+        }
+    }
+}
+
+void Dispatcher::runUnit(std::size_t index,
+                         const PasswordSource &getPassword,
+                         const HashSink &putHash)
+{
+    auto &unit = *units[index];
+    auto &own = *unitQueues[index];
+
+    std::size_t from, to;
+    bool stolen;
+    while (takeJobs(own, unit.getBatchSize(), from, to, stolen)) {
+        unit.process(from, to, getPassword, putHash);
+
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.runHashes += to - from;
+        own.stats.hashes += to - from;
+        own.stats.batches++;
+        if (stolen) {
+            own.stats.stolenBatches++;
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - runStart).count();
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.runNanoseconds = std::max<std::uint64_t>(own.runNanoseconds,
+                                                 elapsed);
+}
+
+void Dispatcher::run(std::size_t count, const PasswordSource &getPassword,
+                     const HashSink &putHash)
+{
+    if (units.empty() || count == 0) {
+        return;
+    }
+
+    splitJobs(count);
+    runStart = std::chrono::steady_clock::now();
+
+    std::vector<std::exception_ptr> errors(units.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < units.size(); i++) {
+        threads.emplace_back([this, i, &errors, &getPassword, &putHash] {
+            try {
+                runUnit(i, getPassword, putHash);
+            } catch (...) {
+                errors[i] = std::current_exception();
+                /* abandon the remaining jobs: */
+                for (auto &queue : queues) {
+                    std::lock_guard<std::mutex> lock(queue->mutex);
+                    queue->end = queue->begin;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (auto &queue : queues) {
+        queue->stats.nanoseconds += queue->runNanoseconds;
+        if (queue->runHashes != 0 && queue->runNanoseconds != 0) {
+            queue->lastHashesPerSecond =
+                    queue->runHashes * 1e9 / queue->runNanoseconds;
+        }
+    }
+    for (auto &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+} // namespace opencl
+} // namespace argon2
@@ -0,0 +1,38 @@
+#ifndef ARGON2_OPENCL_EMBEDDEDKERNELS_H
+#define ARGON2_OPENCL_EMBEDDEDKERNELS_H
+
+#include <cstddef>
+
+namespace argon2 {
+namespace opencl {
+
+/*
+ * Kernels embedded into the library by the CMake build
+ * (see cmake/EmbedFile.cmake).
+ */
+namespace EmbeddedKernels
+{
+#ifdef ARGON2_EMBEDDED_KERNEL
+    /* the source of argon2_kernel.cl: */
+    extern const unsigned char ARGON2_KERNEL[];
+    extern const std::size_t ARGON2_KERNEL_SIZE;
+#endif
+
+#ifdef ARGON2_EMBEDDED_SPIRV
+    /* the kernel compiled to SPIR-V for each type and version (with
+     * the default kernel flags and the portable arithmetic): */
+    extern const unsigned char ARGON2_KERNEL_SPIRV_I_10[];
+    extern const std::size_t ARGON2_KERNEL_SPIRV_I_10_SIZE;
+    extern const unsigned char ARGON2_KERNEL_SPIRV_I_13[];
+    extern const std::size_t ARGON2_KERNEL_SPIRV_I_13_SIZE;
+    extern const unsigned char ARGON2_KERNEL_SPIRV_D_10[];
+    extern const std::size_t ARGON2_KERNEL_SPIRV_D_10_SIZE;
+    extern const unsigned char ARGON2_KERNEL_SPIRV_D_13[];
+    extern const std::size_t ARGON2_KERNEL_SPIRV_D_13_SIZE;
+#endif
+};
+
+} // namespace opencl
+} // namespace argon2
+
+#endif // ARGON2_OPENCL_EMBEDDEDKERNELS_H
@@ -17,26 +17,98 @@
 
 #include "globalcontext.h"
 
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 
+/* from cl_ext.h, which may be missing: */
+#ifndef CL_PLATFORM_NOT_FOUND_KHR
+#define CL_PLATFORM_NOT_FOUND_KHR -1001
+#endif
+
 namespace argon2 {
 namespace opencl {
 
-GlobalContext::GlobalContext()
-    : devices()
+static bool containsIgnoreCase(const std::string &haystack,
+                               const std::string &needle)
+{
+    auto it = std::search(
+                haystack.begin(), haystack.end(),
+                needle.begin(), needle.end(),
+                [](char a, char b) {
+        return std::tolower((unsigned char)a) == std::tolower((unsigned char)b);
+    });
+    return it != haystack.end();
+}
+
+GlobalContext::GlobalContext(const DeviceFilter &filter)
+    : filter(filter), discovered(), devices()
+{
+}
+
+const std::vector<Device> &GlobalContext::getAllDevices() const
+{
+    std::call_once(discovered, &GlobalContext::discoverDevices, this);
+    return devices;
+}
+
+void GlobalContext::discoverDevices() const
 {
+    auto &indices = filter.indices;
+    std::size_t indexLimit = indices.empty() ? 0 :
+            *std::max_element(indices.begin(), indices.end()) + 1;
+
     std::vector<cl::Platform> platforms;
-    cl::Platform::get(&platforms);
+    try {
+        cl::Platform::get(&platforms);
+    } catch (const cl::Error &err) {
+        /* the ICD loader reports this if no platform is installed: */
+        if (err.err() != CL_PLATFORM_NOT_FOUND_KHR) {
+            throw;
+        }
+        return;
+    }
 
+    /* devices that pass the platform, vendor and type criteria: */
+    std::vector<cl::Device> matching;
     std::vector<cl::Device> clDevices;
     for (cl::Platform platform : platforms) {
+        if (indexLimit != 0 && matching.size() >= indexLimit) {
+            /* all requested devices found -- leave the rest alone: */
+            break;
+        }
+        std::string platformName = platform.getInfo<CL_PLATFORM_NAME>();
+        if (!containsIgnoreCase(platformName, filter.platformName)) {
+            continue;
+        }
         try {
-            platform.getDevices(CL_DEVICE_TYPE_ALL, &clDevices);
-            devices.insert(devices.end(), clDevices.begin(), clDevices.end());
+            platform.getDevices(filter.type, &clDevices);
         } catch (const cl::Error &err) {
-            std::cerr << "WARNING: Unable to get devices for platform '"
-                      << platform.getInfo<CL_PLATFORM_NAME>()
-                      << "' - error " << err.err() << std::endl;
+            if (err.err() != CL_DEVICE_NOT_FOUND) {
+                std::cerr << "WARNING: Unable to get devices for platform '"
+                          << platformName
+                          << "' - error " << err.err() << std::endl;
+            }
+            continue;
+        }
+        for (auto &clDevice : clDevices) {
+            if (!filter.vendor.empty() &&
+                    !containsIgnoreCase(clDevice.getInfo<CL_DEVICE_VENDOR>(),
+                                        filter.vendor)) {
+                continue;
+            }
+            matching.push_back(clDevice);
+        }
+    }
+
+    /* the device properties are only queried for the selected devices: */
+    if (indices.empty()) {
+        devices.assign(matching.begin(), matching.end());
+        return;
+    }
+    for (auto index : indices) {
+        if (index < matching.size()) {
+            devices.emplace_back(matching[index]);
         }
     }
 }
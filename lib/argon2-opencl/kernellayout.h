@@ -0,0 +1,31 @@
+#ifndef ARGON2_OPENCL_KERNELLAYOUT_H
+#define ARGON2_OPENCL_KERNELLAYOUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "argon2-common.h"
+
+namespace argon2 {
+namespace opencl {
+
+/* constants shared with argon2_kernel.cl by all units launching it: */
+enum {
+    /* work-items computing one lane (except in the CPU kernel): */
+    THREADS_PER_LANE = 32,
+    /* counters recorded before the segment timestamps
+     * (see ARGON2_COUNTERS in the kernel): */
+    COUNTERS_HEADER = 4,
+};
+
+/* the ulongs recorded per lane of a job by kernels built with
+ * KERNEL_COUNTERS (COUNTERS_RECORD_SIZE in the kernel): */
+inline std::size_t getCountersRecordSize(std::uint32_t passes)
+{
+    return COUNTERS_HEADER + 2 * ARGON2_SYNC_POINTS * (std::size_t)passes;
+}
+
+} // namespace opencl
+} // namespace argon2
+
+#endif // ARGON2_OPENCL_KERNELLAYOUT_H
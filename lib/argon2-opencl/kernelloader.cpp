@@ -1,21 +1,183 @@
 #include "kernelloader.h"
 
+#include "programcache.h"
+#include "embeddedkernels.h"
+
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+/* where the kernel is loaded from if it is not embedded: */
+#define DEFAULT_SOURCE_DIRECTORY "./data/kernels"
+
 namespace argon2 {
 namespace opencl {
 
+static bool hasExtension(const cl::Device &device, const std::string &name)
+{
+    auto extensions = " " + device.getInfo<CL_DEVICE_EXTENSIONS>() + " ";
+    return extensions.find(" " + name + " ") != std::string::npos;
+}
+
+/*
+ * Selects the fast paths for F() and rotr64() in the kernel. One program
+ * is built for all devices of the context, so a fast path is only used
+ * if all of the devices support it. (The AMD path is selected by the
+ * kernel itself, from the cl_amd_media_ops macro.)
+ */
+static std::string getArchBuildOptions(const std::vector<cl::Device> &devices)
+{
+    bool nvidia = !devices.empty();
+    bool funnelShift = nvidia;
+    bool cpu = !devices.empty();
+    for (auto &device : devices) {
+        if (!hasExtension(device, "cl_nv_device_attribute_query")) {
+            nvidia = false;
+            funnelShift = false;
+        } else {
+#if defined(CL_DEVICE_COMPUTE_CAPABILITY_MAJOR_NV) && \
+    defined(CL_DEVICE_COMPUTE_CAPABILITY_MINOR_NV)
+            /* shf.r.wrap needs sm_32: */
+            auto major = device.getInfo<CL_DEVICE_COMPUTE_CAPABILITY_MAJOR_NV>();
+            auto minor = device.getInfo<CL_DEVICE_COMPUTE_CAPABILITY_MINOR_NV>();
+            if (major * 10 + minor < 32) {
+                funnelShift = false;
+            }
+#else
+            funnelShift = false;
+#endif
+        }
+        if (device.getInfo<CL_DEVICE_TYPE>() != CL_DEVICE_TYPE_CPU) {
+            cpu = false;
+        }
+    }
+
+    std::string opts;
+    if (nvidia) {
+        opts += "-DARGON2_ARCH_NVIDIA ";
+        if (funnelShift) {
+            opts += "-DARGON2_NV_FUNNEL_SHIFT ";
+        }
+    } else if (cpu) {
+        opts += "-DARGON2_WIDE_MUL ";
+    }
+    return opts;
+}
+
+#ifdef ARGON2_EMBEDDED_SPIRV
+typedef cl_program (CL_API_CALL *CreateProgramWithILFunc)(
+        cl_context context, const void *il, std::size_t length,
+        cl_int *errcodeRet);
+
+/*
+ * Creates the program from the embedded SPIR-V. Returns an empty program
+ * if the devices cannot consume SPIR-V (cl_khr_il_program), so that the
+ * caller falls back to the source.
+ */
+static cl::Program loadSpirvProgram(const cl::Context &context,
+                                    Type type, Version version)
+{
+    using namespace EmbeddedKernels;
+
+    const unsigned char *il;
+    std::size_t ilSize;
+    if (type == ARGON2_I) {
+        il = version == ARGON2_VERSION_10 ? ARGON2_KERNEL_SPIRV_I_10
+                                          : ARGON2_KERNEL_SPIRV_I_13;
+        ilSize = version == ARGON2_VERSION_10 ? ARGON2_KERNEL_SPIRV_I_10_SIZE
+                                              : ARGON2_KERNEL_SPIRV_I_13_SIZE;
+    } else {
+        il = version == ARGON2_VERSION_10 ? ARGON2_KERNEL_SPIRV_D_10
+                                          : ARGON2_KERNEL_SPIRV_D_13;
+        ilSize = version == ARGON2_VERSION_10 ? ARGON2_KERNEL_SPIRV_D_10_SIZE
+                                              : ARGON2_KERNEL_SPIRV_D_13_SIZE;
+    }
+
+    auto devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    for (auto &device : devices) {
+        if (!hasExtension(device, "cl_khr_il_program")) {
+            return cl::Program();
+        }
+    }
+
+    cl_platform_id platform = devices[0].getInfo<CL_DEVICE_PLATFORM>();
+    auto createProgramWithIL = reinterpret_cast<CreateProgramWithILFunc>(
+                clGetExtensionFunctionAddressForPlatform(
+                    platform, "clCreateProgramWithILKHR"));
+    if (createProgramWithIL == nullptr) {
+        return cl::Program();
+    }
+
+    /* the binary cache works just as well with the IL as the 'source': */
+    std::string ilText(reinterpret_cast<const char *>(il), ilSize);
+    std::string cacheDirectory = ProgramCache::getDefaultDirectory();
+    cl::Program prog;
+    if (ProgramCache::load(cacheDirectory, context, ilText, "", prog)) {
+        return prog;
+    }
+
+    cl_int err;
+    cl_program program = createProgramWithIL(context(), il, ilSize, &err);
+    if (err != CL_SUCCESS) {
+        return cl::Program();
+    }
+    prog = cl::Program(program);
+    try {
+        prog.build("");
+    } catch (const cl::Error &) {
+        return cl::Program();
+    }
+    ProgramCache::store(cacheDirectory, context, ilText, "", prog);
+    return prog;
+}
+#endif
+
 cl::Program KernelLoader::loadArgon2Program(
         const cl::Context &context,
         const std::string &sourceDirectory,
-        Type type, Version version, bool debug)
+        Type type, Version version, unsigned int kernelFlags, bool debug)
 {
-    std::string sourcePath = sourceDirectory + "/argon2_kernel.cl";
+    std::string archOpts;
+    if (!(kernelFlags & KERNEL_PORTABLE_ARITHMETIC)) {
+        archOpts = getArchBuildOptions(context.getInfo<CL_CONTEXT_DEVICES>());
+    }
+
+#ifdef ARGON2_EMBEDDED_SPIRV
+    /* only the default variant with the portable arithmetic is
+     * precompiled, so don't use it if there is a faster one: */
+    bool hasAmdMediaOps = false;
+    for (auto &device : context.getInfo<CL_CONTEXT_DEVICES>()) {
+        if (hasExtension(device, "cl_amd_media_ops")) {
+            hasAmdMediaOps = true;
+        }
+    }
+    if (!debug && sourceDirectory.empty() &&
+            (kernelFlags & ~KERNEL_PORTABLE_ARITHMETIC) == 0 &&
+            ((kernelFlags & KERNEL_PORTABLE_ARITHMETIC) ||
+             (archOpts.empty() && !hasAmdMediaOps))) {
+        cl::Program prog = loadSpirvProgram(context, type, version);
+        if (prog() != nullptr) {
+            return prog;
+        }
+    }
+#endif
+
+    std::string sourcePath;
     std::string sourceText;
     std::stringstream buildOpts;
-    {
+    if (sourceDirectory.empty()) {
+#ifdef ARGON2_EMBEDDED_KERNEL
+        sourceText.assign(
+                    reinterpret_cast<const char *>(
+                        EmbeddedKernels::ARGON2_KERNEL),
+                    EmbeddedKernels::ARGON2_KERNEL_SIZE);
+#else
+        sourcePath = DEFAULT_SOURCE_DIRECTORY "/argon2_kernel.cl";
+#endif
+    } else {
+        sourcePath = sourceDirectory + "/argon2_kernel.cl";
+    }
+    if (!sourcePath.empty()) {
         std::ifstream sourceFile { sourcePath };
         sourceText = {
             std::istreambuf_iterator<char>(sourceFile),
@@ -24,14 +186,51 @@ cl::Program KernelLoader::loadArgon2Program(
     }
 
     if (debug) {
-        buildOpts << "-g -s \"" << sourcePath << "\"" << " ";
+        buildOpts << "-g ";
+        if (!sourcePath.empty()) {
+            buildOpts << "-s \"" << sourcePath << "\"" << " ";
+        }
     }
     buildOpts << "-DARGON2_TYPE=" << type << " ";
     buildOpts << "-DARGON2_VERSION=" << version << " ";
+    if (kernelFlags & KERNEL_PREFETCH_REFS) {
+        buildOpts << "-DARGON2_PREFETCH_REFS ";
+    }
+    if (kernelFlags & KERNEL_VECTOR_ACCESS) {
+        buildOpts << "-DARGON2_VECTOR_ACCESS ";
+    }
+    if (kernelFlags & KERNEL_REGISTER_STATE) {
+        buildOpts << "-DARGON2_REGISTER_STATE ";
+    }
+    if (kernelFlags & KERNEL_COUNTERS) {
+        buildOpts << "-DARGON2_COUNTERS ";
+    }
+    if (kernelFlags & KERNEL_SPLIT_LANES) {
+        buildOpts << "-DARGON2_SPLIT_LANES ";
+    }
+    if (kernelFlags & KERNEL_GLOBAL_SCRATCH) {
+        buildOpts << "-DARGON2_GLOBAL_SCRATCH ";
+    }
+    if (kernelFlags & KERNEL_PORTABLE_ARITHMETIC) {
+        buildOpts << "-DARGON2_PORTABLE_ARITHMETIC ";
+    } else {
+        buildOpts << archOpts;
+    }
+
+    std::string opts = buildOpts.str();
+    /* debug builds refer to the source file, so they are not cached: */
+    std::string cacheDirectory;
+    if (!debug) {
+        cacheDirectory = ProgramCache::getDefaultDirectory();
+    }
+
+    cl::Program prog;
+    if (ProgramCache::load(cacheDirectory, context, sourceText, opts, prog)) {
+        return prog;
+    }
 
-    cl::Program prog(context, sourceText);
+    prog = cl::Program(context, sourceText);
     try {
-        std::string opts = buildOpts.str();
         prog.build(opts.c_str());
     } catch (const cl::Error &err) {
         std::cerr << "ERROR: Failed to build program:" << std::endl;
@@ -41,6 +240,7 @@ cl::Program KernelLoader::loadArgon2Program(
         }
         throw;
     }
+    ProgramCache::store(cacheDirectory, context, sourceText, opts, prog);
     return prog;
 }
 
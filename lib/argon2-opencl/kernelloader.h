@@ -3,6 +3,7 @@
 
 #include "opencl.h"
 #include "argon2-common.h"
+#include "programcontext.h"
 
 #include <string>
 
@@ -11,10 +12,17 @@ namespace opencl {
 
 namespace KernelLoader
 {
+    /*
+     * Builds the program from argon2_kernel.cl in sourceDirectory or, if
+     * sourceDirectory is empty, from the kernel embedded in the library
+     * (the precompiled SPIR-V where possible, or ./data/kernels if the
+     * library was built without the embedded kernel).
+     */
     cl::Program loadArgon2Program(
             const cl::Context &context,
             const std::string &sourceDirectory,
-            Type type, Version version, bool debug = false);
+            Type type, Version version, unsigned int kernelFlags = 0,
+            bool debug = false);
 };
 
 } // namespace opencl
@@ -0,0 +1,113 @@
+#include "memoryplanner.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+/* the part of the global memory left for the driver and for the small
+ * buffers besides the hash memory (1/16): */
+#define MEMORY_RESERVE_SHIFT 4
+
+namespace argon2 {
+namespace opencl {
+
+std::uint64_t MemoryPlanner::getMemoryBudget(const Device &device)
+{
+    auto globalMemSize = device.getProperties().globalMemSize;
+    return globalMemSize - (globalMemSize >> MEMORY_RESERVE_SHIFT);
+}
+
+const std::size_t MemoryPlanner::MAX_LANE_BUFFERS;
+
+std::size_t MemoryPlanner::getMaxBatchSize(const Device &device,
+                                           std::size_t jobMemorySize,
+                                           std::size_t bufferMemorySize)
+{
+    if (bufferMemorySize == 0) {
+        bufferMemorySize = jobMemorySize;
+    }
+    if (jobMemorySize == 0 ||
+            bufferMemorySize > device.getProperties().maxMemAllocSize) {
+        return 0;
+    }
+    return getMemoryBudget(device) / jobMemorySize;
+}
+
+std::size_t MemoryPlanner::getLanesPerBuffer(const Device &device,
+                                             std::size_t laneMemorySize,
+                                             std::size_t lanes)
+{
+    auto maxAllocSize = device.getProperties().maxMemAllocSize;
+    if (laneMemorySize > maxAllocSize) {
+        throw std::length_error(
+                    "the memory of one lane (" + std::to_string(laneMemorySize)
+                    + " bytes) exceeds the largest allocation allowed by "
+                    + device.getName() + " ("
+                    + std::to_string(maxAllocSize) + " bytes)");
+    }
+    std::size_t lanesPerBuffer = std::min<std::size_t>(
+                lanes, maxAllocSize / laneMemorySize);
+    if (lanes > lanesPerBuffer * MAX_LANE_BUFFERS) {
+        throw std::length_error(
+                    "the lanes of one job would need more than "
+                    + std::to_string(MAX_LANE_BUFFERS) + " buffers on "
+                    + device.getName() + " (at most "
+                    + std::to_string(lanesPerBuffer)
+                    + " lanes fit into one)");
+    }
+    return lanesPerBuffer;
+}
+
+std::vector<MemoryPlanner::Shard> MemoryPlanner::planShards(
+        const Device &device, std::size_t jobMemorySize,
+        std::size_t batchSize, std::size_t minShards,
+        std::size_t bufferMemorySize)
+{
+    auto maxAllocSize = device.getProperties().maxMemAllocSize;
+    if (bufferMemorySize == 0) {
+        if (jobMemorySize > maxAllocSize) {
+            throw std::length_error(
+                        "the memory of one job ("
+                        + std::to_string(jobMemorySize)
+                        + " bytes) exceeds the largest allocation allowed by "
+                        + device.getName() + " ("
+                        + std::to_string(maxAllocSize) + " bytes); build"
+                        " the kernel with KERNEL_SPLIT_LANES to split its"
+                        " lanes between several buffers");
+        }
+        bufferMemorySize = jobMemorySize;
+    } else if (bufferMemorySize > maxAllocSize) {
+        throw std::length_error(
+                    "a part of one job (" + std::to_string(bufferMemorySize)
+                    + " bytes) exceeds the largest allocation allowed by "
+                    + device.getName() + " ("
+                    + std::to_string(maxAllocSize) + " bytes)");
+    }
+    auto maxBatchSize = getMaxBatchSize(device, jobMemorySize,
+                                        bufferMemorySize);
+    if (batchSize > maxBatchSize) {
+        throw std::length_error(
+                    "a batch of " + std::to_string(batchSize)
+                    + " jobs does not fit into the memory of "
+                    + device.getName() + " (at most "
+                    + std::to_string(maxBatchSize) + " jobs fit)");
+    }
+
+    std::size_t jobsPerBuffer = maxAllocSize / bufferMemorySize;
+    std::size_t shardCount = (batchSize + jobsPerBuffer - 1) / jobsPerBuffer;
+    shardCount = std::max(shardCount, minShards);
+    shardCount = std::max<std::size_t>(1, std::min(shardCount, batchSize));
+
+    std::vector<Shard> shards(shardCount);
+    std::size_t firstJob = 0;
+    for (std::size_t i = 0; i < shardCount; i++) {
+        shards[i].firstJob = firstJob;
+        shards[i].jobs = batchSize / shardCount
+                + (i < batchSize % shardCount ? 1 : 0);
+        firstJob += shards[i].jobs;
+    }
+    return shards;
+}
+
+} // namespace opencl
+} // namespace argon2
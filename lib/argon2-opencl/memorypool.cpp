@@ -0,0 +1,228 @@
+#include "memorypool.h"
+
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* from linux/mman.h and linux/mempolicy.h, which may be missing: */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#define ARGON2_MPOL_PREFERRED 1
+#endif
+
+namespace argon2 {
+namespace cpu {
+
+enum {
+    SIZE_2M = std::size_t(1) << 21,
+    SIZE_1G = std::size_t(1) << 30,
+};
+
+static std::size_t roundUp(std::size_t size, std::size_t granularity)
+{
+    return (size + granularity - 1) / granularity * granularity;
+}
+
+MemoryPool::Buffer::Buffer(Buffer &&other)
+    : pool(other.pool), data(other.data), size(other.size)
+{
+    other.pool = nullptr;
+    other.data = nullptr;
+    other.size = 0;
+}
+
+MemoryPool::Buffer &MemoryPool::Buffer::operator=(Buffer &&other)
+{
+    if (this != &other) {
+        if (pool) {
+            pool->release(data);
+        }
+        pool = other.pool;
+        data = other.data;
+        size = other.size;
+        other.pool = nullptr;
+        other.data = nullptr;
+        other.size = 0;
+    }
+    return *this;
+}
+
+MemoryPool::Buffer::~Buffer()
+{
+    if (pool) {
+        pool->release(data);
+    }
+}
+
+MemoryPool::MemoryPool(PageSize pageSize, int numaNode)
+    : pageSize(pageSize), numaNode(numaNode), stats()
+{
+}
+
+MemoryPool::~MemoryPool()
+{
+    for (auto &entry : mappings) {
+        unmap(entry.first, entry.second);
+    }
+}
+
+#ifdef __linux__
+
+void *MemoryPool::map(std::size_t size, PageSize &usedPageSize)
+{
+    const int prot = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    /* explicit huge pages need to be reserved by the administrator,
+     * so fall back to smaller ones; a length that isn't a multiple of
+     * 1 GiB would be rounded up and then not fully unmapped, so such
+     * sizes go straight to 2 MiB pages: */
+    void *data = MAP_FAILED;
+    usedPageSize = pageSize;
+    if (usedPageSize == PAGES_1G && size % SIZE_1G != 0) {
+        usedPageSize = PAGES_2M;
+    }
+    if (usedPageSize == PAGES_1G) {
+        data = mmap(nullptr, size, prot,
+                    flags | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+        if (data == MAP_FAILED) {
+            usedPageSize = PAGES_2M;
+        }
+    }
+    if (usedPageSize == PAGES_2M && data == MAP_FAILED) {
+        data = mmap(nullptr, size, prot,
+                    flags | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (data == MAP_FAILED) {
+            usedPageSize = PAGES_DEFAULT;
+        }
+    }
+    if (data == MAP_FAILED) {
+        data = mmap(nullptr, size, prot, flags, -1, 0);
+        if (data == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (pageSize != PAGES_DEFAULT) {
+            /* transparent huge pages, if enabled: */
+            madvise(data, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    if (numaNode >= 0) {
+        /* syscall() instead of mbind() from libnuma, to not depend on
+         * it; a failure only costs performance: */
+        unsigned long nodeMask[4] = { 0 };
+        std::size_t bits = 8 * sizeof(nodeMask[0]);
+        if (static_cast<std::size_t>(numaNode) < 4 * bits) {
+            nodeMask[numaNode / bits] = 1UL << (numaNode % bits);
+            syscall(SYS_mbind, data, size, ARGON2_MPOL_PREFERRED,
+                    nodeMask, 4 * bits + 1, 0);
+        }
+    }
+
+    /* fault the pages in now rather than during the first batch: */
+    long systemPageSize = sysconf(_SC_PAGESIZE);
+    for (std::size_t i = 0; i < size; i += systemPageSize) {
+        static_cast<volatile std::uint8_t *>(data)[i] = 0;
+    }
+    return data;
+}
+
+void MemoryPool::unmap(void *data, const Mapping &mapping)
+{
+    munmap(data, mapping.size);
+}
+
+#else
+
+void *MemoryPool::map(std::size_t size, PageSize &usedPageSize)
+{
+    usedPageSize = PAGES_DEFAULT;
+    void *data = ::operator new(size);
+    std::memset(data, 0, size);
+    return data;
+}
+
+void MemoryPool::unmap(void *data, const Mapping &)
+{
+    ::operator delete(data);
+}
+
+#endif
+
+MemoryPool::Stats MemoryPool::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+MemoryPool::Buffer MemoryPool::allocate(std::size_t size)
+{
+    if (size == 0) {
+        return Buffer();
+    }
+
+    switch (pageSize) {
+    case PAGES_1G:
+        size = roundUp(size, size >= SIZE_1G / 2 ? SIZE_1G : SIZE_2M);
+        break;
+    case PAGES_2M:
+        size = roundUp(size, SIZE_2M);
+        break;
+    default:
+        break;
+    }
+
+    /* the pool is set last, so that a failed buffer isn't released: */
+    Buffer buffer;
+    buffer.size = size;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    stats.allocations++;
+    auto it = freeMappings.find(size);
+    if (it != freeMappings.end()) {
+        stats.reuses++;
+        buffer.data = it->second;
+        buffer.pool = this;
+        freeMappings.erase(it);
+        return buffer;
+    }
+
+    /* faulting in a big mapping takes a while: */
+    Mapping mapping;
+    mapping.size = size;
+    lock.unlock();
+    buffer.data = map(size, mapping.pageSize);
+    lock.lock();
+    mappings[buffer.data] = mapping;
+
+    stats.bytes += size;
+    if (mapping.pageSize == PAGES_2M) {
+        stats.bytes2M += size;
+    } else if (mapping.pageSize == PAGES_1G) {
+        stats.bytes1G += size;
+    }
+    buffer.pool = this;
+    return buffer;
+}
+
+void MemoryPool::release(void *data)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    freeMappings.emplace(mappings[data].size, data);
+}
+
+} // namespace cpu
+} // namespace argon2
@@ -1,6 +1,12 @@
 #include "processingunit.h"
 
-#define THREADS_PER_LANE 32
+#include "kernellayout.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
 #define DEBUG_BUFFER_SIZE 4
 
 namespace argon2 {
@@ -9,131 +15,584 @@ namespace opencl {
 ProcessingUnit::ProcessingUnit(
         const ProgramContext *programContext, const Argon2Params *params,
         const Device *device, std::size_t batchSize,
-        bool bySegment)
+        bool bySegment, bool allowLocalMemory, bool allowPersistent,
+        std::size_t chunkBlocks, bool allowCpuKernel, std::size_t queueCount,
+        std::size_t lanesPerBuffer)
     : programContext(programContext), params(params),
-      device(device), batchSize(batchSize), bySegment(bySegment)
+      device(device), batchSize(batchSize), bySegment(bySegment),
+      persistent(false), localMemoryResident(false), globalScratch(false),
+      cpuKernel(false), cpuJobsPerGroup(1),
+      lanesPerBuffer(params->getLanes()),
+      program(programContext->getProgram()), localMemSize(0),
+      chunkBlocks(chunkBlocks), chunksPerSegment(1), chunkCount(0),
+      cancelled(false), countersRecordSize(0)
+{
+    auto lanes = params->getLanes();
+    if (programContext->getKernelFlags() & KERNEL_COUNTERS) {
+        countersRecordSize = getCountersRecordSize(params->getTimeCost());
+        counters.resize(batchSize * lanes * countersRecordSize);
+    }
+
+    bool splitLanes = programContext->getKernelFlags() & KERNEL_SPLIT_LANES;
+    std::size_t bufferMemorySize = 0;
+    if (splitLanes) {
+        auto laneMemorySize =
+                (std::size_t)params->getLaneBlocks() * ARGON2_BLOCK_SIZE;
+        if (lanesPerBuffer == 0) {
+            lanesPerBuffer = MemoryPlanner::getLanesPerBuffer(
+                        *device, laneMemorySize, lanes);
+        }
+        /* the kernel takes at most MAX_LANE_BUFFERS buffers: */
+        auto maxBuffers = MemoryPlanner::MAX_LANE_BUFFERS;
+        lanesPerBuffer = std::max(lanesPerBuffer,
+                                  (lanes + maxBuffers - 1) / maxBuffers);
+        this->lanesPerBuffer = std::min<std::size_t>(lanesPerBuffer, lanes);
+        bufferMemorySize = this->lanesPerBuffer * laneMemorySize;
+    }
+
+    /* at least one shard per queue, more if the batch does not fit into
+     * that many allocations: */
+    queueCount = std::max<std::size_t>(1, std::min(queueCount, batchSize));
+    for (auto &plannedShard : MemoryPlanner::planShards(
+             *device, params->getMemorySize(), batchSize, queueCount,
+             bufferMemorySize)) {
+        Shard shard;
+        shard.firstJob = plannedShard.firstJob;
+        shard.jobs = plannedShard.jobs;
+        shard.nextChunk = 0;
+        shards.push_back(std::move(shard));
+    }
+    for (std::size_t i = 0; i < queueCount; i++) {
+        cmdQueues.emplace_back(programContext->getContext(),
+                               device->getCLDevice());
+    }
+
+    auto &clDevice = device->getCLDevice();
+    bool globalScratchOnly =
+            programContext->getKernelFlags() & KERNEL_GLOBAL_SCRATCH;
+    if (globalScratchOnly) {
+        /* only the oneshot kernel is built with KERNEL_GLOBAL_SCRATCH: */
+        if (chunkBlocks != 0) {
+            throw std::logic_error(
+                        "ProcessingUnit: programs built with"
+                        " KERNEL_GLOBAL_SCRATCH cannot process in chunks");
+        }
+        bySegment = false;
+        this->bySegment = false;
+        allowLocalMemory = false;
+        allowCpuKernel = false;
+    }
+    if (splitLanes) {
+        /* only the segment kernel is built with KERNEL_SPLIT_LANES: */
+        bySegment = true;
+        this->bySegment = true;
+        allowPersistent = false;
+        allowCpuKernel = false;
+    }
+    if (chunkBlocks != 0) {
+        /* chunks are always computed by the (multi-launch) segment kernel: */
+        bySegment = true;
+        this->bySegment = true;
+        allowPersistent = false;
+
+        auto segmentBlocks = params->getSegmentBlocks();
+        chunksPerSegment = (segmentBlocks + chunkBlocks - 1) / chunkBlocks;
+        chunkCount = chunksPerSegment * params->getTimeCost()
+                * ARGON2_SYNC_POINTS;
+    }
+
+    cpuKernel = allowCpuKernel && chunkBlocks == 0 &&
+            device->getProperties().type == CL_DEVICE_TYPE_CPU;
+    if (cpuKernel) {
+        kernelName = "argon2_kernel_cpu";
+        cl::Kernel kernel(program, kernelName.c_str());
+        auto maxWorkGroupSize =
+                kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(clDevice);
+        if (lanes <= maxWorkGroupSize) {
+            /* one launch for everything, with all lanes of a job in one
+             * work-group; add as many jobs as the vector units can take,
+             * so that the runtime can vectorize across them: */
+            this->bySegment = false;
+            std::size_t vectorWidth =
+                    device->getProperties().nativeVectorWidthLong;
+            cpuJobsPerGroup = std::min(std::max<std::size_t>(vectorWidth, 1),
+                                       maxWorkGroupSize / lanes);
+            for (auto &shard : shards) {
+                while (shard.jobs % cpuJobsPerGroup != 0) {
+                    --cpuJobsPerGroup;
+                }
+            }
+        } else {
+            /* one launch per segment: */
+            this->bySegment = true;
+        }
+    } else if (!bySegment) {
+        /* the whole memory of the job + working blocks for each lane: */
+        auto residentMemSize = (std::size_t)lanes * ARGON2_BLOCK_SIZE;
+        if (programContext->getArgon2Type() == ARGON2_I) {
+            residentMemSize *= params->getLaneBlocks() + 3;
+        } else {
+            residentMemSize *= params->getLaneBlocks() + 1;
+        }
+        auto deviceLocalMemSize = device->getProperties().localMemSize;
+        localMemoryResident = allowLocalMemory &&
+                residentMemSize <= deviceLocalMemSize;
+
+        if (localMemoryResident) {
+            localMemSize = residentMemSize;
+            kernelName = "argon2_kernel_oneshot_local";
+        } else {
+            localMemSize = (std::size_t)lanes * ARGON2_BLOCK_SIZE;
+            if (programContext->getArgon2Type() == ARGON2_I) {
+                localMemSize *= 3;
+            } else {
+                localMemSize *= 2;
+            }
+            kernelName = "argon2_kernel_oneshot";
+        }
+
+        cl::Kernel kernel(program, kernelName.c_str());
+        auto maxWorkGroupSize =
+                kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(clDevice);
+        globalScratch = globalScratchOnly;
+        if (lanes * THREADS_PER_LANE <= maxWorkGroupSize &&
+                localMemSize > deviceLocalMemSize) {
+            /* the working blocks do not fit into local memory -- keep
+             * them in global memory, still with one work-group per job: */
+            globalScratch = true;
+            program = programContext->getGlobalScratchProgram();
+            kernel = cl::Kernel(program, kernelName.c_str());
+            maxWorkGroupSize = kernel.getWorkGroupInfo<
+                    CL_KERNEL_WORK_GROUP_SIZE>(clDevice);
+        }
+        if (lanes * THREADS_PER_LANE > maxWorkGroupSize) {
+            if (globalScratchOnly) {
+                throw std::length_error(
+                            "ProcessingUnit: the " + std::to_string(lanes)
+                            + " lanes of a job do not fit into one"
+                            " work-group on " + device->getName());
+            }
+            /* too many lanes to fit into one work-group -- give each lane
+             * its own work-group (in one launch via the persistent kernel
+             * only if the caller allows it): */
+            this->bySegment = true;
+            localMemoryResident = false;
+            globalScratch = false;
+            program = programContext->getProgram();
+        }
+    }
+
+    if (this->bySegment && !cpuKernel) {
+        /* each lane is processed by one work-group, so (assuming in-order
+         * dispatch) one work-group per compute unit is always enough
+         * to keep all lanes of a job resident; the launches of several
+         * queues may run concurrently and split the compute units, so
+         * each of them needs its own lanes: */
+        auto computeUnits = device->getProperties().computeUnits;
+        persistent = allowPersistent &&
+                lanes * cmdQueues.size() <= computeUnits;
+        if (persistent) {
+            localMemSize = (std::size_t)ARGON2_BLOCK_SIZE;
+            if (programContext->getArgon2Type() == ARGON2_I) {
+                localMemSize *= 3;
+            } else {
+                localMemSize *= 2;
+            }
+            kernelName = "argon2_kernel_segment_persistent";
+        } else {
+            kernelName = "argon2_kernel_segment";
+        }
+    }
+
+    for (std::size_t i = 0; i < shards.size(); i++) {
+        shards[i].cmdQueue = cmdQueues[i % cmdQueues.size()];
+        setUpShard(shards[i]);
+    }
+}
+
+void ProcessingUnit::setUpShard(Shard &shard)
 {
-    // FIXME: check memSize out of bounds
     auto &clContext = programContext->getContext();
     auto lanes = params->getLanes();
-    cmdQueue = cl::CommandQueue(clContext, device->getCLDevice());
 
-    memorySize = params->getMemorySize() * batchSize;
-    memoryBuffer = cl::Buffer(clContext, CL_MEM_READ_WRITE, memorySize);
-    debugBuffer = cl::Buffer(clContext, CL_MEM_WRITE_ONLY, DEBUG_BUFFER_SIZE);
+    auto laneMemorySize =
+            (std::size_t)params->getLaneBlocks() * ARGON2_BLOCK_SIZE;
+    auto groups = (lanes + lanesPerBuffer - 1) / lanesPerBuffer;
+    for (std::size_t group = 0; group < groups; group++) {
+        shard.memoryBuffers.emplace_back(
+                    clContext, CL_MEM_READ_WRITE,
+                    shard.jobs * getLaneGroupSize(group) * laneMemorySize);
+    }
+    if (hasCounters()) {
+        shard.debugBuffer = cl::Buffer(
+                    clContext, CL_MEM_READ_WRITE,
+                    shard.jobs * lanes * countersRecordSize
+                    * sizeof(cl_ulong));
+    } else {
+        shard.debugBuffer = cl::Buffer(clContext, CL_MEM_WRITE_ONLY,
+                                       DEBUG_BUFFER_SIZE);
+    }
 
-    mappedMemoryBuffer = cmdQueue.enqueueMapBuffer(
-                memoryBuffer, true, CL_MAP_WRITE, 0, memorySize);
+    mapMemory(shard, true, CL_MAP_WRITE, nullptr);
 
-    if (bySegment) {
-        kernel = cl::Kernel(programContext->getProgram(),
-                            "argon2_kernel_segment");
-        kernel.setArg<cl::Buffer>(0, memoryBuffer);
+    auto &kernel = shard.kernel;
+    kernel = cl::Kernel(program, kernelName.c_str());
+    if (cpuKernel) {
+        kernel.setArg<cl::Buffer>(0, shard.memoryBuffers[0]);
         kernel.setArg<cl_uint>(1, params->getTimeCost());
         kernel.setArg<cl_uint>(2, lanes);
         kernel.setArg<cl_uint>(3, params->getSegmentBlocks());
-    } else {
-        auto localMemSize = (std::size_t)lanes * ARGON2_BLOCK_SIZE;
+        kernel.setArg<cl_uint>(4, 0);
+        kernel.setArg<cl_uint>(5, params->getTimeCost() * ARGON2_SYNC_POINTS);
+    } else if (globalScratch) {
+        /* the working blocks the kernel would otherwise keep in local
+         * memory, for each job: */
+        auto scratchSize = (std::size_t)lanes * ARGON2_BLOCK_SIZE;
         if (programContext->getArgon2Type() == ARGON2_I) {
-            localMemSize *= 3;
+            scratchSize *= 3;
         } else {
-            localMemSize *= 2;
+            scratchSize *= 2;
         }
-
-        kernel = cl::Kernel(programContext->getProgram(),
-                            "argon2_kernel_oneshot");
-        kernel.setArg<cl::Buffer>(0, memoryBuffer);
+        shard.scratchBuffer = cl::Buffer(clContext, CL_MEM_READ_WRITE,
+                                         shard.jobs * scratchSize);
+        kernel.setArg<cl::Buffer>(0, shard.memoryBuffers[0]);
+        kernel.setArg<cl::Buffer>(1, shard.scratchBuffer);
+        kernel.setArg<cl_uint>(2, params->getTimeCost());
+        kernel.setArg<cl_uint>(3, lanes);
+        kernel.setArg<cl_uint>(4, params->getSegmentBlocks());
+    } else if (!bySegment) {
+        kernel.setArg<cl::Buffer>(0, shard.memoryBuffers[0]);
         kernel.setArg<cl::LocalSpaceArg>(1, { localMemSize });
         kernel.setArg<cl_uint>(2, params->getTimeCost());
         kernel.setArg<cl_uint>(3, lanes);
         kernel.setArg<cl_uint>(4, params->getSegmentBlocks());
+    } else if (persistent) {
+        shard.syncBuffer = cl::Buffer(clContext, CL_MEM_READ_WRITE,
+                                      shard.jobs * sizeof(cl_uint));
+        kernel.setArg<cl::Buffer>(0, shard.memoryBuffers[0]);
+        kernel.setArg<cl::Buffer>(1, shard.syncBuffer);
+        kernel.setArg<cl::LocalSpaceArg>(2, { localMemSize });
+        kernel.setArg<cl_uint>(3, params->getTimeCost());
+        kernel.setArg<cl_uint>(4, lanes);
+        kernel.setArg<cl_uint>(5, params->getSegmentBlocks());
+    } else {
+        kernel.setArg<cl::Buffer>(0, shard.memoryBuffers[0]);
+        kernel.setArg<cl_uint>(1, params->getTimeCost());
+        kernel.setArg<cl_uint>(2, lanes);
+        kernel.setArg<cl_uint>(3, params->getSegmentBlocks());
+        kernel.setArg<cl_uint>(6, 0);
+        kernel.setArg<cl_uint>(7, params->getSegmentBlocks());
+        if (programContext->getKernelFlags() & KERNEL_SPLIT_LANES) {
+            kernel.setArg<cl_uint>(8, lanesPerBuffer);
+            /* the unused buffer arguments just repeat the first one: */
+            for (std::size_t i = 1; i < MemoryPlanner::MAX_LANE_BUFFERS;
+                 i++) {
+                kernel.setArg<cl::Buffer>(
+                            8 + i, shard.memoryBuffers[
+                                i < shard.memoryBuffers.size() ? i : 0]);
+            }
+        }
+    }
+
+    if (hasCounters()) {
+        /* the counters are always the last argument: */
+        auto argCount = kernel.getInfo<CL_KERNEL_NUM_ARGS>();
+        kernel.setArg<cl::Buffer>(argCount - 1, shard.debugBuffer);
     }
 }
 
+void ProcessingUnit::mapMemory(Shard &shard, bool blocking,
+                               cl_map_flags flags, cl::Event *event)
+{
+    auto laneMemorySize =
+            (std::size_t)params->getLaneBlocks() * ARGON2_BLOCK_SIZE;
+    auto count = shard.memoryBuffers.size();
+    shard.mappedMemoryBuffers.resize(count);
+    for (std::size_t i = 0; i < count; i++) {
+        /* the queue is in-order, so the last map finishes last: */
+        shard.mappedMemoryBuffers[i] = shard.cmdQueue.enqueueMapBuffer(
+                    shard.memoryBuffers[i], blocking, flags, 0,
+                    shard.jobs * getLaneGroupSize(i) * laneMemorySize,
+                    nullptr, i == count - 1 ? event : nullptr);
+    }
+}
+
+void ProcessingUnit::unmapMemory(Shard &shard)
+{
+    for (std::size_t i = 0; i < shard.memoryBuffers.size(); i++) {
+        shard.cmdQueue.enqueueUnmapMemObject(shard.memoryBuffers[i],
+                                             shard.mappedMemoryBuffers[i]);
+    }
+}
+
+std::size_t ProcessingUnit::getLaneGroupSize(std::size_t group) const
+{
+    return std::min<std::size_t>(lanesPerBuffer, params->getLanes()
+                                 - group * lanesPerBuffer);
+}
+
+std::uint8_t *ProcessingUnit::getLaneMemory(std::size_t job,
+                                            std::size_t lane) const
+{
+    auto laneMemorySize =
+            (std::size_t)params->getLaneBlocks() * ARGON2_BLOCK_SIZE;
+    auto group = lane / lanesPerBuffer;
+    auto groupLanes = getLaneGroupSize(group);
+    for (auto &shard : shards) {
+        if (job < shard.firstJob + shard.jobs) {
+            return static_cast<std::uint8_t *>(
+                        shard.mappedMemoryBuffers[group])
+                    + ((job - shard.firstJob) * groupLanes
+                       + lane - group * lanesPerBuffer) * laneMemorySize;
+        }
+    }
+    return nullptr;
+}
+
+ProcessingUnit::LaneCounters ProcessingUnit::getCounters(
+        std::size_t job, std::size_t lane) const
+{
+    auto record = counters.data()
+            + (job * params->getLanes() + lane) * countersRecordSize;
+    auto segments = (countersRecordSize - COUNTERS_HEADER) / 2;
+
+    LaneCounters res;
+    res.blocks = record[0];
+    res.crossLaneRefs = record[1];
+    res.addressBlocks = record[2];
+    res.segmentStart.resize(segments);
+    res.segmentEnd.resize(segments);
+    for (std::size_t i = 0; i < segments; i++) {
+        res.segmentStart[i] = record[COUNTERS_HEADER + 2 * i];
+        res.segmentEnd[i] = record[COUNTERS_HEADER + 2 * i + 1];
+    }
+    return res;
+}
+
 ProcessingUnit::PasswordWriter::PasswordWriter(
         ProcessingUnit &parent, std::size_t index)
-    : params(parent.params),
+    : parent(&parent), params(parent.params),
       type(parent.programContext->getArgon2Type()),
       version(parent.programContext->getArgon2Version()),
-      dest(static_cast<std::uint8_t *>(parent.mappedMemoryBuffer))
+      index(index)
 {
-    dest += index * params->getMemorySize();
+    if (parent.lanesPerBuffer != params->getLanes()) {
+        buffer.reset(new std::uint8_t[
+                     params->getLanes() * 2 * ARGON2_BLOCK_SIZE]);
+    }
 }
 
 void ProcessingUnit::PasswordWriter::moveForward(std::size_t offset)
 {
-    dest += offset * params->getMemorySize();
+    index += offset;
 }
 
 void ProcessingUnit::PasswordWriter::moveBackwards(std::size_t offset)
 {
-    dest -= offset * params->getMemorySize();
+    index -= offset;
 }
 
 void ProcessingUnit::PasswordWriter::setPassword(
         const void *pw, std::size_t pwSize) const
 {
-    params->fillFirstBlocks(dest, pw, pwSize, type, version);
+    if (!buffer) {
+        params->fillFirstBlocks(parent->getLaneMemory(index, 0), pw, pwSize,
+                                type, version);
+        return;
+    }
+    /* fill the first two blocks of all lanes here and copy them to the
+     * lanes' buffers: */
+    params->fillFirstBlocks(buffer.get(), pw, pwSize, type, version, 2);
+    for (std::size_t lane = 0; lane < params->getLanes(); lane++) {
+        std::memcpy(parent->getLaneMemory(index, lane),
+                    buffer.get() + lane * 2 * ARGON2_BLOCK_SIZE,
+                    2 * ARGON2_BLOCK_SIZE);
+    }
 }
 
 ProcessingUnit::HashReader::HashReader(
         ProcessingUnit &parent, std::size_t index)
-    : params(parent.params),
-      src(static_cast<const std::uint8_t *>(parent.mappedMemoryBuffer)),
+    : parent(&parent), params(parent.params), index(index),
       buffer(new std::uint8_t[params->getOutputLength()])
 {
-    src += index * params->getMemorySize();
+    if (parent.lanesPerBuffer != params->getLanes()) {
+        lastBlocks.reset(new std::uint8_t[
+                         params->getLanes() * ARGON2_BLOCK_SIZE]);
+    }
 }
 
 void ProcessingUnit::HashReader::moveForward(std::size_t offset)
 {
-    src += offset * params->getMemorySize();
+    index += offset;
 }
 
 void ProcessingUnit::HashReader::moveBackwards(std::size_t offset)
 {
-    src -= offset * params->getMemorySize();
+    index -= offset;
 }
 
 const void *ProcessingUnit::HashReader::getHash() const
 {
-    params->finalize(buffer.get(), src);
+    if (!lastBlocks) {
+        params->finalize(buffer.get(), parent->getLaneMemory(index, 0));
+        return buffer.get();
+    }
+    /* gather the last blocks of all lanes: */
+    auto lastBlockOffset =
+            (std::size_t)(params->getLaneBlocks() - 1) * ARGON2_BLOCK_SIZE;
+    for (std::size_t lane = 0; lane < params->getLanes(); lane++) {
+        std::memcpy(lastBlocks.get() + lane * ARGON2_BLOCK_SIZE,
+                    parent->getLaneMemory(index, lane) + lastBlockOffset,
+                    ARGON2_BLOCK_SIZE);
+    }
+    params->finalize(buffer.get(), lastBlocks.get(), 1);
     return buffer.get();
 }
 
-void ProcessingUnit::beginProcessing()
+void ProcessingUnit::enqueueNextChunk(Shard &shard)
 {
-    cmdQueue.enqueueUnmapMemObject(memoryBuffer, mappedMemoryBuffer);
+    auto segment = shard.nextChunk / chunksPerSegment;
+    auto chunkStart = (shard.nextChunk % chunksPerSegment) * chunkBlocks;
+    auto &kernel = shard.kernel;
+    kernel.setArg<cl_uint>(4, segment / ARGON2_SYNC_POINTS);
+    kernel.setArg<cl_uint>(5, segment % ARGON2_SYNC_POINTS);
+    kernel.setArg<cl_uint>(6, chunkStart);
+    kernel.setArg<cl_uint>(7, chunkStart + chunkBlocks);
+
+    cl::Event chunkEvent;
+    shard.cmdQueue.enqueueNDRangeKernel(
+                kernel, cl::NullRange,
+                cl::NDRange(shard.jobs, params->getLanes(), THREADS_PER_LANE),
+                cl::NDRange(1, 1, THREADS_PER_LANE), nullptr, &chunkEvent);
+    shard.cmdQueue.flush();
+    shard.chunkEvents.push_back(chunkEvent);
+    ++shard.nextChunk;
+}
 
-    if (bySegment) {
+void ProcessingUnit::enqueueKernels(Shard &shard)
+{
+    auto &cmdQueue = shard.cmdQueue;
+    auto &kernel = shard.kernel;
+    auto jobs = shard.jobs;
+    auto lanes = params->getLanes();
+    if (cpuKernel) {
+        if (bySegment) {
+            auto segments = params->getTimeCost() * ARGON2_SYNC_POINTS;
+            for (cl_uint segment = 0; segment < segments; segment++) {
+                kernel.setArg<cl_uint>(4, segment);
+                kernel.setArg<cl_uint>(5, segment + 1);
+                cmdQueue.enqueueNDRangeKernel(
+                            kernel, cl::NullRange,
+                            cl::NDRange(jobs, lanes),
+                            cl::NDRange(1, 1));
+            }
+        } else {
+            cmdQueue.enqueueNDRangeKernel(
+                        kernel, cl::NullRange,
+                        cl::NDRange(jobs, lanes),
+                        cl::NDRange(cpuJobsPerGroup, lanes));
+        }
+    } else if (persistent) {
+        cmdQueue.enqueueFillBuffer<cl_uint>(shard.syncBuffer, 0, 0,
+                                            jobs * sizeof(cl_uint));
+        cmdQueue.enqueueNDRangeKernel(
+                    kernel, cl::NullRange,
+                    cl::NDRange(THREADS_PER_LANE, lanes, jobs),
+                    cl::NDRange(THREADS_PER_LANE, 1, 1));
+    } else if (bySegment) {
         for (cl_uint pass = 0; pass < params->getTimeCost(); pass++) {
             kernel.setArg<cl_uint>(4, pass);
             for (cl_uint slice = 0; slice < ARGON2_SYNC_POINTS; slice++) {
                 kernel.setArg<cl_uint>(5, slice);
                 cmdQueue.enqueueNDRangeKernel(
                             kernel, cl::NullRange,
-                            cl::NDRange(batchSize, params->getLanes(),
-                                        THREADS_PER_LANE),
+                            cl::NDRange(jobs, lanes, THREADS_PER_LANE),
                             cl::NDRange(1, 1, THREADS_PER_LANE));
             }
         }
     } else {
         cmdQueue.enqueueNDRangeKernel(
                     kernel, cl::NullRange,
-                    cl::NDRange(batchSize, params->getLanes(),
-                                THREADS_PER_LANE),
-                    cl::NDRange(1, params->getLanes(), THREADS_PER_LANE));
+                    cl::NDRange(jobs, lanes, THREADS_PER_LANE),
+                    cl::NDRange(1, lanes, THREADS_PER_LANE));
     }
+}
 
-    mappedMemoryBuffer = cmdQueue.enqueueMapBuffer(
-                memoryBuffer, false, CL_MAP_READ | CL_MAP_WRITE,
-                0, memorySize, nullptr, &event);
+void ProcessingUnit::beginProcessing()
+{
+    cancelled = false;
+    for (auto &shard : shards) {
+        auto &cmdQueue = shard.cmdQueue;
+        unmapMemory(shard);
+
+        if (hasCounters()) {
+            /* the kernels only add to the counters: */
+            cmdQueue.enqueueFillBuffer<cl_ulong>(
+                        shard.debugBuffer, 0, 0,
+                        shard.jobs * params->getLanes() * countersRecordSize
+                        * sizeof(cl_ulong));
+        }
+
+        if (chunkBlocks != 0) {
+            /* keep two chunks in flight, so that the device does not idle
+             * while the host checks for cancellation between chunks: */
+            shard.nextChunk = 0;
+            while (shard.nextChunk < chunkCount && shard.nextChunk < 2) {
+                enqueueNextChunk(shard);
+            }
+            continue;
+        }
+
+        enqueueKernels(shard);
+        mapMemory(shard, false, CL_MAP_READ | CL_MAP_WRITE, &shard.event);
+        /* get each shard going before the next one is enqueued: */
+        cmdQueue.flush();
+    }
 }
 
-void ProcessingUnit::endProcessing()
+bool ProcessingUnit::endProcessing()
 {
-    event.wait();
-    event = cl::Event();
+    bool finished = true;
+    if (chunkBlocks != 0) {
+        /* advance the shards in lockstep, waiting for the oldest chunk
+         * of each in turn: */
+        bool pending = true;
+        while (pending) {
+            pending = false;
+            for (auto &shard : shards) {
+                if (shard.chunkEvents.empty()) {
+                    continue;
+                }
+                shard.chunkEvents.front().wait();
+                shard.chunkEvents.pop_front();
+                if (!cancelled && shard.nextChunk < chunkCount) {
+                    enqueueNextChunk(shard);
+                }
+                pending = true;
+            }
+        }
+        for (auto &shard : shards) {
+            if (shard.nextChunk != chunkCount) {
+                finished = false;
+            }
+            mapMemory(shard, false, CL_MAP_READ | CL_MAP_WRITE,
+                      &shard.event);
+        }
+    }
+
+    for (auto &shard : shards) {
+        shard.event.wait();
+        shard.event = cl::Event();
+
+        if (hasCounters()) {
+            auto recordsSize = params->getLanes() * countersRecordSize;
+            shard.cmdQueue.enqueueReadBuffer(
+                        shard.debugBuffer, true, 0,
+                        shard.jobs * recordsSize * sizeof(cl_ulong),
+                        counters.data() + shard.firstJob * recordsSize);
+        }
+    }
+    return finished;
 }
 
 } // namespace opencl
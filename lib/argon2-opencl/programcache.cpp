@@ -0,0 +1,268 @@
+#include "programcache.h"
+
+#include "blake2b.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "A2CLBIN1"
+#define CACHE_MAGIC_SIZE 8
+#define CACHE_KEY_SIZE 32
+
+namespace argon2 {
+namespace opencl {
+
+namespace {
+
+void hashString(Blake2b &hash, const std::string &str)
+{
+    std::uint64_t size = str.size();
+    hash.update(&size, sizeof(size));
+    hash.update(str.data(), str.size());
+}
+
+void computeKey(std::uint8_t *key, const std::vector<cl::Device> &devices,
+                const std::string &source, const std::string &options)
+{
+    Blake2b hash;
+    hash.init(CACHE_KEY_SIZE);
+    hashString(hash, source);
+    hashString(hash, options);
+    for (auto &device : devices) {
+        cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+        hashString(hash, platform.getInfo<CL_PLATFORM_NAME>());
+        hashString(hash, platform.getInfo<CL_PLATFORM_VERSION>());
+        hashString(hash, device.getInfo<CL_DEVICE_NAME>());
+        hashString(hash, device.getInfo<CL_DEVICE_VERSION>());
+        hashString(hash, device.getInfo<CL_DRIVER_VERSION>());
+    }
+    hash.final(key, CACHE_KEY_SIZE);
+}
+
+std::string getEntryPath(const std::string &directory,
+                         const std::uint8_t *key)
+{
+    static const char HEX[] = "0123456789abcdef";
+    std::string path = directory + "/";
+    for (std::size_t i = 0; i < CACHE_KEY_SIZE; i++) {
+        path += HEX[key[i] >> 4];
+        path += HEX[key[i] & 0xf];
+    }
+    return path + ".bin";
+}
+
+/* creates the directory and its parents (like mkdir -p): */
+bool makeDirectory(const std::string &path)
+{
+    std::size_t pos = 0;
+    do {
+        pos = path.find('/', pos + 1);
+        std::string prefix = path.substr(0, pos);
+        if (::mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+    } while (pos != std::string::npos);
+    return true;
+}
+
+} // anonymous namespace
+
+/*
+ * Entry layout: magic, key, number of binaries, size of each binary
+ * (64-bit), the binaries and a BLAKE2b checksum of all of the preceding
+ * data (to detect truncated or corrupted files).
+ */
+
+std::string ProgramCache::getDefaultDirectory()
+{
+    const char *dir = std::getenv("ARGON2_OPENCL_CACHE_DIR");
+    if (dir != nullptr) {
+        return dir;
+    }
+    dir = std::getenv("XDG_CACHE_HOME");
+    if (dir != nullptr && dir[0] != '\0') {
+        return std::string(dir) + "/argon2-opencl";
+    }
+    dir = std::getenv("HOME");
+    if (dir != nullptr && dir[0] != '\0') {
+        return std::string(dir) + "/.cache/argon2-opencl";
+    }
+    return "";
+}
+
+bool ProgramCache::load(const std::string &directory,
+                        const cl::Context &context,
+                        const std::string &source, const std::string &options,
+                        cl::Program &program)
+{
+    if (directory.empty()) {
+        return false;
+    }
+
+    auto devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    std::uint8_t key[CACHE_KEY_SIZE];
+    computeKey(key, devices, source, options);
+
+    std::vector<char> data;
+    {
+        std::ifstream file(getEntryPath(directory, key), std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+    }
+
+    std::size_t headerSize = CACHE_MAGIC_SIZE + CACHE_KEY_SIZE
+            + sizeof(std::uint32_t);
+    if (data.size() < headerSize + CACHE_KEY_SIZE) {
+        return false;
+    }
+    std::size_t payloadEnd = data.size() - CACHE_KEY_SIZE;
+
+    std::uint8_t checksum[CACHE_KEY_SIZE];
+    Blake2b hash;
+    hash.init(CACHE_KEY_SIZE);
+    hash.update(data.data(), payloadEnd);
+    hash.final(checksum, CACHE_KEY_SIZE);
+    if (std::memcmp(checksum, data.data() + payloadEnd, CACHE_KEY_SIZE) != 0 ||
+            std::memcmp(data.data(), CACHE_MAGIC, CACHE_MAGIC_SIZE) != 0 ||
+            std::memcmp(data.data() + CACHE_MAGIC_SIZE, key,
+                        CACHE_KEY_SIZE) != 0) {
+        return false;
+    }
+
+    std::uint32_t count;
+    std::memcpy(&count, data.data() + CACHE_MAGIC_SIZE + CACHE_KEY_SIZE,
+                sizeof(count));
+    if (count != devices.size() ||
+            headerSize + count * sizeof(std::uint64_t) > payloadEnd) {
+        return false;
+    }
+
+    cl::Program::Binaries binaries;
+    const char *sizes = data.data() + headerSize;
+    std::size_t pos = headerSize + count * sizeof(std::uint64_t);
+    for (std::uint32_t i = 0; i < count; i++) {
+        std::uint64_t size;
+        std::memcpy(&size, sizes + i * sizeof(size), sizeof(size));
+        if (size > payloadEnd - pos) {
+            return false;
+        }
+        binaries.push_back(std::make_pair(data.data() + pos,
+                                          (std::size_t)size));
+        pos += size;
+    }
+    if (pos != payloadEnd) {
+        return false;
+    }
+
+    try {
+        cl::Program prog(context, devices, binaries);
+        prog.build(devices, options.c_str());
+        program = prog;
+    } catch (const cl::Error &) {
+        /* stale or foreign binary -- rebuild from source */
+        return false;
+    }
+    return true;
+}
+
+void ProgramCache::store(const std::string &directory,
+                         const cl::Context &context,
+                         const std::string &source, const std::string &options,
+                         const cl::Program &program)
+{
+    if (directory.empty()) {
+        return;
+    }
+
+    auto devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    std::uint8_t key[CACHE_KEY_SIZE];
+    computeKey(key, devices, source, options);
+
+    /* the binaries are in the order of CL_PROGRAM_DEVICES, which is the
+     * order of the context's devices: */
+    std::vector<std::size_t> sizes;
+    std::vector<std::unique_ptr<unsigned char[]>> binaries;
+    std::vector<unsigned char *> binaryPtrs;
+    try {
+        sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+    } catch (const cl::Error &) {
+        return;
+    }
+    if (sizes.size() != devices.size()) {
+        return;
+    }
+    for (auto size : sizes) {
+        if (size == 0) {
+            return;
+        }
+        binaries.emplace_back(new unsigned char[size]);
+        binaryPtrs.push_back(binaries.back().get());
+    }
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES,
+                         binaryPtrs.size() * sizeof(unsigned char *),
+                         binaryPtrs.data(), nullptr) != CL_SUCCESS) {
+        return;
+    }
+
+    std::vector<char> data(CACHE_MAGIC, CACHE_MAGIC + CACHE_MAGIC_SIZE);
+    data.insert(data.end(), key, key + CACHE_KEY_SIZE);
+    std::uint32_t count = sizes.size();
+    auto countBytes = reinterpret_cast<const char *>(&count);
+    data.insert(data.end(), countBytes, countBytes + sizeof(count));
+    for (auto size : sizes) {
+        std::uint64_t size64 = size;
+        auto sizeBytes = reinterpret_cast<const char *>(&size64);
+        data.insert(data.end(), sizeBytes, sizeBytes + sizeof(size64));
+    }
+    for (std::size_t i = 0; i < sizes.size(); i++) {
+        data.insert(data.end(), binaries[i].get(),
+                    binaries[i].get() + sizes[i]);
+    }
+    std::uint8_t checksum[CACHE_KEY_SIZE];
+    Blake2b hash;
+    hash.init(CACHE_KEY_SIZE);
+    hash.update(data.data(), data.size());
+    hash.final(checksum, CACHE_KEY_SIZE);
+    data.insert(data.end(), checksum, checksum + CACHE_KEY_SIZE);
+
+    if (!makeDirectory(directory)) {
+        return;
+    }
+
+    /* write to a temporary file first, so that concurrent readers
+     * never see a partial entry (programs may be built by several
+     * threads at once, hence the counter): */
+    static std::atomic<unsigned int> tmpCounter(0);
+    auto path = getEntryPath(directory, key);
+    auto tmpPath = path + ".tmp" + std::to_string(::getpid())
+            + "." + std::to_string(tmpCounter++);
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), data.size());
+        if (!file) {
+            file.close();
+            std::remove(tmpPath.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+    }
+}
+
+} // namespace opencl
+} // namespace argon2
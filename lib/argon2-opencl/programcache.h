@@ -0,0 +1,48 @@
+#ifndef ARGON2_OPENCL_PROGRAMCACHE_H
+#define ARGON2_OPENCL_PROGRAMCACHE_H
+
+#include "opencl.h"
+
+#include <string>
+
+namespace argon2 {
+namespace opencl {
+
+/*
+ * On-disk cache of built program binaries. An entry is keyed by
+ * the program source, the build options and the name, version, driver
+ * version and platform of each device, so any change of these simply
+ * results in a cache miss.
+ */
+namespace ProgramCache
+{
+    /*
+     * Returns the directory given by the ARGON2_OPENCL_CACHE_DIR
+     * environment variable, or $XDG_CACHE_HOME/argon2-opencl, or
+     * $HOME/.cache/argon2-opencl. An empty string (e.g. when
+     * ARGON2_OPENCL_CACHE_DIR is set to an empty value) disables
+     * the cache.
+     */
+    std::string getDefaultDirectory();
+
+    /*
+     * Creates the program from the cached binaries and builds it.
+     * Returns false if there is no usable entry.
+     */
+    bool load(const std::string &directory, const cl::Context &context,
+              const std::string &source, const std::string &options,
+              cl::Program &program);
+
+    /*
+     * Stores the binaries of a built program. Failures are ignored,
+     * since the cache is only an optimization.
+     */
+    void store(const std::string &directory, const cl::Context &context,
+               const std::string &source, const std::string &options,
+               const cl::Program &program);
+};
+
+} // namespace opencl
+} // namespace argon2
+
+#endif // ARGON2_OPENCL_PROGRAMCACHE_H
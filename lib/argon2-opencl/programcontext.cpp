@@ -2,24 +2,69 @@
 
 #include "kernelloader.h"
 
+#include <cstdlib>
+
 namespace argon2 {
 namespace opencl {
 
 ProgramContext::ProgramContext(
         const GlobalContext *globalContext,
         const std::vector<Device> &devices,
-        Type type, Version version)
-    : globalContext(globalContext), devices(), type(type), version(version)
+        Type type, Version version, unsigned int kernelFlags)
+    : globalContext(globalContext), devices(), type(type), version(version),
+      kernelFlags(kernelFlags)
 {
+    if (kernelFlags & KERNEL_REGISTER_STATE) {
+        this->kernelFlags &= ~KERNEL_VECTOR_ACCESS;
+    }
+    if (kernelFlags & KERNEL_SPLIT_LANES) {
+        this->kernelFlags &= ~KERNEL_GLOBAL_SCRATCH;
+    }
+
     this->devices.reserve(devices.size());
     for (auto &device : devices) {
         this->devices.push_back(device.getCLDevice());
     }
     context = cl::Context(this->devices);
 
+    /* the kernel may be overridden from a directory (e.g. when working
+     * on it), otherwise the one built into the library is used: */
+    const char *dir = std::getenv("ARGON2_OPENCL_KERNEL_DIR");
+    if (dir != nullptr) {
+        sourceDirectory = dir;
+    }
     program = KernelLoader::loadArgon2Program(
-                // FIXME path:
-                context, "./data/kernels", type, version);
+                context, sourceDirectory, type, version,
+                this->kernelFlags);
+}
+
+const cl::Program &ProgramContext::getGlobalScratchProgram() const
+{
+    if (kernelFlags & KERNEL_GLOBAL_SCRATCH) {
+        return program;
+    }
+    std::call_once(globalScratchBuilt,
+                   &ProgramContext::buildGlobalScratchProgram, this);
+    return globalScratchProgram;
+}
+
+void ProgramContext::buildGlobalScratchProgram() const
+{
+    globalScratchProgram = KernelLoader::loadArgon2Program(
+                context, sourceDirectory, type, version,
+                (kernelFlags & ~KERNEL_SPLIT_LANES) | KERNEL_GLOBAL_SCRATCH);
+}
+
+unsigned int ProgramContext::getPreferredKernelFlags(const Device &device)
+{
+    unsigned int flags = 0;
+    /* wide accesses only pay off on devices that natively operate on
+     * vectors of 64-bit integers (typically CPUs); on GPUs the default
+     * per-qword access is already perfectly coalesced: */
+    if (device.getProperties().nativeVectorWidthLong > 1) {
+        flags |= KERNEL_VECTOR_ACCESS;
+    }
+    return flags;
 }
 
 } // namespace opencl
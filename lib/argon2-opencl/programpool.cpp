@@ -0,0 +1,43 @@
+#include "programpool.h"
+
+namespace argon2 {
+namespace opencl {
+
+ProgramPool::~ProgramPool()
+{
+    for (auto &entry : programs) {
+        entry.second.wait();
+    }
+}
+
+ProgramPool::Handle ProgramPool::get(
+        const std::vector<Device> &devices, Type type, Version version,
+        unsigned int kernelFlags)
+{
+    std::vector<cl_device_id> ids;
+    ids.reserve(devices.size());
+    for (auto &device : devices) {
+        ids.push_back(device.getCLDevice()());
+    }
+    Key key(std::move(ids), type, version, kernelFlags);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = programs.find(key);
+    if (it != programs.end()) {
+        return it->second;
+    }
+
+    auto globalContext = this->globalContext;
+    Handle handle = std::async(
+                std::launch::async,
+                [globalContext, devices, type, version, kernelFlags] {
+        return std::shared_ptr<const ProgramContext>(
+                    new ProgramContext(globalContext, devices,
+                                       type, version, kernelFlags));
+    }).share();
+    programs.emplace(std::move(key), handle);
+    return handle;
+}
+
+} // namespace opencl
+} // namespace argon2
@@ -0,0 +1,229 @@
+#include "streamingunit.h"
+
+#include "kernellayout.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace argon2 {
+namespace opencl {
+
+StreamingUnit::StreamingUnit(
+        const ProgramContext *programContext, const Argon2Params *params,
+        const Device *device, std::size_t slotCount,
+        std::size_t maxWorkGroups)
+    : programContext(programContext), params(params), device(device),
+      slotCount(slotCount), maxWorkGroups(maxWorkGroups),
+      queueStart(0), nextJobId(0)
+{
+    auto &clContext = programContext->getContext();
+    auto lanes = params->getLanes();
+
+    if (programContext->getKernelFlags() &
+            (KERNEL_SPLIT_LANES | KERNEL_GLOBAL_SCRATCH)) {
+        throw std::logic_error(
+                    "StreamingUnit: programs built with KERNEL_SPLIT_LANES"
+                    " or KERNEL_GLOBAL_SCRATCH have no stream kernel");
+    }
+
+    auto localMemSize = (std::size_t)lanes * ARGON2_BLOCK_SIZE;
+    if (programContext->getArgon2Type() == ARGON2_I) {
+        localMemSize *= 3;
+    } else {
+        localMemSize *= 2;
+    }
+
+    /* all lanes of a job are computed by one work-group: */
+    kernel = cl::Kernel(programContext->getProgram(),
+                        "argon2_kernel_oneshot_stream");
+    auto maxWorkGroupSize = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(
+                device->getCLDevice());
+    if (lanes * THREADS_PER_LANE > maxWorkGroupSize) {
+        throw std::length_error(
+                    "StreamingUnit: the " + std::to_string(lanes)
+                    + " lanes of a job do not fit into one work-group on "
+                    + device->getName());
+    }
+    if (localMemSize > device->getProperties().localMemSize) {
+        throw std::length_error(
+                    "StreamingUnit: the working blocks of "
+                    + std::to_string(lanes)
+                    + " lanes do not fit into the local memory of "
+                    + device->getName());
+    }
+
+    cmdQueue = cl::CommandQueue(clContext, device->getCLDevice());
+
+    /* the kernel addresses all slots in one buffer, so they cannot
+     * be sharded: */
+    auto shards = MemoryPlanner::planShards(
+                *device, params->getMemorySize(), slotCount);
+    if (shards.size() > 1) {
+        throw std::length_error(
+                    "StreamingUnit: the memory of " + std::to_string(slotCount)
+                    + " slots does not fit into one allocation on "
+                    + device->getName());
+    }
+    memoryBuffer = cl::Buffer(clContext, CL_MEM_READ_WRITE,
+                              params->getMemorySize() * slotCount);
+    queueBuffer = cl::Buffer(clContext, CL_MEM_READ_ONLY,
+                             slotCount * sizeof(cl_uint));
+    headBuffer = cl::Buffer(clContext, CL_MEM_READ_WRITE, sizeof(cl_uint));
+
+    kernel.setArg<cl::Buffer>(0, memoryBuffer);
+    kernel.setArg<cl::LocalSpaceArg>(1, { localMemSize });
+    kernel.setArg<cl::Buffer>(2, queueBuffer);
+    kernel.setArg<cl::Buffer>(3, headBuffer);
+    kernel.setArg<cl_uint>(4, slotCount);
+    kernel.setArg<cl_uint>(7, params->getTimeCost());
+    kernel.setArg<cl_uint>(8, lanes);
+    kernel.setArg<cl_uint>(9, params->getSegmentBlocks());
+
+    if (programContext->getKernelFlags() & KERNEL_COUNTERS) {
+        /* the counters are not collected here (use ProcessingUnit for
+         * that), but the kernel still needs somewhere to write them: */
+        auto recordSize = getCountersRecordSize(params->getTimeCost());
+        auto countersSize = slotCount * lanes * recordSize * sizeof(cl_ulong);
+        countersBuffer = cl::Buffer(clContext, CL_MEM_READ_WRITE,
+                                    countersSize);
+        kernel.setArg<cl::Buffer>(10, countersBuffer);
+    }
+
+    freeSlots.reserve(slotCount);
+    for (std::size_t i = slotCount; i > 0; i--) {
+        freeSlots.push_back(i - 1);
+    }
+}
+
+std::uint64_t StreamingUnit::submit(const void *pw, std::size_t pwSize)
+{
+    if (freeSlots.empty()) {
+        throw std::logic_error("StreamingUnit: no free slot");
+    }
+
+    Job job;
+    job.id = nextJobId++;
+    job.slot = freeSlots.back();
+    freeSlots.pop_back();
+
+    /* the first two blocks of each lane, with the lanes packed together: */
+    auto lanes = params->getLanes();
+    job.seed.reset(new std::uint8_t[lanes * 2 * ARGON2_BLOCK_SIZE]);
+    params->fillFirstBlocks(job.seed.get(), pw, pwSize,
+                            programContext->getArgon2Type(),
+                            programContext->getArgon2Version(), 2);
+
+    cl::size_t<3> bufferOffset, hostOffset, region;
+    bufferOffset[0] = job.slot * params->getMemorySize();
+    bufferOffset[1] = bufferOffset[2] = 0;
+    hostOffset[0] = hostOffset[1] = hostOffset[2] = 0;
+    region[0] = 2 * ARGON2_BLOCK_SIZE;
+    region[1] = lanes;
+    region[2] = 1;
+    cmdQueue.enqueueWriteBufferRect(
+                memoryBuffer, false, bufferOffset, hostOffset, region,
+                params->getLaneBlocks() * ARGON2_BLOCK_SIZE, 0,
+                2 * ARGON2_BLOCK_SIZE, 0, job.seed.get());
+
+    pending.push_back(std::move(job));
+    return pending.back().id;
+}
+
+void StreamingUnit::flush()
+{
+    if (pending.empty()) {
+        return;
+    }
+
+    auto lanes = params->getLanes();
+    auto count = pending.size();
+
+    Batch batch;
+    batch.jobs = std::move(pending);
+    pending.clear();
+    batch.harvested = 0;
+
+    /* append the jobs' slots to the ring buffer: */
+    batch.slots.reserve(count);
+    for (auto &job : batch.jobs) {
+        batch.slots.push_back(job.slot);
+    }
+    auto firstPart = std::min(count, slotCount - queueStart);
+    cmdQueue.enqueueWriteBuffer(
+                queueBuffer, false, queueStart * sizeof(cl_uint),
+                firstPart * sizeof(cl_uint), batch.slots.data());
+    if (firstPart < count) {
+        cmdQueue.enqueueWriteBuffer(
+                    queueBuffer, false, 0, (count - firstPart) * sizeof(cl_uint),
+                    batch.slots.data() + firstPart);
+    }
+    cmdQueue.enqueueFillBuffer<cl_uint>(headBuffer, 0, 0, sizeof(cl_uint));
+
+    std::size_t groups = count;
+    if (maxWorkGroups != 0 && groups > maxWorkGroups) {
+        groups = maxWorkGroups;
+    }
+    kernel.setArg<cl_uint>(5, queueStart);
+    kernel.setArg<cl_uint>(6, count);
+    cmdQueue.enqueueNDRangeKernel(
+                kernel, cl::NullRange,
+                cl::NDRange(groups, lanes, THREADS_PER_LANE),
+                cl::NDRange(1, lanes, THREADS_PER_LANE));
+    queueStart = (queueStart + count) % slotCount;
+
+    /* read back the last block of each lane: */
+    auto jobBlocksSize = lanes * ARGON2_BLOCK_SIZE;
+    batch.lastBlocks.reset(new std::uint8_t[count * jobBlocksSize]);
+    cl::size_t<3> bufferOffset, hostOffset, region;
+    bufferOffset[1] = bufferOffset[2] = 0;
+    hostOffset[0] = hostOffset[1] = hostOffset[2] = 0;
+    region[0] = ARGON2_BLOCK_SIZE;
+    region[1] = lanes;
+    region[2] = 1;
+    for (std::size_t i = 0; i < count; i++) {
+        bufferOffset[0] = batch.jobs[i].slot * params->getMemorySize()
+                + (params->getLaneBlocks() - 1) * ARGON2_BLOCK_SIZE;
+        cmdQueue.enqueueReadBufferRect(
+                    memoryBuffer, false, bufferOffset, hostOffset, region,
+                    params->getLaneBlocks() * ARGON2_BLOCK_SIZE, 0,
+                    ARGON2_BLOCK_SIZE, 0,
+                    batch.lastBlocks.get() + i * jobBlocksSize,
+                    nullptr, i + 1 == count ? &batch.event : nullptr);
+    }
+    cmdQueue.flush();
+
+    batches.push_back(std::move(batch));
+}
+
+bool StreamingUnit::harvest(std::uint64_t &jobId, void *hash, bool wait)
+{
+    if (batches.empty()) {
+        return false;
+    }
+
+    auto &batch = batches.front();
+    if (batch.harvested == 0) {
+        if (wait) {
+            batch.event.wait();
+        } else if (batch.event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>()
+                   != CL_COMPLETE) {
+            return false;
+        }
+    }
+
+    auto &job = batch.jobs[batch.harvested];
+    params->finalize(hash, batch.lastBlocks.get()
+                     + batch.harvested * params->getLanes() * ARGON2_BLOCK_SIZE,
+                     1);
+    jobId = job.id;
+    freeSlots.push_back(job.slot);
+
+    if (++batch.harvested == batch.jobs.size()) {
+        batches.pop_front();
+    }
+    return true;
+}
+
+} // namespace opencl
+} // namespace argon2
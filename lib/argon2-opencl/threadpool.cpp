@@ -0,0 +1,182 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace argon2 {
+namespace cpu {
+
+/* parses a list like "0-3,8-11" from sysfs: */
+static std::vector<unsigned int> parseCpuList(const std::string &list)
+{
+    std::vector<unsigned int> cpus;
+    std::istringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        unsigned int first, last;
+        char dash;
+        std::istringstream rangeStream(range);
+        if (!(rangeStream >> first)) {
+            continue;
+        }
+        if (!(rangeStream >> dash >> last) || dash != '-') {
+            last = first;
+        }
+        for (unsigned int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<ThreadPool::NumaNode> ThreadPool::getNumaNodes()
+{
+    std::vector<NumaNode> nodes;
+#ifdef __linux__
+    const std::string prefix = "/sys/devices/system/node/";
+
+    std::ifstream onlineFile(prefix + "online");
+    std::string online;
+    if (!std::getline(onlineFile, online)) {
+        return nodes;
+    }
+    for (unsigned int id : parseCpuList(online)) {
+        std::ifstream cpuListFile(
+                    prefix + "node" + std::to_string(id) + "/cpulist");
+        std::string cpuList;
+        std::getline(cpuListFile, cpuList);
+
+        NumaNode node;
+        node.id = (int)id;
+        node.cpus = parseCpuList(cpuList);
+        /* memory-only nodes have no CPUs: */
+        if (!node.cpus.empty()) {
+            nodes.push_back(std::move(node));
+        }
+    }
+#endif
+    return nodes;
+}
+
+ThreadPool::ThreadPool(std::size_t threadCount)
+    : stopping(false), callerHelps(true)
+{
+    if (threadCount == 0) {
+        threadCount = std::max<std::size_t>(
+                    1, std::thread::hardware_concurrency());
+    }
+    /* the calling thread is the last one: */
+    for (std::size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(&ThreadPool::workerMain, this);
+    }
+}
+
+ThreadPool::ThreadPool(const std::vector<unsigned int> &cpus)
+    : stopping(false), callerHelps(false)
+{
+    for (unsigned int cpu : cpus) {
+        threads.emplace_back(&ThreadPool::pinnedWorkerMain, this, cpu);
+    }
+    if (threads.empty()) {
+        callerHelps = true;
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+bool ThreadPool::runNext(std::unique_lock<std::mutex> &lock)
+{
+    if (loops.empty()) {
+        return false;
+    }
+
+    /* a loop leaves the queue as soon as its last iteration is taken,
+     * since its owner may return right after that iteration finishes: */
+    Loop *loop = loops.front();
+    std::size_t index = loop->next++;
+    if (loop->next == loop->count) {
+        loops.pop_front();
+    }
+    lock.unlock();
+    (*loop->task)(index);
+    lock.lock();
+    if (++loop->finished == loop->count) {
+        loopFinished.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerMain()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        if (!runNext(lock)) {
+            if (stopping) {
+                return;
+            }
+            workAvailable.wait(lock);
+        }
+    }
+}
+
+void ThreadPool::pinnedWorkerMain(unsigned int cpu)
+{
+#ifdef __linux__
+    if (cpu < CPU_SETSIZE) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        /* a failure (e.g. an offline CPU) only costs performance: */
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)cpu;
+#endif
+    workerMain();
+}
+
+void ThreadPool::parallelFor(std::size_t count,
+                             const std::function<void(std::size_t)> &task)
+{
+    if (count == 0) {
+        return;
+    }
+
+    Loop loop;
+    loop.task = &task;
+    loop.count = count;
+    loop.next = 0;
+    loop.finished = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    loops.push_back(&loop);
+    if (count > 1 || !callerHelps) {
+        workAvailable.notify_all();
+    }
+    /* help with our own loop (and the ones queued before it): */
+    while (callerHelps && loop.next != loop.count && runNext(lock)) {
+    }
+    while (loop.finished != loop.count) {
+        loopFinished.wait(lock);
+    }
+}
+
+} // namespace cpu
+} // namespace argon2
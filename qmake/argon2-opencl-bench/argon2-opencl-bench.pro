@@ -7,11 +7,13 @@ LIBS += -lOpenCL
 
 SOURCES += \
     ../../src/argon2-opencl-bench/main.cpp \
-    ../../src/argon2-opencl-bench/benchmark.cpp
+    ../../src/argon2-opencl-bench/benchmark.cpp \
+    ../../src/argon2-opencl-bench/memorycounters.cpp
 
 HEADERS += \
     ../../src/argon2-opencl-bench/runtimestatistics.h \
-    ../../src/argon2-opencl-bench/benchmark.h
+    ../../src/argon2-opencl-bench/benchmark.h \
+    ../../src/argon2-opencl-bench/memorycounters.h
 win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../argon2-opencl/release/ -largon2-opencl
 else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../argon2-opencl/debug/ -largon2-opencl
 else:unix: LIBS += -L$$OUT_PWD/../argon2-opencl/ -largon2-opencl
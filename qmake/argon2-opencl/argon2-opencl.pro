@@ -18,9 +18,19 @@ LIBS += -lOpenCL
 SOURCES += \
     ../../lib/argon2-opencl/globalcontext.cpp \
     ../../lib/argon2-opencl/programcontext.cpp \
+    ../../lib/argon2-opencl/programpool.cpp \
+    ../../lib/argon2-opencl/dispatcher.cpp \
+    ../../lib/argon2-opencl/memoryplanner.cpp \
     ../../lib/argon2-opencl/processingunit.cpp \
+    ../../lib/argon2-opencl/streamingunit.cpp \
+    ../../lib/argon2-opencl/threadpool.cpp \
+    ../../lib/argon2-opencl/cpukernel.cpp \
+    ../../lib/argon2-opencl/cpuimplementation.cpp \
+    ../../lib/argon2-opencl/cpuprocessingunit.cpp \
+    ../../lib/argon2-opencl/memorypool.cpp \
     ../../lib/argon2-opencl/device.cpp \
     ../../lib/argon2-opencl/kernelloader.cpp \
+    ../../lib/argon2-opencl/programcache.cpp \
     ../../lib/argon2-opencl/argon2params.cpp \
     ../../lib/argon2-opencl/blake2b.cpp
 
@@ -29,10 +39,22 @@ HEADERS += \
     ../../include/argon2-opencl/opencl.h \
     ../../include/argon2-opencl/device.h \
     ../../include/argon2-opencl/programcontext.h \
+    ../../include/argon2-opencl/programpool.h \
+    ../../include/argon2-opencl/dispatcher.h \
+    ../../include/argon2-opencl/memoryplanner.h \
     ../../include/argon2-opencl/globalcontext.h \
     ../../include/argon2-opencl/processingunit.h \
+    ../../include/argon2-opencl/streamingunit.h \
+    ../../include/argon2-opencl/threadpool.h \
+    ../../include/argon2-opencl/cpuimplementation.h \
+    ../../include/argon2-opencl/cpuprocessingunit.h \
+    ../../include/argon2-opencl/memorypool.h \
     ../../include/argon2-opencl/argon2-common.h\
     ../../lib/argon2-opencl/kernelloader.h \
+    ../../lib/argon2-opencl/kernellayout.h \
+    ../../lib/argon2-opencl/programcache.h \
+    ../../lib/argon2-opencl/embeddedkernels.h \
+    ../../lib/argon2-opencl/cpukernel.h \
     ../../include/argon2-opencl/argon2params.h \
     ../../lib/argon2-opencl/blake2b.h
 
@@ -1,7 +1,27 @@
 #include "benchmark.h"
 
+#include "memorycounters.h"
+
+#include "argon2-opencl/programpool.h"
+
 #include <iostream>
 
+std::size_t BenchmarkDirector::getMemoryTrafficPerHash() const
+{
+    argon2::Argon2Params params(32, nullptr, 0, nullptr, 0, nullptr, 0,
+                                t_cost, m_cost, lanes);
+
+    std::size_t laneBlocks = params.getLaneBlocks();
+    /* every computed block reads its reference block and is written back;
+     * in version 1.3, later passes also read the overwritten block: */
+    std::size_t blocks = (laneBlocks * t_cost - 2) * lanes;
+    std::size_t transfers = blocks * 2;
+    if (version != argon2::ARGON2_VERSION_10) {
+        transfers += laneBlocks * (t_cost - 1) * lanes;
+    }
+    return transfers * argon2::ARGON2_BLOCK_SIZE;
+}
+
 int BenchmarkDirector::runBenchmark(Argon2Runner &runner) const
 {
     DummyPasswordGenerator pwGen;
@@ -31,6 +51,12 @@ int BenchmarkDirector::runBenchmark(Argon2Runner &runner) const
         std::cout << "Mean deviation (per hash): "
                   << RunTimeStats::repr((nanosecs)perHash.getMeanDeviation())
                   << std::endl;
+
+        double bytes = (double)getMemoryTrafficPerHash() * batchSize;
+        std::cout << "Effective memory bandwidth: "
+                  << bytes / RunTimeStats::toSeconds(time.getMean())
+                     / (1024 * 1024 * 1024)
+                  << " GiB/s" << std::endl;
         return 0;
     }
 
@@ -65,11 +91,16 @@ int BenchmarkDirector::runBenchmark(Argon2Runner &runner) const
 OpenCLExecutive::Runner::Runner(
         const BenchmarkDirector &director,
         const argon2::opencl::Device &device,
-        const argon2::opencl::ProgramContext &pc)
+        const argon2::opencl::ProgramContext &pc,
+        bool bySegment, bool allowLocalMemory, bool allowPersistent,
+        std::size_t chunkBlocks, bool allowCpuKernel,
+        std::size_t queueCount)
     : params(HASH_LENGTH, NULL, 0, NULL, 0, NULL, 0,
              director.getTimeCost(), director.getMemoryCost(),
              director.getLanes()),
-      unit(&pc, &params, &device, director.getBatchSize())
+      unit(&pc, &params, &device, director.getBatchSize(),
+           bySegment, allowLocalMemory, allowPersistent, chunkBlocks,
+           allowCpuKernel, queueCount)
 {
 }
 
@@ -113,6 +144,23 @@ nanosecs OpenCLExecutive::Runner::runBenchmark(
     }
     clock_type::time_point checkpt3 = clock_type::now();
 
+    if (beVerbose && unit.hasCounters()) {
+        /* show the first job only, the others behave the same: */
+        for (std::size_t lane = 0; lane < director.getLanes(); lane++) {
+            auto counters = unit.getCounters(0, lane);
+            std::cout << "    Lane " << lane << ": "
+                      << counters.blocks << " blocks, "
+                      << counters.crossLaneRefs << " cross-lane refs, "
+                      << counters.addressBlocks << " address blocks";
+            auto segments = counters.segmentStart.size();
+            if (segments != 0 && counters.segmentEnd[segments - 1] != 0) {
+                std::cout << ", " << counters.segmentEnd[segments - 1]
+                             - counters.segmentStart[0] << " clocks";
+            }
+            std::cout << std::endl;
+        }
+    }
+
     if (beVerbose) {
         clock_type::duration wrTime = checkpt1 - checkpt0;
         auto wrTimeNs = toNanoseconds(wrTime);
@@ -140,31 +188,388 @@ int OpenCLExecutive::runBenchmark(const BenchmarkDirector &director) const
 {
     using namespace argon2::opencl;
 
-    GlobalContext global;
-    auto &devices = global.getAllDevices();
-
     if (listDevices) {
+        GlobalContext global(filter);
         std::size_t i = 0;
-        for (auto &device : devices) {
+        for (auto &device : global.getAllDevices()) {
             std::cout << "Device #" << i << ": "
                       << device.getInfo() << std::endl;
             i++;
         }
         return 0;
     }
-    if (deviceIndex > devices.size()) {
+    if (allDevices) {
+        return runOnAllDevices(director);
+    }
+
+    /* discover only the device that we are going to use: */
+    auto deviceFilter = filter;
+    deviceFilter.indices = { deviceIndex };
+    GlobalContext global(deviceFilter);
+    auto &devices = global.getAllDevices();
+    if (devices.empty()) {
         std::cerr << director.getProgname()
-                  << ": device index out of range: "
-                  << deviceIndex << std::endl;
+                  << ": no device #" << deviceIndex << " found" << std::endl;
         return 1;
     }
-    auto &device = devices[deviceIndex];
+    auto &device = devices[0];
     if (director.isVerbose()) {
         std::cout << "Using device #" << deviceIndex << ": "
                   << device.getInfo() << std::endl;
     }
+    auto flags = kernelFlags;
+    flags |= ProgramContext::getPreferredKernelFlags(device) & autoKernelFlags;
     ProgramContext pc(&global, { device },
-                      director.getType(), director.getVersion());
-    Runner runner(director, device, pc);
+                      director.getType(), director.getVersion(), flags);
+    if (director.isVerbose()) {
+        std::cout << "Vector access: "
+                  << (pc.getKernelFlags() & KERNEL_VECTOR_ACCESS ? "yes" : "no")
+                  << std::endl;
+    }
+    Runner runner(director, device, pc, bySegment, allowLocalMemory,
+                  allowPersistent, chunkBlocks, allowCpuKernel, queueCount);
+    if (director.isVerbose() && runner.getUnit().isCpuKernel()) {
+        std::cout << "Using the kernel for CPU devices" << std::endl;
+    }
+    if (director.isVerbose() && runner.getUnit().isLocalMemoryResident()) {
+        std::cout << "Keeping hash memory in local memory" << std::endl;
+    }
+    if (director.isVerbose() && runner.getUnit().isGlobalScratch()) {
+        std::cout << "Keeping the working blocks in global memory"
+                  << std::endl;
+    }
+    if (director.isVerbose() && runner.getUnit().isPersistent()) {
+        std::cout << "Using a single kernel launch per batch" << std::endl;
+    }
+    if (director.isVerbose() && runner.getUnit().getQueueCount() > 1) {
+        std::cout << "Splitting each batch between "
+                  << runner.getUnit().getQueueCount()
+                  << " command queues" << std::endl;
+    }
     return director.runBenchmark(runner);
 }
+
+OpenCLExecutive::DispatchRunner::DispatchRunner(
+        const BenchmarkDirector &director,
+        const std::vector<argon2::opencl::Device> &devices,
+        const std::vector<const argon2::opencl::ProgramContext *> &programs,
+        std::size_t unitsPerDevice,
+        bool bySegment, bool allowLocalMemory, bool allowPersistent,
+        std::size_t chunkBlocks, bool allowCpuKernel,
+        std::size_t queueCount, bool withCpu, std::size_t cpuThreads,
+        argon2::cpu::Implementation cpuImpl)
+    : params(HASH_LENGTH, NULL, 0, NULL, 0, NULL, 0,
+             director.getTimeCost(), director.getMemoryCost(),
+             director.getLanes()),
+      dispatcher(&params), passwords(director.getBatchSize())
+{
+    using namespace argon2::opencl;
+
+    /* about two batches per unit, so that there is something
+     * left to steal near the end of each sample: */
+    std::size_t unitCount = devices.size() * unitsPerDevice + (withCpu ? 1 : 0);
+    std::size_t unitBatchSize = (director.getBatchSize() + 2 * unitCount - 1)
+            / (2 * unitCount);
+    for (std::size_t i = 0; i < devices.size(); i++) {
+        for (std::size_t k = 0; k < unitsPerDevice; k++) {
+            dispatcher.addUnit(std::unique_ptr<ProcessingUnit>(
+                    new ProcessingUnit(programs[i], &params, &devices[i],
+                                       unitBatchSize, bySegment,
+                                       allowLocalMemory, allowPersistent,
+                                       chunkBlocks, allowCpuKernel,
+                                       queueCount)));
+        }
+    }
+    if (withCpu) {
+        cpuPool.reset(new argon2::cpu::ThreadPool(cpuThreads));
+        dispatcher.addUnit(std::unique_ptr<argon2::cpu::ProcessingUnit>(
+                new argon2::cpu::ProcessingUnit(
+                    &params, director.getType(), director.getVersion(),
+                    cpuPool.get(), unitBatchSize, cpuImpl)));
+    }
+}
+
+nanosecs OpenCLExecutive::DispatchRunner::runBenchmark(
+        const BenchmarkDirector &director, PasswordGenerator &pwGen)
+{
+    typedef std::chrono::steady_clock clock_type;
+
+    for (auto &password : passwords) {
+        const void *pw;
+        std::size_t pwLength;
+        pwGen.nextPassword(pw, pwLength);
+        password.assign(static_cast<const char *>(pw), pwLength);
+    }
+
+    clock_type::time_point checkpt0 = clock_type::now();
+    dispatcher.run(
+                passwords.size(),
+                [this](std::size_t index, const void *&pw, std::size_t &pwSize) {
+        pw = passwords[index].data();
+        pwSize = passwords[index].size();
+    }, [](std::size_t, const void *) { });
+    clock_type::time_point checkpt1 = clock_type::now();
+
+    auto compTimeNs = toNanoseconds(checkpt1 - checkpt0);
+    if (director.isVerbose()) {
+        std::cout << "    Computation took "
+                  << RunTimeStats::repr(compTimeNs) << std::endl;
+    }
+    return compTimeNs;
+}
+
+int OpenCLExecutive::runOnAllDevices(const BenchmarkDirector &director) const
+{
+    using namespace argon2::opencl;
+
+    GlobalContext global(filter);
+    auto &devices = global.getAllDevices();
+    if (devices.empty()) {
+        std::cerr << director.getProgname()
+                  << ": no devices found" << std::endl;
+        return 1;
+    }
+
+    /* each device gets its own program, built in parallel: */
+    ProgramPool pool(&global);
+    std::vector<ProgramPool::Handle> handles;
+    for (auto &device : devices) {
+        auto flags = kernelFlags;
+        flags |= ProgramContext::getPreferredKernelFlags(device)
+                & autoKernelFlags;
+        handles.push_back(pool.get({ device }, director.getType(),
+                                   director.getVersion(), flags));
+    }
+    std::vector<const ProgramContext *> programs;
+    for (auto &handle : handles) {
+        programs.push_back(handle.get().get());
+    }
+
+    if (director.isVerbose()) {
+        std::cout << "Using " << devices.size() << " device(s) with "
+                  << unitsPerDevice << " unit(s) each"
+                  << (withCpu ? ", plus the host CPU" : "") << std::endl;
+    }
+    DispatchRunner runner(director, devices, programs, unitsPerDevice,
+                          bySegment, allowLocalMemory, allowPersistent,
+                          chunkBlocks, allowCpuKernel, queueCount,
+                          withCpu, cpuThreads, cpuImpl);
+    int ret = director.runBenchmark(runner);
+    if (ret != 0 || !director.isVerbose()) {
+        return ret;
+    }
+
+    double total = 0.0;
+    std::size_t i = 0;
+    for (auto &stats : runner.getDispatcher().getStats()) {
+        std::cout << "Engine #" << i++ << " (" << stats.name << "): "
+                  << stats.hashes << " hashes in " << stats.batches
+                  << " batches (" << stats.stolenBatches << " stolen), "
+                  << stats.getHashesPerSecond() << " hashes/s" << std::endl;
+        total += stats.getHashesPerSecond();
+    }
+    std::cout << "Aggregate throughput: " << total << " hashes/s"
+              << std::endl;
+    return 0;
+}
+
+CPUExecutive::Runner::Runner(const BenchmarkDirector &director,
+                             std::size_t threadCount,
+                             argon2::cpu::Implementation impl,
+                             bool allowLockstep,
+                             argon2::cpu::MemoryPool::PageSize pageSize,
+                             bool numa, std::size_t interleavedSegments)
+    : params(HASH_LENGTH, NULL, 0, NULL, 0, NULL, 0,
+             director.getTimeCost(), director.getMemoryCost(),
+             director.getLanes())
+{
+    using namespace argon2::cpu;
+
+    std::vector<ThreadPool::NumaNode> numaNodes;
+    if (numa) {
+        numaNodes = ThreadPool::getNumaNodes();
+    }
+
+    auto batchSize = director.getBatchSize();
+    if (numaNodes.empty()) {
+        Node node;
+        node.numaNode = -1;
+        node.pool.reset(new ThreadPool(threadCount));
+        node.memoryPool.reset(new MemoryPool(pageSize));
+        node.unit.reset(new ProcessingUnit(
+                            &params, director.getType(),
+                            director.getVersion(), node.pool.get(),
+                            batchSize, impl, allowLockstep,
+                            node.memoryPool.get(), interleavedSegments));
+        nodes.push_back(std::move(node));
+        return;
+    }
+
+    /* split the batch evenly between the nodes: */
+    for (std::size_t i = 0; i < numaNodes.size(); i++) {
+        std::size_t nodeBatchSize = batchSize / numaNodes.size()
+                + (i < batchSize % numaNodes.size() ? 1 : 0);
+        if (nodeBatchSize == 0) {
+            continue;
+        }
+        Node node;
+        node.numaNode = numaNodes[i].id;
+        node.pool.reset(new ThreadPool(numaNodes[i].cpus));
+        node.memoryPool.reset(new MemoryPool(pageSize, numaNodes[i].id));
+        node.unit.reset(new ProcessingUnit(
+                            &params, director.getType(),
+                            director.getVersion(), node.pool.get(),
+                            nodeBatchSize, impl, allowLockstep,
+                            node.memoryPool.get(), interleavedSegments));
+        nodes.push_back(std::move(node));
+    }
+}
+
+nanosecs CPUExecutive::Runner::runBenchmark(
+        const BenchmarkDirector &director, PasswordGenerator &pwGen)
+{
+    typedef std::chrono::steady_clock clock_type;
+    using namespace argon2::cpu;
+
+    auto beVerbose = director.isVerbose();
+    if (beVerbose) {
+        std::cout << "Starting computation..." << std::endl;
+    }
+
+    clock_type::time_point checkpt0 = clock_type::now();
+    for (auto &node : nodes) {
+        ProcessingUnit::PasswordWriter writer(*node.unit);
+        for (std::size_t i = 0; i < node.unit->getBatchSize(); i++) {
+            const void *pw;
+            std::size_t pwLength;
+            pwGen.nextPassword(pw, pwLength);
+            writer.setPassword(pw, pwLength);
+
+            writer.moveForward(1);
+        }
+    }
+    clock_type::time_point checkpt1 = clock_type::now();
+
+    for (auto &node : nodes) {
+        node.unit->beginProcessing();
+    }
+    for (auto &node : nodes) {
+        node.unit->endProcessing();
+    }
+
+    clock_type::time_point checkpt2 = clock_type::now();
+    for (auto &node : nodes) {
+        ProcessingUnit::HashReader reader(*node.unit);
+        for (std::size_t i = 0; i < node.unit->getBatchSize(); i++) {
+            reader.getHash();
+            reader.moveForward(1);
+        }
+    }
+    clock_type::time_point checkpt3 = clock_type::now();
+
+    if (beVerbose) {
+        clock_type::duration wrTime = checkpt1 - checkpt0;
+        auto wrTimeNs = toNanoseconds(wrTime);
+        std::cout << "    Writing took     "
+                  << RunTimeStats::repr(wrTimeNs) << std::endl;
+    }
+
+    clock_type::duration compTime = checkpt2 - checkpt1;
+    auto compTimeNs = toNanoseconds(compTime);
+    if (beVerbose) {
+        std::cout << "    Computation took "
+                  << RunTimeStats::repr(compTimeNs) << std::endl;
+    }
+
+    if (beVerbose) {
+        clock_type::duration rdTime = checkpt3 - checkpt2;
+        auto rdTimeNs = toNanoseconds(rdTime);
+        std::cout << "    Reading took     "
+                  << RunTimeStats::repr(rdTimeNs) << std::endl;
+    }
+    return compTimeNs;
+}
+
+static void printPageFaults(const MemoryCounters &counters, const char *when,
+                            std::uintmax_t &minor, std::uintmax_t &major)
+{
+    std::uintmax_t totalMinor, totalMajor;
+    if (!counters.getPageFaults(totalMinor, totalMajor)) {
+        std::cout << "Page faults " << when << ": not available"
+                  << std::endl;
+        return;
+    }
+    std::cout << "Page faults " << when << ": "
+              << totalMinor - minor << " minor, "
+              << totalMajor - major << " major" << std::endl;
+    minor = totalMinor;
+    major = totalMajor;
+}
+
+int CPUExecutive::runBenchmark(const BenchmarkDirector &director) const
+{
+    using namespace argon2::cpu;
+
+    auto beVerbose = director.isVerbose();
+
+    /* started before the threads, so that it counts them too: */
+    MemoryCounters counters;
+    std::uintmax_t minorFaults = 0, majorFaults = 0;
+
+    int result;
+    {
+        Runner runner(director, threadCount, impl, allowLockstep,
+                      pageSize, numa, interleavedSegments);
+        auto &nodes = runner.getNodes();
+        if (beVerbose) {
+            for (auto &node : nodes) {
+                std::cout << "Using " << node.pool->getThreadCount()
+                          << " CPU thread(s)";
+                if (node.numaNode >= 0) {
+                    std::cout << " on NUMA node " << node.numaNode
+                              << " for " << node.unit->getBatchSize()
+                              << " hashes";
+                }
+                std::cout << std::endl;
+            }
+            std::cout << "Using the " << getImplementationName(impl)
+                      << " implementation" << std::endl;
+            if (nodes[0].unit->isLockstep()) {
+                std::cout << "Computing "
+                          << nodes[0].unit->getLockstepJobs()
+                          << " jobs in lockstep per thread" << std::endl;
+            }
+            if (nodes[0].unit->getInterleavedSegments() > 1) {
+                std::cout << "Computing "
+                          << nodes[0].unit->getInterleavedSegments()
+                          << " segments in turns per thread" << std::endl;
+            }
+            for (auto &node : nodes) {
+                auto stats = node.memoryPool->getStats();
+                std::cout << "Mapped " << stats.bytes / (1024 * 1024)
+                          << " MiB of memory ("
+                          << stats.bytes2M / (1024 * 1024)
+                          << " MiB on 2 MiB pages, "
+                          << stats.bytes1G / (1024 * 1024)
+                          << " MiB on 1 GiB pages)" << std::endl;
+            }
+            printPageFaults(counters, "while allocating",
+                            minorFaults, majorFaults);
+        }
+        result = director.runBenchmark(runner);
+        if (beVerbose) {
+            printPageFaults(counters, "while computing",
+                            minorFaults, majorFaults);
+        }
+    }
+
+    if (beVerbose) {
+        std::uintmax_t tlbMisses;
+        if (counters.getTlbMisses(tlbMisses)) {
+            std::cout << "dTLB load misses: " << tlbMisses << std::endl;
+        } else {
+            std::cout << "dTLB load misses: not available" << std::endl;
+        }
+    }
+    return result;
+}
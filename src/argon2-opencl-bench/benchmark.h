@@ -37,7 +37,7 @@ public:
     }
 };
 
-#include "argon2-opencl/argon2-common.h"
+#include "argon2-opencl/argon2params.h"
 
 class BenchmarkDirector;
 
@@ -69,6 +69,12 @@ public:
     std::size_t getBatchSize() const { return batchSize; }
     bool isVerbose() const { return beVerbose; }
 
+    /**
+     * @brief Returns the number of bytes that the kernel has to move
+     * to/from global memory to compute one hash.
+     */
+    std::size_t getMemoryTrafficPerHash() const;
+
     BenchmarkDirector(const std::string &progname,
                       argon2::Type type, argon2::Version version,
                       std::size_t t_cost, std::size_t m_cost, std::size_t lanes,
@@ -93,6 +99,8 @@ public:
 };
 
 #include "argon2-opencl/processingunit.h"
+#include "argon2-opencl/cpuprocessingunit.h"
+#include "argon2-opencl/dispatcher.h"
 
 class OpenCLExecutive : public BenchmarkExecutive
 {
@@ -106,7 +114,41 @@ private:
     public:
         Runner(const BenchmarkDirector &director,
                const argon2::opencl::Device &device,
-               const argon2::opencl::ProgramContext &pc);
+               const argon2::opencl::ProgramContext &pc,
+               bool bySegment, bool allowLocalMemory,
+               bool allowPersistent, std::size_t chunkBlocks,
+               bool allowCpuKernel, std::size_t queueCount);
+
+        const argon2::opencl::ProcessingUnit &getUnit() const { return unit; }
+
+        nanosecs runBenchmark(const BenchmarkDirector &director,
+                              PasswordGenerator &pwGen) override;
+    };
+
+    /* runs each sample on all units of a dispatcher: */
+    class DispatchRunner : public Argon2Runner
+    {
+    private:
+        argon2::Argon2Params params;
+        std::unique_ptr<argon2::cpu::ThreadPool> cpuPool;
+        argon2::opencl::Dispatcher dispatcher;
+        std::vector<std::string> passwords;
+
+    public:
+        DispatchRunner(const BenchmarkDirector &director,
+                       const std::vector<argon2::opencl::Device> &devices,
+                       const std::vector<const argon2::opencl::ProgramContext *> &programs,
+                       std::size_t unitsPerDevice,
+                       bool bySegment, bool allowLocalMemory,
+                       bool allowPersistent, std::size_t chunkBlocks,
+                       bool allowCpuKernel, std::size_t queueCount,
+                       bool withCpu, std::size_t cpuThreads,
+                       argon2::cpu::Implementation cpuImpl);
+
+        const argon2::opencl::Dispatcher &getDispatcher() const
+        {
+            return dispatcher;
+        }
 
         nanosecs runBenchmark(const BenchmarkDirector &director,
                               PasswordGenerator &pwGen) override;
@@ -114,12 +156,105 @@ private:
 
     static constexpr std::size_t HASH_LENGTH = 32;
 
+    int runOnAllDevices(const BenchmarkDirector &director) const;
+
+    argon2::opencl::DeviceFilter filter;
     std::size_t deviceIndex;
     bool listDevices;
+    bool allDevices;
+    std::size_t unitsPerDevice;
+    unsigned int kernelFlags;
+    /* flags to take from the device's preferred kernel flags: */
+    unsigned int autoKernelFlags;
+    bool bySegment;
+    bool allowLocalMemory;
+    bool allowPersistent;
+    std::size_t chunkBlocks;
+    bool allowCpuKernel;
+    std::size_t queueCount;
+    bool withCpu;
+    std::size_t cpuThreads;
+    argon2::cpu::Implementation cpuImpl;
+
+public:
+    OpenCLExecutive(const argon2::opencl::DeviceFilter &filter,
+                    std::size_t deviceIndex, bool listDevices,
+                    bool allDevices, std::size_t unitsPerDevice,
+                    unsigned int kernelFlags = 0,
+                    unsigned int autoKernelFlags = 0,
+                    bool bySegment = true, bool allowLocalMemory = true,
+                    bool allowPersistent = false,
+                    std::size_t chunkBlocks = 0,
+                    bool allowCpuKernel = true,
+                    std::size_t queueCount = 1,
+                    bool withCpu = false, std::size_t cpuThreads = 0,
+                    argon2::cpu::Implementation cpuImpl =
+                        argon2::cpu::getBestImplementation())
+        : filter(filter), deviceIndex(deviceIndex), listDevices(listDevices),
+          allDevices(allDevices), unitsPerDevice(unitsPerDevice),
+          kernelFlags(kernelFlags), autoKernelFlags(autoKernelFlags),
+          bySegment(bySegment), allowLocalMemory(allowLocalMemory),
+          allowPersistent(allowPersistent), chunkBlocks(chunkBlocks),
+          allowCpuKernel(allowCpuKernel), queueCount(queueCount),
+          withCpu(withCpu), cpuThreads(cpuThreads), cpuImpl(cpuImpl)
+    {
+    }
+
+    int runBenchmark(const BenchmarkDirector &director) const override;
+};
+
+class CPUExecutive : public BenchmarkExecutive
+{
+private:
+    /* a thread pool and a memory pool, and the unit computing a part of
+     * the batch on them (one per NUMA node with --numa): */
+    struct Node
+    {
+        int numaNode;
+        std::unique_ptr<argon2::cpu::ThreadPool> pool;
+        std::unique_ptr<argon2::cpu::MemoryPool> memoryPool;
+        std::unique_ptr<argon2::cpu::ProcessingUnit> unit;
+    };
+
+    class Runner : public Argon2Runner
+    {
+    private:
+        argon2::Argon2Params params;
+        std::vector<Node> nodes;
+
+    public:
+        Runner(const BenchmarkDirector &director,
+               std::size_t threadCount, argon2::cpu::Implementation impl,
+               bool allowLockstep,
+               argon2::cpu::MemoryPool::PageSize pageSize, bool numa,
+               std::size_t interleavedSegments);
+
+        const std::vector<Node> &getNodes() const { return nodes; }
+
+        nanosecs runBenchmark(const BenchmarkDirector &director,
+                              PasswordGenerator &pwGen) override;
+    };
+
+    static constexpr std::size_t HASH_LENGTH = 32;
+
+    std::size_t threadCount;
+    argon2::cpu::Implementation impl;
+    bool allowLockstep;
+    argon2::cpu::MemoryPool::PageSize pageSize;
+    bool numa;
+    std::size_t interleavedSegments;
 
 public:
-    OpenCLExecutive(std::size_t deviceIndex, bool listDevices)
-        : deviceIndex(deviceIndex), listDevices(listDevices)
+    CPUExecutive(std::size_t threadCount = 0,
+                 argon2::cpu::Implementation impl =
+                    argon2::cpu::getBestImplementation(),
+                 bool allowLockstep = true,
+                 argon2::cpu::MemoryPool::PageSize pageSize =
+                    argon2::cpu::MemoryPool::PAGES_2M,
+                 bool numa = false, std::size_t interleavedSegments = 0)
+        : threadCount(threadCount), impl(impl), allowLockstep(allowLockstep),
+          pageSize(pageSize), numa(numa),
+          interleavedSegments(interleavedSegments)
     {
     }
 
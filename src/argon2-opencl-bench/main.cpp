@@ -4,6 +4,7 @@
 #include "benchmark.h"
 
 #include <iostream>
+#include <stdexcept>
 
 using namespace libcommandline;
 
@@ -11,10 +12,35 @@ struct Arguments
 {
     bool showHelp = false;
     bool listDevices = false;
+    bool allDevices = false;
+    std::size_t unitsPerDevice = 2;
+    bool oneshot = false;
+    bool noLocalMemory = false;
+    bool noCpuKernel = false;
+    bool persistent = false;
+    std::size_t chunkBlocks = 0;
+    std::size_t queueCount = 1;
+    bool withCpu = false;
+    std::size_t cpuThreads = 0;
+    std::string cpuImplementation = "auto";
+    bool noLockstep = false;
+    std::string cpuPages = "2m";
+    bool numa = false;
+    std::size_t cpuInterleave = 0;
+    bool prefetchRefs = false;
+    bool registerState = false;
+    bool counters = false;
+    bool portableArithmetic = false;
+    bool splitLanes = false;
+    bool globalScratch = false;
+    std::string vectorAccess = "auto";
 
     std::string mode = "opencl";
 
     std::size_t deviceIndex = 0;
+    std::string platformName;
+    std::string deviceVendor;
+    std::string deviceType = "all";
 
     std::string outputType = "ns";
     std::string outputMode = "verbose";
@@ -46,6 +72,86 @@ static CommandLineParser<Arguments> buildCmdLineParser()
             makeNumericHandler<Arguments, std::size_t>([] (Arguments &state, std::size_t index) {
                 state.deviceIndex = (std::size_t)index;
             }), "device", 'd', "use device with index INDEX", "0", "INDEX"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.allDevices = true; },
+            "all-devices", '\0', "spread each batch over all (matching) devices"),
+        new ArgumentOption<Arguments>(
+            makeNumericHandler<Arguments, std::size_t>([] (Arguments &state, std::size_t num) {
+                state.unitsPerDevice = num;
+            }), "units-per-device", '\0', "number of processing units per device with --all-devices", "2", "N"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.withCpu = true; },
+            "with-cpu", '\0', "with --all-devices, also compute on the host CPU"),
+        new ArgumentOption<Arguments>(
+            makeNumericHandler<Arguments, std::size_t>([] (Arguments &state, std::size_t num) {
+                state.cpuThreads = num;
+            }), "cpu-threads", '\0', "number of threads for CPU computation (0 = one per core)", "0", "N"),
+        new ArgumentOption<Arguments>(
+            [] (Arguments &state, const std::string &name) { state.cpuImplementation = name; },
+            "cpu-implementation", '\0', "instruction set for CPU computation (auto|portable|sse2|avx2|avx512)", "auto", "NAME"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.noLockstep = true; },
+            "no-lockstep", '\0', "do not compute several Argon2i hashes per CPU thread in SIMD lockstep"),
+        new ArgumentOption<Arguments>(
+            [] (Arguments &state, const std::string &size) { state.cpuPages = size; },
+            "cpu-pages", '\0', "largest page size for CPU job memory (default|2m|1g)", "2m", "SIZE"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.numa = true; },
+            "numa", '\0', "in CPU mode, compute a part of the batch on each NUMA node, with one pinned thread per CPU and node-local memory"),
+        new ArgumentOption<Arguments>(
+            makeNumericHandler<Arguments, std::size_t>([] (Arguments &state, std::size_t num) {
+                state.cpuInterleave = num;
+            }), "cpu-interleave", '\0', "number of segments that a CPU thread computes in turns, prefetching their reference blocks (0 = by memory size, 1 = off)", "0", "N"),
+        new ArgumentOption<Arguments>(
+            [] (Arguments &state, const std::string &name) { state.platformName = name; },
+            "platform", '\0', "only consider platforms whose name contains NAME", "", "NAME"),
+        new ArgumentOption<Arguments>(
+            [] (Arguments &state, const std::string &name) { state.deviceVendor = name; },
+            "vendor", '\0', "only consider devices whose vendor contains NAME", "", "NAME"),
+        new ArgumentOption<Arguments>(
+            [] (Arguments &state, const std::string &type) { state.deviceType = type; },
+            "device-type", '\0', "only consider devices of type TYPE (all|cpu|gpu|accelerator)", "all", "TYPE"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.oneshot = true; },
+            "oneshot", '\0', "process the whole hash in one kernel launch"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.noLocalMemory = true; },
+            "no-local-memory", '\0', "never keep the whole hash memory in local memory"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.noCpuKernel = true; },
+            "no-cpu-kernel", '\0', "do not use the one-work-item-per-lane kernel on CPU devices"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.persistent = true; },
+            "persistent", '\0', "process all segments in a single kernel launch if possible"),
+        new ArgumentOption<Arguments>(
+            makeNumericHandler<Arguments, std::size_t>([] (Arguments &state, std::size_t num) {
+                state.chunkBlocks = num;
+            }), "chunk-blocks", '\0', "compute at most N blocks per lane in one kernel launch (0 = no limit)", "0", "N"),
+        new ArgumentOption<Arguments>(
+            makeNumericHandler<Arguments, std::size_t>([] (Arguments &state, std::size_t num) {
+                state.queueCount = num;
+            }), "queues", '\0', "split each batch between N command queues", "1", "N"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.prefetchRefs = true; },
+            "prefetch-refs", '\0', "use the kernel variant that prefetches reference blocks"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.registerState = true; },
+            "register-state", '\0', "use the kernel variant that keeps block state in registers"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.counters = true; },
+            "counters", '\0', "record per-lane kernel counters and print them (slower)"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.portableArithmetic = true; },
+            "portable-arithmetic", '\0', "do not use vendor-specific arithmetic in the kernel"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.splitLanes = true; },
+            "split-lanes", '\0', "spread the lanes of a hash over several buffers if it does not fit into one"),
+        new FlagOption<Arguments>(
+            [] (Arguments &state) { state.globalScratch = true; },
+            "global-scratch", '\0', "keep the working blocks of the oneshot kernel in global memory"),
+        new ArgumentOption<Arguments>(
+            [] (Arguments &state, const std::string &mode) { state.vectorAccess = mode; },
+            "vector-access", '\0', "use vector loads/stores for global memory (auto|yes|no)", "auto", "MODE"),
 
         new ArgumentOption<Arguments>(
             [] (Arguments &state, const std::string &type) { state.outputType = type; },
@@ -125,16 +231,117 @@ int main(int, const char * const *argv)
         return 1;
     }
 
+    argon2::cpu::Implementation cpuImpl;
+    if (args.cpuImplementation == "auto") {
+        cpuImpl = argon2::cpu::getBestImplementation();
+    } else if (args.cpuImplementation == "portable") {
+        cpuImpl = argon2::cpu::IMPLEMENTATION_PORTABLE;
+    } else if (args.cpuImplementation == "sse2") {
+        cpuImpl = argon2::cpu::IMPLEMENTATION_SSE2;
+    } else if (args.cpuImplementation == "avx2") {
+        cpuImpl = argon2::cpu::IMPLEMENTATION_AVX2;
+    } else if (args.cpuImplementation == "avx512") {
+        cpuImpl = argon2::cpu::IMPLEMENTATION_AVX512;
+    } else {
+        std::cerr << argv[0] << ": invalid CPU implementation: "
+                  << args.cpuImplementation << std::endl;
+        return 1;
+    }
+    if (!argon2::cpu::isImplementationSupported(cpuImpl)) {
+        std::cerr << argv[0] << ": CPU implementation not supported: "
+                  << args.cpuImplementation << std::endl;
+        return 1;
+    }
+
+    argon2::cpu::MemoryPool::PageSize cpuPageSize;
+    if (args.cpuPages == "default") {
+        cpuPageSize = argon2::cpu::MemoryPool::PAGES_DEFAULT;
+    } else if (args.cpuPages == "2m") {
+        cpuPageSize = argon2::cpu::MemoryPool::PAGES_2M;
+    } else if (args.cpuPages == "1g") {
+        cpuPageSize = argon2::cpu::MemoryPool::PAGES_1G;
+    } else {
+        std::cerr << argv[0] << ": invalid CPU page size: "
+                  << args.cpuPages << std::endl;
+        return 1;
+    }
+
     BenchmarkDirector director(argv[0], type, version,
             args.t_cost, args.m_cost, args.lanes,
             args.batchSize, args.sampleCount,
             args.outputMode, args.outputType);
     if (args.mode == "opencl") {
-        OpenCLExecutive exec(args.deviceIndex, args.listDevices);
-        return exec.runBenchmark(director);
+        unsigned int kernelFlags = 0, autoKernelFlags = 0;
+        if (args.prefetchRefs) {
+            kernelFlags |= argon2::opencl::KERNEL_PREFETCH_REFS;
+        }
+        if (args.registerState) {
+            kernelFlags |= argon2::opencl::KERNEL_REGISTER_STATE;
+        }
+        if (args.counters) {
+            kernelFlags |= argon2::opencl::KERNEL_COUNTERS;
+        }
+        if (args.portableArithmetic) {
+            kernelFlags |= argon2::opencl::KERNEL_PORTABLE_ARITHMETIC;
+        }
+        if (args.splitLanes) {
+            kernelFlags |= argon2::opencl::KERNEL_SPLIT_LANES;
+        }
+        if (args.globalScratch) {
+            kernelFlags |= argon2::opencl::KERNEL_GLOBAL_SCRATCH;
+        }
+        if (args.vectorAccess == "yes") {
+            kernelFlags |= argon2::opencl::KERNEL_VECTOR_ACCESS;
+        } else if (args.vectorAccess == "auto") {
+            autoKernelFlags |= argon2::opencl::KERNEL_VECTOR_ACCESS;
+        } else if (args.vectorAccess != "no") {
+            std::cerr << argv[0] << ": invalid vector access mode: "
+                      << args.vectorAccess << std::endl;
+            return 1;
+        }
+        if (args.unitsPerDevice == 0) {
+            std::cerr << argv[0] << ": invalid number of units per device: "
+                      << args.unitsPerDevice << std::endl;
+            return 1;
+        }
+        if (args.allDevices && args.persistent && args.unitsPerDevice > 1) {
+            /* the units' persistent kernels could starve each other: */
+            std::cerr << argv[0] << ": --persistent needs exclusive use"
+                      << " of each device; use --units-per-device 1"
+                      << std::endl;
+            return 1;
+        }
+        argon2::opencl::DeviceFilter filter;
+        filter.platformName = args.platformName;
+        filter.vendor = args.deviceVendor;
+        if (args.deviceType == "cpu") {
+            filter.type = CL_DEVICE_TYPE_CPU;
+        } else if (args.deviceType == "gpu") {
+            filter.type = CL_DEVICE_TYPE_GPU;
+        } else if (args.deviceType == "accelerator") {
+            filter.type = CL_DEVICE_TYPE_ACCELERATOR;
+        } else if (args.deviceType != "all") {
+            std::cerr << argv[0] << ": invalid device type: "
+                      << args.deviceType << std::endl;
+            return 1;
+        }
+        OpenCLExecutive exec(filter, args.deviceIndex, args.listDevices,
+                             args.allDevices, args.unitsPerDevice,
+                             kernelFlags, autoKernelFlags,
+                             !args.oneshot, !args.noLocalMemory,
+                             args.persistent, args.chunkBlocks,
+                             !args.noCpuKernel, args.queueCount,
+                             args.withCpu, args.cpuThreads, cpuImpl);
+        try {
+            return exec.runBenchmark(director);
+        } catch (const std::length_error &err) {
+            std::cerr << argv[0] << ": " << err.what() << std::endl;
+            return 1;
+        }
     } else if (args.mode == "cpu") {
-        // TODO
-        return 1;
+        CPUExecutive exec(args.cpuThreads, cpuImpl, !args.noLockstep,
+                          cpuPageSize, args.numa, args.cpuInterleave);
+        return exec.runBenchmark(director);
     } else {
         std::cerr << argv[0] << ": invalid mode: " << args.mode << std::endl;
         return 1;
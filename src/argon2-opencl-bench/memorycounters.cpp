@@ -0,0 +1,90 @@
+#include "memorycounters.h"
+
+#ifdef __linux__
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static bool readPageFaults(std::uintmax_t &minor, std::uintmax_t &major)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        minor = major = 0;
+        return false;
+    }
+    minor = usage.ru_minflt;
+    major = usage.ru_majflt;
+    return true;
+}
+
+MemoryCounters::MemoryCounters()
+{
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    /* also count the threads started later: */
+    attr.inherit = 1;
+    tlbFd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+    readPageFaults(startMinorFaults, startMajorFaults);
+}
+
+MemoryCounters::~MemoryCounters()
+{
+    if (tlbFd >= 0) {
+        close(tlbFd);
+    }
+}
+
+bool MemoryCounters::getPageFaults(std::uintmax_t &minor,
+                                   std::uintmax_t &major) const
+{
+    if (!readPageFaults(minor, major)) {
+        return false;
+    }
+    minor -= startMinorFaults;
+    major -= startMajorFaults;
+    return true;
+}
+
+bool MemoryCounters::getTlbMisses(std::uintmax_t &misses) const
+{
+    std::uint64_t value;
+    if (tlbFd < 0 || read(tlbFd, &value, sizeof(value)) != sizeof(value)) {
+        return false;
+    }
+    misses = value;
+    return true;
+}
+
+#else
+
+MemoryCounters::MemoryCounters()
+    : startMinorFaults(0), startMajorFaults(0), tlbFd(-1)
+{
+}
+
+MemoryCounters::~MemoryCounters()
+{
+}
+
+bool MemoryCounters::getPageFaults(std::uintmax_t &, std::uintmax_t &) const
+{
+    return false;
+}
+
+bool MemoryCounters::getTlbMisses(std::uintmax_t &) const
+{
+    return false;
+}
+
+#endif
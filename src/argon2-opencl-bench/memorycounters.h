@@ -0,0 +1,32 @@
+#ifndef MEMORYCOUNTERS_H
+#define MEMORYCOUNTERS_H
+
+#include <cstdint>
+
+/**
+ * @brief Counts the page faults and data TLB misses of the process from
+ * its construction on (only supported on Linux).
+ *
+ * The TLB misses of a thread are only included once the thread has
+ * exited, so read them after the threads of the benchmark are joined.
+ */
+class MemoryCounters
+{
+private:
+    std::uintmax_t startMinorFaults, startMajorFaults;
+    int tlbFd;
+
+public:
+    MemoryCounters();
+    ~MemoryCounters();
+
+    MemoryCounters(const MemoryCounters &) = delete;
+    MemoryCounters &operator=(const MemoryCounters &) = delete;
+
+    /* these return false if the counter is not available (e.g. no
+     * permission to use perf events): */
+    bool getPageFaults(std::uintmax_t &minor, std::uintmax_t &major) const;
+    bool getTlbMisses(std::uintmax_t &misses) const;
+};
+
+#endif // MEMORYCOUNTERS_H
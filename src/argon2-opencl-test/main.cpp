@@ -1,7 +1,14 @@
 #include <iostream>
+#include <chrono>
 #include <cstdint>
+#include <stdexcept>
+#include <thread>
 
+#include "argon2-opencl/cpuprocessingunit.h"
+#include "argon2-opencl/dispatcher.h"
 #include "argon2-opencl/processingunit.h"
+#include "argon2-opencl/programpool.h"
+#include "argon2-opencl/streamingunit.h"
 
 using namespace argon2;
 using namespace argon2::opencl;
@@ -65,42 +72,629 @@ public:
     }
 };
 
-std::size_t runTests(const GlobalContext &global, const Device &device,
+static void dumpKernelFlags(std::ostream &out, unsigned int flags)
+{
+    if (flags & KERNEL_PREFETCH_REFS) {
+        out << "[prefetch] ";
+    }
+    if (flags & KERNEL_VECTOR_ACCESS) {
+        out << "[vector] ";
+    }
+    if (flags & KERNEL_REGISTER_STATE) {
+        out << "[registers] ";
+    }
+    if (flags & KERNEL_COUNTERS) {
+        out << "[counters] ";
+    }
+    if (flags & KERNEL_PORTABLE_ARITHMETIC) {
+        out << "[portable] ";
+    }
+    if (flags & KERNEL_SPLIT_LANES) {
+        out << "[split-lanes] ";
+    }
+    if (flags & KERNEL_GLOBAL_SCRATCH) {
+        out << "[global-scratch] ";
+    }
+}
+
+static bool checkCounters(const ProcessingUnit &pu, const Argon2Params &params,
+                          Type type)
+{
+    std::uint64_t blocks = params.getLaneBlocks() * params.getTimeCost() - 2;
+    std::uint64_t addressBlocks = 0;
+    if (type == ARGON2_I) {
+        /* one address block per 128 blocks of each segment: */
+        std::size_t addressesPerBlock = ARGON2_BLOCK_SIZE / 8;
+        std::uint64_t perSegment = (params.getSegmentBlocks()
+                                    + addressesPerBlock - 1) / addressesPerBlock;
+        addressBlocks = perSegment * params.getTimeCost() * ARGON2_SYNC_POINTS;
+        if (params.getSegmentBlocks() <= 2) {
+            /* nothing to compute in the first segment */
+            addressBlocks -= perSegment;
+        }
+    }
+    for (std::size_t job = 0; job < pu.getBatchSize(); job++) {
+        for (std::size_t lane = 0; lane < params.getLanes(); lane++) {
+            auto counters = pu.getCounters(job, lane);
+            if (counters.blocks != blocks || counters.crossLaneRefs > blocks) {
+                return false;
+            }
+            if (params.getLanes() == 1 && counters.crossLaneRefs != 0) {
+                return false;
+            }
+            /* chunks starting inside an address block regenerate it: */
+            if (pu.getChunkBlocks() == 0 ?
+                    counters.addressBlocks != addressBlocks :
+                    counters.addressBlocks < addressBlocks) {
+                return false;
+            }
+            for (std::size_t i = 0; i < counters.segmentStart.size(); i++) {
+                if (counters.segmentEnd[i] < counters.segmentStart[i]) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static std::size_t runTestCases(const ProgramContext &progCtx,
+                                const Device &device, bool bySegment,
+                                bool allowLocalMemory, bool allowPersistent,
+                                std::size_t chunkBlocks, bool allowCpuKernel,
+                                std::size_t queueCount,
+                                std::size_t lanesPerBuffer,
+                                const TestCase *casesFrom,
+                                const TestCase *casesTo)
+{
+    /* with more queues, one more job than queues, so that
+     * the parts of the batch differ in size: */
+    std::size_t batchSize = queueCount == 1 ? 1 : queueCount + 1;
+
+    std::size_t failures = 0;
+    for (auto tc = casesFrom; tc < casesTo; ++tc) {
+        auto &params = tc->getParams();
+        std::unique_ptr<ProcessingUnit> unit;
+        try {
+            unit.reset(new ProcessingUnit(
+                           &progCtx, &params, &device, batchSize, bySegment,
+                           allowLocalMemory, allowPersistent, chunkBlocks,
+                           allowCpuKernel, queueCount, lanesPerBuffer));
+        } catch (const std::length_error &) {
+            if (!(progCtx.getKernelFlags() & KERNEL_GLOBAL_SCRATCH)) {
+                throw;
+            }
+            /* the lanes do not fit into one work-group on this device */
+            continue;
+        }
+        auto &pu = *unit;
+        if (allowCpuKernel && !pu.isCpuKernel()) {
+            /* not a CPU device */
+            continue;
+        }
+        if (allowLocalMemory && !pu.isLocalMemoryResident()) {
+            /* already covered by the run without local memory */
+            continue;
+        }
+        if (allowPersistent && !pu.isPersistent()) {
+            /* already covered by the multi-launch run */
+            continue;
+        }
+
+        std::cerr << "  " << (pu.isBySegment() ? "[by-segment] " : "[oneshot] ");
+        if (pu.isLocalMemoryResident()) {
+            std::cerr << "[local] ";
+        }
+        if (pu.isGlobalScratch() &&
+                !(progCtx.getKernelFlags() & KERNEL_GLOBAL_SCRATCH)) {
+            std::cerr << "[scratch] ";
+        }
+        if (pu.isPersistent()) {
+            std::cerr << "[persistent] ";
+        }
+        if (pu.getChunkBlocks() != 0) {
+            std::cerr << "[chunked] ";
+        }
+        if (pu.isCpuKernel()) {
+            std::cerr << "[cpu] ";
+        }
+        if (pu.getQueueCount() > 1) {
+            std::cerr << "[queues=" << pu.getQueueCount() << "] ";
+        }
+        if (pu.getLanesPerBuffer() != params.getLanes()) {
+            std::cerr << "[lanes-per-buffer=" << pu.getLanesPerBuffer()
+                      << "] ";
+        }
+        dumpKernelFlags(std::cerr, progCtx.getKernelFlags());
+        tc->dump(std::cerr);
+        std::cerr << "... ";
+
+        bool res = true;
+        if (chunkBlocks != 0) {
+            /* a cancelled run must not affect the next one: */
+            pu.beginProcessing();
+            pu.cancel();
+            if (pu.endProcessing()) {
+                res = false;
+            }
+        }
+
+        {
+            ProcessingUnit::PasswordWriter writer(pu);
+            for (std::size_t i = 0; i < batchSize; i++) {
+                writer.setPassword(tc->getInput(), tc->getInputLength());
+                writer.moveForward(1);
+            }
+        }
+        pu.beginProcessing();
+        if (!pu.endProcessing()) {
+            res = false;
+        }
+
+        ProcessingUnit::HashReader hash(pu);
+        for (std::size_t i = 0; i < batchSize; i++) {
+            if (std::memcmp(tc->getOutput(), hash.getHash(),
+                            params.getOutputLength()) != 0) {
+                res = false;
+            }
+            hash.moveForward(1);
+        }
+        if (pu.hasCounters() &&
+                !checkCounters(pu, params, progCtx.getArgon2Type())) {
+            res = false;
+        }
+        if (!res) {
+            ++failures;
+            std::cerr << "FAIL" << std::endl;
+        } else {
+            std::cerr << "PASS" << std::endl;
+        }
+    }
+    return failures;
+}
+
+static std::size_t runStreamingTestCases(const ProgramContext &progCtx,
+                                         const Device &device,
+                                         const TestCase *casesFrom,
+                                         const TestCase *casesTo)
+{
+    std::size_t failures = 0;
+    for (auto tc = casesFrom; tc < casesTo; ++tc) {
+        auto &params = tc->getParams();
+
+        /* two slots, one work-group -- three jobs in two batches, the
+         * second one submitted while the first batch is still queued: */
+        std::unique_ptr<StreamingUnit> su;
+        try {
+            su.reset(new StreamingUnit(&progCtx, &params, &device, 2, 1));
+        } catch (const std::length_error &) {
+            /* the lanes do not fit into one work-group on this device */
+            continue;
+        }
+
+        std::cerr << "  [stream] ";
+        dumpKernelFlags(std::cerr, progCtx.getKernelFlags());
+        tc->dump(std::cerr);
+        std::cerr << "... ";
+
+        std::unique_ptr<std::uint8_t[]> hash(
+                    new std::uint8_t[params.getOutputLength()]);
+
+        bool res = true;
+        std::uint64_t expectedId = 0, jobId;
+        su->submit(tc->getInput(), tc->getInputLength());
+        su->submit(tc->getInput(), tc->getInputLength());
+        su->flush();
+        for (std::size_t i = 0; i < 3; i++) {
+            if (i == 1) {
+                su->submit(tc->getInput(), tc->getInputLength());
+                su->flush();
+            }
+            if (!su->harvest(jobId, hash.get()) || jobId != expectedId++ ||
+                    std::memcmp(tc->getOutput(), hash.get(),
+                                params.getOutputLength()) != 0) {
+                res = false;
+            }
+        }
+        if (su->harvest(jobId, hash.get(), false)) {
+            res = false;
+        }
+
+        if (!res) {
+            ++failures;
+            std::cerr << "FAIL" << std::endl;
+        } else {
+            std::cerr << "PASS" << std::endl;
+        }
+    }
+    return failures;
+}
+
+static std::size_t runCpuTestCases(cpu::ThreadPool &pool, Type type,
+                                   Version version, std::size_t batchSize,
+                                   cpu::Implementation impl,
+                                   const TestCase *casesFrom,
+                                   const TestCase *casesTo,
+                                   cpu::MemoryPool *memoryPool = nullptr,
+                                   std::size_t interleavedSegments = 0)
+{
+    std::size_t failures = 0;
+    for (auto tc = casesFrom; tc < casesTo; ++tc) {
+        auto &params = tc->getParams();
+
+        cpu::ProcessingUnit pu(&params, type, version, &pool, batchSize,
+                               impl, true, memoryPool,
+                               interleavedSegments);
+
+        std::cerr << "  [host] [" << cpu::getImplementationName(impl)
+                  << "] [threads=" << pool.getThreadCount()
+                  << "] [batch=" << batchSize << "] ";
+        if (pu.isLockstep()) {
+            std::cerr << "[lockstep=" << pu.getLockstepJobs() << "] ";
+        }
+        if (pu.getInterleavedSegments() > 1) {
+            std::cerr << "[interleave=" << pu.getInterleavedSegments()
+                      << "] ";
+        }
+        tc->dump(std::cerr);
+        std::cerr << "... ";
+
+        {
+            cpu::ProcessingUnit::PasswordWriter writer(pu);
+            for (std::size_t i = 0; i < batchSize; i++) {
+                writer.setPassword(tc->getInput(), tc->getInputLength());
+                writer.moveForward(1);
+            }
+        }
+        pu.beginProcessing();
+        pu.endProcessing();
+
+        bool res = true;
+        cpu::ProcessingUnit::HashReader hash(pu);
+        for (std::size_t i = 0; i < batchSize; i++) {
+            if (std::memcmp(tc->getOutput(), hash.getHash(),
+                            params.getOutputLength()) != 0) {
+                res = false;
+            }
+            hash.moveForward(1);
+        }
+        if (!res) {
+            ++failures;
+            std::cerr << "FAIL" << std::endl;
+        } else {
+            std::cerr << "PASS" << std::endl;
+        }
+    }
+    return failures;
+}
+
+/* a deliberately slow engine besides the devices (an OpenCL unit behind
+ * the generic interface), so that the engines differ in speed: */
+class SlowUnit : public Dispatcher::Unit
+{
+private:
+    ProcessingUnit unit;
+
+public:
+    SlowUnit(const ProgramContext *progCtx, const Argon2Params *params,
+             const Device *device)
+        : unit(progCtx, params, device, 1)
+    {
+    }
+
+    const void *getEngine() const override { return this; }
+    std::string getEngineName() const override { return "slow"; }
+    std::size_t getBatchSize() const override { return 1; }
+
+    void process(std::size_t from, std::size_t to,
+                 const Dispatcher::PasswordSource &getPassword,
+                 const Dispatcher::HashSink &putHash) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        for (std::size_t i = from; i < to; i++) {
+            const void *pw;
+            std::size_t pwSize;
+            getPassword(i, pw, pwSize);
+            ProcessingUnit::PasswordWriter(unit).setPassword(pw, pwSize);
+            unit.beginProcessing();
+            unit.endProcessing();
+            putHash(i, ProcessingUnit::HashReader(unit).getHash());
+        }
+    }
+};
+
+static std::size_t runDispatcherTestCases(ProgramPool &pool,
+                                          const std::vector<Device> &devices,
+                                          Type type, Version version,
+                                          const TestCase *casesFrom,
+                                          const TestCase *casesTo)
+{
+    std::vector<std::shared_ptr<const ProgramContext>> programs;
+    for (auto &device : devices) {
+        programs.push_back(pool.get({ device }, type, version).get());
+    }
+
+    std::size_t failures = 0;
+    for (auto tc = casesFrom; tc < casesTo; ++tc) {
+        auto &params = tc->getParams();
+
+        std::cerr << "  [dispatch] ";
+        tc->dump(std::cerr);
+        std::cerr << "... ";
+
+        /* two units of two jobs per device plus a slow engine and an odd
+         * number of jobs, so that the last batch is only partially filled;
+         * the second run is split by the measured throughput: */
+        Dispatcher dispatcher(&params);
+        for (std::size_t i = 0; i < devices.size(); i++) {
+            dispatcher.addDevice(programs[i].get(), &devices[i], 2, 2);
+        }
+        dispatcher.addUnit(std::unique_ptr<Dispatcher::Unit>(
+                               new SlowUnit(programs[0].get(), &params,
+                                            &devices[0])));
+        std::size_t jobs = 4 * devices.size() + 3;
+        bool res = true;
+        for (std::size_t run = 0; run < 2; run++) {
+            std::vector<char> done(jobs, false);
+            std::vector<char> correct(jobs, false);
+            dispatcher.run(
+                        jobs,
+                        [tc](std::size_t, const void *&pw,
+                             std::size_t &pwSize) {
+                pw = tc->getInput();
+                pwSize = tc->getInputLength();
+            }, [&](std::size_t index, const void *hash) {
+                done[index] = true;
+                correct[index] = std::memcmp(tc->getOutput(), hash,
+                                             params.getOutputLength()) == 0;
+            });
+
+            for (std::size_t i = 0; i < jobs; i++) {
+                if (!done[i] || !correct[i]) {
+                    res = false;
+                }
+            }
+        }
+        auto engineStats = dispatcher.getStats();
+        std::uint64_t hashes = 0;
+        for (auto &stats : engineStats) {
+            hashes += stats.hashes;
+        }
+        if (hashes != 2 * jobs || engineStats.size() != devices.size() + 1 ||
+                engineStats.back().device != nullptr) {
+            res = false;
+        }
+
+        if (!res) {
+            ++failures;
+            std::cerr << "FAIL" << std::endl;
+        } else {
+            std::cerr << "PASS" << std::endl;
+        }
+    }
+    return failures;
+}
+
+static std::size_t runAllModes(const ProgramContext &progCtx,
+                               const Device &device,
+                               const TestCase *casesFrom,
+                               const TestCase *casesTo)
+{
+    std::size_t failures = 0;
+    if (progCtx.getKernelFlags() & KERNEL_SPLIT_LANES) {
+        /* only the segment kernel is built; one lane per buffer, then
+         * groups of three lanes (the last one shorter) with chunks and
+         * two queues: */
+        failures += runTestCases(progCtx, device, true, false, false, 0,
+                                 false, 1, 1, casesFrom, casesTo);
+        failures += runTestCases(progCtx, device, true, false, false, 100,
+                                 false, 2, 3, casesFrom, casesTo);
+        return failures;
+    }
+    if (progCtx.getKernelFlags() & KERNEL_GLOBAL_SCRATCH) {
+        /* only the oneshot kernel is built; also with two queues: */
+        for (std::size_t queueCount : {1, 2}) {
+            failures += runTestCases(progCtx, device, false, false, false,
+                                     0, false, queueCount, 0,
+                                     casesFrom, casesTo);
+        }
+        return failures;
+    }
+    for (auto allowPersistent : {false, true}) {
+        failures += runTestCases(progCtx, device, true, false,
+                                 allowPersistent, 0, false, 1, 0,
+                                 casesFrom, casesTo);
+    }
+    for (auto allowLocalMemory : {false, true}) {
+        failures += runTestCases(progCtx, device, false,
+                                 allowLocalMemory, false, 0, false, 1, 0,
+                                 casesFrom, casesTo);
+    }
+    /* the same, with the jobs that do not fit into one work-group
+     * computed by the persistent kernel (only those are run): */
+    failures += runTestCases(progCtx, device, false, false, true, 0, false,
+                             1, 0, casesFrom, casesTo);
+    /* an odd chunk size, so that chunks start in the middle
+     * of an address block: */
+    failures += runTestCases(progCtx, device, true, false, false, 100,
+                             false, 1, 0, casesFrom, casesTo);
+    failures += runTestCases(progCtx, device, false, false, false, 0,
+                             true, 1, 0, casesFrom, casesTo);
+    /* the batch split between two queues, with and without chunks: */
+    for (std::size_t chunkBlocks : {0, 100}) {
+        failures += runTestCases(progCtx, device, true, false, false,
+                                 chunkBlocks, false, 2, 0,
+                                 casesFrom, casesTo);
+    }
+    failures += runStreamingTestCases(progCtx, device, casesFrom, casesTo);
+    return failures;
+}
+
+/* only plans, does not allocate anything: */
+static std::size_t checkMemoryPlanner(const Device &device)
+{
+    std::cerr << "Running memory planner tests..." << std::endl;
+
+    std::size_t failures = 0;
+    std::size_t jobMemorySize = std::size_t(1) << 20;
+    auto maxAllocSize = device.getProperties().maxMemAllocSize;
+    auto maxBatchSize = MemoryPlanner::getMaxBatchSize(device, jobMemorySize);
+    if (maxBatchSize == 0) {
+        ++failures;
+    }
+
+    auto shards = MemoryPlanner::planShards(device, jobMemorySize,
+                                            maxBatchSize, 2);
+    std::size_t nextJob = 0;
+    for (auto &shard : shards) {
+        if (shard.firstJob != nextJob || shard.jobs == 0 ||
+                shard.jobs * jobMemorySize > maxAllocSize) {
+            ++failures;
+        }
+        nextJob += shard.jobs;
+    }
+    if (nextJob != maxBatchSize || shards.size() < 2) {
+        ++failures;
+    }
+
+    bool thrown = false;
+    try {
+        MemoryPlanner::planShards(device, jobMemorySize, maxBatchSize + 1);
+    } catch (const std::length_error &) {
+        thrown = true;
+    }
+    if (!thrown) {
+        ++failures;
+    }
+
+    /* lanes of just over half an allocation need a buffer each: */
+    std::size_t laneMemorySize = maxAllocSize / 2 + 1;
+    if (MemoryPlanner::getLanesPerBuffer(device, laneMemorySize, 4) != 1 ||
+            MemoryPlanner::getLanesPerBuffer(device, jobMemorySize, 4) != 4) {
+        ++failures;
+    }
+    thrown = false;
+    try {
+        MemoryPlanner::getLanesPerBuffer(
+                    device, laneMemorySize,
+                    MemoryPlanner::MAX_LANE_BUFFERS + 1);
+    } catch (const std::length_error &) {
+        thrown = true;
+    }
+    if (!thrown) {
+        ++failures;
+    }
+
+    if (failures) {
+        std::cerr << "  FAIL" << std::endl;
+    } else {
+        std::cerr << "  ALL PASSED" << std::endl;
+    }
+    return failures;
+}
+
+/* all combinations of the kernel variants, then the instrumented and the
+ * portable-arithmetic kernels (on top of the default variant only): */
+static std::vector<unsigned int> getTestedKernelFlags()
+{
+    static const unsigned int FLAGS_ALL =
+            KERNEL_PREFETCH_REFS | KERNEL_VECTOR_ACCESS | KERNEL_REGISTER_STATE;
+
+    std::vector<unsigned int> res;
+    for (unsigned int kernelFlags = 0; kernelFlags <= FLAGS_ALL;
+         kernelFlags++) {
+        res.push_back(kernelFlags);
+    }
+    res.push_back(KERNEL_COUNTERS);
+    /* the other runs use the device's fast arithmetic, if it has any: */
+    res.push_back(KERNEL_PORTABLE_ARITHMETIC);
+    res.push_back(KERNEL_SPLIT_LANES);
+    res.push_back(KERNEL_GLOBAL_SCRATCH);
+    return res;
+}
+
+/* starts building all programs needed by runTests() in the background: */
+static void requestPrograms(ProgramPool &pool, const Device &device,
+                            Type type, Version version)
+{
+    for (auto kernelFlags : getTestedKernelFlags()) {
+        pool.get({ device }, type, version, kernelFlags);
+    }
+}
+
+std::size_t runTests(ProgramPool &pool, const std::vector<Device> &devices,
                      Type type, Version version,
                      const TestCase *casesFrom, const TestCase *casesTo)
 {
+    auto &device = devices[0];
     std::cerr << "Running tests for Argon2"
               << (type == ARGON2_I ? "i" : "d")
               << " v" << (version == ARGON2_VERSION_10 ? "1.0" : "1.3")
               << "..." << std::endl;
 
     std::size_t failures = 0;
-    ProgramContext progCtx(&global, { device }, type, version);
-    for (auto bySegment : {true, false}) {
-        for (auto tc = casesFrom; tc < casesTo; ++tc) {
-            std::cerr << "  " << (bySegment ? "[by-segment] " : "[oneshot] ");
-            tc->dump(std::cerr);
-            std::cerr << "... ";
-
-            auto &params = tc->getParams();
-            ProcessingUnit pu(&progCtx, &params, &device, 1, bySegment);
-
-            {
-                ProcessingUnit::PasswordWriter writer(pu);
-                writer.setPassword(tc->getInput(), tc->getInputLength());
-            }
-            pu.beginProcessing();
-            pu.endProcessing();
-
-            ProcessingUnit::HashReader hash(pu);
-            bool res = std::memcmp(tc->getOutput(), hash.getHash(),
-                                   params.getOutputLength()) == 0;
-            if (!res) {
-                ++failures;
-                std::cerr << "FAIL" << std::endl;
-            } else {
-                std::cerr << "PASS" << std::endl;
-            }
+    for (auto kernelFlags : getTestedKernelFlags()) {
+        auto progCtx = pool.get({ device }, type, version, kernelFlags).get();
+        if (progCtx->getKernelFlags() != kernelFlags) {
+            /* an overridden flag -- same as another combination */
+            continue;
+        }
+        failures += runAllModes(*progCtx, device, casesFrom, casesTo);
+    }
+    failures += runDispatcherTestCases(pool, devices, type, version,
+                                       casesFrom, casesTo);
+    if (!failures) {
+        std::cerr << "  ALL PASSED" << std::endl;
+    }
+    return failures;
+}
+
+std::size_t runCpuTests(Type type, Version version,
+                        const TestCase *casesFrom, const TestCase *casesTo)
+{
+    std::cerr << "Running CPU tests for Argon2"
+              << (type == ARGON2_I ? "i" : "d")
+              << " v" << (version == ARGON2_VERSION_10 ? "1.0" : "1.3")
+              << "..." << std::endl;
+
+    /* one thread; then fewer jobs than threads (the lanes are spread
+     * over the threads) and as many (each thread computes whole jobs): */
+    cpu::ThreadPool single(1), multi(3);
+    auto best = cpu::getBestImplementation();
+    std::size_t failures = 0;
+    failures += runCpuTestCases(single, type, version, 1, best,
+                                casesFrom, casesTo);
+    failures += runCpuTestCases(multi, type, version, 1, best,
+                                casesFrom, casesTo);
+    failures += runCpuTestCases(multi, type, version, 3, best,
+                                casesFrom, casesTo);
+
+    /* segments computed in turns: whole jobs per thread, and the lanes
+     * of fewer jobs than threads (lockstep would take over Argon2i
+     * batches of many jobs): */
+    failures += runCpuTestCases(single, type, version, 3, best,
+                                casesFrom, casesTo, nullptr, 2);
+    failures += runCpuTestCases(multi, type, version, 2, best,
+                                casesFrom, casesTo, nullptr, 3);
+
+    /* Argon2i jobs in lockstep, the last group only partly used; the
+     * second time with the memory left over by the first: */
+    auto lockstepJobs = cpu::getLockstepJobs(best);
+    if (type == ARGON2_I && lockstepJobs > 1) {
+        cpu::MemoryPool memoryPool;
+        for (int i = 0; i < 2; i++) {
+            failures += runCpuTestCases(multi, type, version,
+                                        lockstepJobs + 1, best,
+                                        casesFrom, casesTo, &memoryPool);
+        }
+    }
+
+    /* the other instruction sets that the CPU supports: */
+    for (int i = 0; i < cpu::IMPLEMENTATION_COUNT; i++) {
+        auto impl = static_cast<cpu::Implementation>(i);
+        if (impl != best && cpu::isImplementationSupported(impl)) {
+            failures += runCpuTestCases(single, type, version, 1, impl,
+                                        casesFrom, casesTo);
         }
     }
     if (!failures) {
@@ -187,6 +781,19 @@ const TestCase CASES_I_10[] = {
         "\xc3\x89\x25\x69\xd4\xf1\xc4\x97",
         "password", 8
     },
+    /* more lanes than fit into one work-group (or its local memory),
+     * so the oneshot mode falls back to one work-group per lane: */
+    {
+        {
+            32, "somesalt", 8, nullptr, 0, nullptr, 0,
+            2, UINT32_C(1) << 10, 64
+        },
+        "\xdc\x34\x25\x57\xaf\x02\xb0\x69"
+        "\x37\x0a\xe9\x51\x19\xf2\x4a\x38"
+        "\x4e\x29\x28\xb3\x8d\x0e\x53\x08"
+        "\x76\x14\x77\x6e\x46\x43\x6d\x8e",
+        "password", 8
+    },
 };
 
 const TestCase CASES_I_13[] = {
@@ -286,6 +893,19 @@ const TestCase CASES_I_13[] = {
         "\xe9\xcc\x40\x72\x6c\x52\x12\x71",
         "password", 8
     },
+    /* more lanes than fit into one work-group (or its local memory),
+     * so the oneshot mode falls back to one work-group per lane: */
+    {
+        {
+            32, "somesalt", 8, nullptr, 0, nullptr, 0,
+            2, UINT32_C(1) << 10, 64
+        },
+        "\x72\x83\x40\x1b\x70\x1c\x90\xce"
+        "\xd3\x1e\xd8\xfd\x9d\xf9\xa4\x74"
+        "\x31\x8c\xb3\x3b\x2a\xf3\x69\xc5"
+        "\x10\x68\xb7\xf6\x5a\x19\xdb\x8d",
+        "password", 8
+    },
 };
 
 const TestCase CASES_D_13[] = {
@@ -308,29 +928,72 @@ const TestCase CASES_D_13[] = {
         "\x01\x01\x01\x01\x01\x01\x01\x01"
         "\x01\x01\x01\x01\x01\x01\x01\x01", 32
     },
+    /* more lanes than fit into one work-group (or its local memory),
+     * so the oneshot mode falls back to one work-group per lane: */
+    {
+        {
+            32, "somesalt", 8, nullptr, 0, nullptr, 0,
+            2, UINT32_C(1) << 10, 64
+        },
+        "\xfa\x0d\x36\xb2\x6b\x0c\x40\xc1"
+        "\x42\x50\xa8\xbc\xc6\x9f\xe2\xe0"
+        "\xcf\x35\xbe\x34\xfc\xa1\x0f\x48"
+        "\xd2\x23\x64\x5b\xc7\x71\x4d\xe2",
+        "password", 8
+    },
 };
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 #define ARRAY_BEGIN(a) (a)
 #define ARRAY_END(a) ((a) + ARRAY_SIZE(a))
 
-int main(void) {
+static std::size_t runOpenCLTests(GlobalContext &global,
+                                  const std::vector<Device> &devices)
+{
+    auto &device = devices[0];
+
+    ProgramPool pool(&global);
+    requestPrograms(pool, device, ARGON2_I, ARGON2_VERSION_10);
+    requestPrograms(pool, device, ARGON2_I, ARGON2_VERSION_13);
+    requestPrograms(pool, device, ARGON2_D, ARGON2_VERSION_13);
+
     std::size_t failures = 0;
-    try {
-        GlobalContext global;
-        auto &devices = global.getAllDevices();
-        auto &device = devices[0];
-
-        failures += runTests(global, device, ARGON2_I, ARGON2_VERSION_10,
-                             ARRAY_BEGIN(CASES_I_10), ARRAY_END(CASES_I_10));
-        failures += runTests(global, device, ARGON2_I, ARGON2_VERSION_13,
-                             ARRAY_BEGIN(CASES_I_13), ARRAY_END(CASES_I_13));
-        failures += runTests(global, device, ARGON2_D, ARGON2_VERSION_13,
-                             ARRAY_BEGIN(CASES_D_13), ARRAY_END(CASES_D_13));
-    } catch (cl::Error &err) {
-        std::cerr << "OpenCL ERROR: " << err.err() << ": "
-                  << err.what() << std::endl;
-        return 2;
+    failures += checkMemoryPlanner(device);
+    failures += runTests(pool, devices, ARGON2_I, ARGON2_VERSION_10,
+                         ARRAY_BEGIN(CASES_I_10), ARRAY_END(CASES_I_10));
+    failures += runTests(pool, devices, ARGON2_I, ARGON2_VERSION_13,
+                         ARRAY_BEGIN(CASES_I_13), ARRAY_END(CASES_I_13));
+    failures += runTests(pool, devices, ARGON2_D, ARGON2_VERSION_13,
+                         ARRAY_BEGIN(CASES_D_13), ARRAY_END(CASES_D_13));
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    /* '--cpu' skips the OpenCL tests: */
+    bool cpuOnly = argc > 1 && std::string(argv[1]) == "--cpu";
+
+    std::size_t failures = 0;
+    failures += runCpuTests(ARGON2_I, ARGON2_VERSION_10,
+                            ARRAY_BEGIN(CASES_I_10), ARRAY_END(CASES_I_10));
+    failures += runCpuTests(ARGON2_I, ARGON2_VERSION_13,
+                            ARRAY_BEGIN(CASES_I_13), ARRAY_END(CASES_I_13));
+    failures += runCpuTests(ARGON2_D, ARGON2_VERSION_13,
+                            ARRAY_BEGIN(CASES_D_13), ARRAY_END(CASES_D_13));
+    if (!cpuOnly) {
+        try {
+            GlobalContext global;
+            auto &devices = global.getAllDevices();
+            if (devices.empty()) {
+                std::cerr << "No OpenCL devices found, skipping the OpenCL tests"
+                          << std::endl;
+            } else {
+                failures += runOpenCLTests(global, devices);
+            }
+        } catch (cl::Error &err) {
+            std::cerr << "OpenCL ERROR: " << err.err() << ": "
+                      << err.what() << std::endl;
+            return 2;
+        }
     }
 
     if (failures) {